@@ -0,0 +1,633 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <json.h>
+#include <format.h>
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void report(const char* name, double seconds, size_t operations, size_t bytes) {
+	printf("%s:%*s%8.3f ms  %10.1f ns/op", name, (int) (30 - strlen(name)), "", seconds * 1e3, seconds * 1e9 / operations);
+	if (bytes > 0) {
+		printf("  %8.1f MB/s", bytes / seconds / 1e6);
+	}
+	printf("\n");
+}
+
+void header(const char* text) {
+	printf("\n");
+	printf("=======================================\n");
+	printf("== %s\n", text);
+	printf("=======================================\n");
+}
+
+#define NUMBERS (1000000)
+
+static double* randomDoubles() {
+	double* values = malloc(sizeof(double) * NUMBERS);
+	srand(42);
+	for (size_t i = 0; i < NUMBERS; i++) {
+		values[i] = (rand() - RAND_MAX / 2) / 1000.0 * (rand() % 1000);
+	}
+	return values;
+}
+
+void benchFormat() {
+	double* values = randomDoubles();
+	char buffer[64];
+	size_t bytes;
+	double start;
+	
+	bytes = 0;
+	start = now();
+	for (size_t i = 0; i < NUMBERS; i++) {
+		bytes += snprintf(buffer, sizeof(buffer), "%.17g", values[i]);
+	}
+	report("snprintf %.17g", now() - start, NUMBERS, bytes);
+	
+	bytes = 0;
+	start = now();
+	for (size_t i = 0; i < NUMBERS; i++) {
+		bytes += json_format_double(buffer, values[i]);
+	}
+	report("json_format_double", now() - start, NUMBERS, bytes);
+	
+	bytes = 0;
+	start = now();
+	for (size_t i = 0; i < NUMBERS; i++) {
+		bytes += snprintf(buffer, sizeof(buffer), "%lld", (long long) (values[i] * 1000));
+	}
+	report("snprintf %lld", now() - start, NUMBERS, bytes);
+	
+	bytes = 0;
+	start = now();
+	for (size_t i = 0; i < NUMBERS; i++) {
+		bytes += json_format_long(buffer, (long long) (values[i] * 1000));
+	}
+	report("json_format_long", now() - start, NUMBERS, bytes);
+	
+	free(values);
+}
+
+static jsonValue_t* numberDocument() {
+	double* values = randomDoubles();
+	jsonValue_t** entries = malloc(sizeof(jsonValue_t*) * NUMBERS);
+	for (size_t i = 0; i < NUMBERS; i++) {
+		if (i % 2 == 0) {
+			entries[i] = json_double(values[i]);
+		} else {
+			entries[i] = json_long((long) (values[i] * 1000));
+		}
+	}
+	jsonValue_t* value = json_array_direct(true, NUMBERS, entries);
+	free(entries);
+	free(values);
+	return value;
+}
+
+void benchStringify() {
+	jsonValue_t* value = numberDocument();
+	
+	double start = now();
+	char* string = json_stringify(value);
+	report("stringify numbers", now() - start, NUMBERS, strlen(string));
+	
+	free(string);
+	json_free(value);
+}
+
+#define STRINGS (100000)
+#define STRING_LENGTH (200)
+
+static jsonValue_t* stringDocument() {
+	char string[STRING_LENGTH + 1];
+	for (size_t i = 0; i < STRING_LENGTH; i++) {
+		string[i] = 'a' + i % 26;
+	}
+	string[STRING_LENGTH] = '\0';
+	
+	jsonValue_t** entries = malloc(sizeof(jsonValue_t*) * STRINGS);
+	for (size_t i = 0; i < STRINGS; i++) {
+		// every tenth string needs escaping
+		string[i % STRING_LENGTH] = i % 10 == 0 ? '"' : 'x';
+		entries[i] = json_string(string);
+	}
+	jsonValue_t* value = json_array_direct(true, STRINGS, entries);
+	free(entries);
+	return value;
+}
+
+void benchStringifyStrings() {
+	jsonValue_t* value = stringDocument();
+	
+	double start = now();
+	char* string = json_stringify(value);
+	report("stringify long strings", now() - start, STRINGS, strlen(string));
+	
+	free(string);
+	json_free(value);
+}
+
+void benchStringifyParallel() {
+	jsonValue_t* value = numberDocument();
+	
+	for (int threads = 1; threads <= 8; threads *= 2) {
+		double start = now();
+		char* string = json_stringify_parallel(value, threads);
+		char name[64];
+		snprintf(name, sizeof(name), "stringify numbers, %d threads", threads);
+		report(name, now() - start, NUMBERS, strlen(string));
+		free(string);
+	}
+	
+	json_free(value);
+}
+
+#define RECORDS (20000)
+
+void benchStringifyCached() {
+	jsonValue_t** entries = malloc(sizeof(jsonValue_t*) * RECORDS);
+	for (size_t i = 0; i < RECORDS; i++) {
+		entries[i] = json_object(true, 3,
+			"id", json_long(i),
+			"name", json_string("a record with a reasonably long name"),
+			"values", json_array(true, 3, json_double(i / 3.0), json_double(i * 1.5), json_bool(i % 2))
+		);
+	}
+	jsonValue_t* value = json_object(true, 1, "records", json_array_direct(true, RECORDS, entries));
+	free(entries);
+	
+	double start = now();
+	char* string = json_stringify(value);
+	report("stringify records", now() - start, RECORDS, strlen(string));
+	free(string);
+	
+	json_cache(value);
+	
+	// change 1% of the records
+	char query[64];
+	for (size_t i = 0; i < RECORDS; i += 100) {
+		snprintf(query, sizeof(query), ".records.[%zu].id", i);
+		json_set(value, query, json_long(-i));
+	}
+	
+	start = now();
+	string = json_stringify(value);
+	report("stringify records, 1% changed", now() - start, RECORDS, strlen(string));
+	free(string);
+	
+	json_free(value);
+}
+
+void benchStringifySpans() {
+	jsonValue_t** entries = malloc(sizeof(jsonValue_t*) * RECORDS);
+	for (size_t i = 0; i < RECORDS; i++) {
+		entries[i] = json_object(true, 3,
+			"id", json_long(i),
+			"name", json_string("a record with a reasonably long name"),
+			"values", json_array(true, 3, json_double(i / 3.0), json_double(i * 1.5), json_bool(i % 2))
+		);
+	}
+	jsonValue_t* value = json_object(true, 2,
+		"version", json_long(1),
+		"records", json_array_direct(true, RECORDS, entries)
+	);
+	free(entries);
+	char* text = json_stringify(value);
+	json_free(value);
+	
+	const char* names[] = { "forward, plain", "forward, spans" };
+	int flags[] = { 0, JSON_PARSE_SPANS };
+	
+	for (size_t i = 0; i < 2; i++) {
+		value = json_parse_with(text, strlen(text), flags[i]);
+		json_set(value, ".version", json_long(2));
+		
+		double start = now();
+		char* string = json_stringify(value);
+		report(names[i], now() - start, RECORDS, strlen(string));
+		free(string);
+		
+		json_free(value);
+	}
+	
+	free(text);
+}
+
+#define CLONES (100)
+
+void benchClone() {
+	jsonValue_t** entries = malloc(sizeof(jsonValue_t*) * RECORDS);
+	for (size_t i = 0; i < RECORDS; i++) {
+		entries[i] = json_object(true, 2,
+			"id", json_long(i),
+			"name", json_string("a record")
+		);
+	}
+	jsonValue_t* value = json_object(true, 1, "records", json_array_direct(true, RECORDS, entries));
+	free(entries);
+	
+	jsonValue_t* clones[CLONES];
+	
+	double start = now();
+	for (size_t i = 0; i < CLONES; i++) {
+		clones[i] = json_clone(value);
+	}
+	for (size_t i = 0; i < CLONES; i++) {
+		json_free(clones[i]);
+	}
+	report("clone/free, deep", now() - start, CLONES, 0);
+	
+	start = now();
+	for (size_t i = 0; i < CLONES; i++) {
+		clones[i] = json_share(value);
+		json_set(clones[i], ".records.[0].id", json_long(-1));
+	}
+	for (size_t i = 0; i < CLONES; i++) {
+		json_free(clones[i]);
+	}
+	report("clone/set/free, shared", now() - start, CLONES, 0);
+	
+	json_free(value);
+}
+
+#define PUSHES (1000000)
+
+void benchPush() {
+	jsonValue_t* array = json_array(true, 0);
+	
+	double start = now();
+	for (size_t i = 0; i < PUSHES; i++) {
+		json_array_push(array, json_long(i));
+	}
+	report("json_array_push", now() - start, PUSHES, 0);
+	
+	json_free(array);
+}
+
+#define VERSIONS (200)
+
+void benchPersistent() {
+	jsonValue_t** entries = malloc(sizeof(jsonValue_t*) * RECORDS);
+	for (size_t i = 0; i < RECORDS; i++) {
+		entries[i] = json_object(true, 2,
+			"id", json_long(i),
+			"name", json_string("a record")
+		);
+	}
+	jsonValue_t* value = json_object(true, 1, "records", json_array_direct(true, RECORDS, entries));
+	free(entries);
+	
+	char query[64];
+	jsonValue_t* snapshots[VERSIONS];
+	
+	double start = now();
+	jsonValue_t* current = value;
+	for (size_t i = 0; i < VERSIONS; i++) {
+		snapshots[i] = json_clone(current);
+		snprintf(query, sizeof(query), ".records.[%zu].id", i * 97 % RECORDS);
+		json_set(snapshots[i], query, json_long(-1));
+		current = snapshots[i];
+	}
+	report("snapshot/set, clone", now() - start, VERSIONS, 0);
+	for (size_t i = 0; i < VERSIONS; i++) {
+		json_free(snapshots[i]);
+	}
+	
+	jsonPersistent_t* versions[VERSIONS + 1];
+	
+	start = now();
+	versions[0] = json_persistent_new(value);
+	report("persistent, convert", now() - start, 1, 0);
+	
+	start = now();
+	for (size_t i = 0; i < VERSIONS; i++) {
+		snprintf(query, sizeof(query), ".records.[%zu].id", i * 97 % RECORDS);
+		versions[i + 1] = json_persistent_set(versions[i], query, json_long(-1));
+	}
+	report("snapshot/set, persistent", now() - start, VERSIONS, 0);
+	for (size_t i = 0; i <= VERSIONS; i++) {
+		json_persistent_release(versions[i]);
+	}
+	
+	json_free(value);
+}
+
+#define COMPARISONS (50)
+
+void benchEqual() {
+	jsonValue_t** entries = malloc(sizeof(jsonValue_t*) * RECORDS);
+	for (size_t i = 0; i < RECORDS; i++) {
+		entries[i] = json_object(true, 3,
+			"id", json_long(i),
+			"name", json_string("a record"),
+			"values", json_array(true, 2, json_double(i / 3.0), json_bool(i % 2))
+		);
+	}
+	jsonValue_t* a = json_array_direct(true, RECORDS, entries);
+	free(entries);
+	jsonValue_t* b = json_clone(a);
+	
+	bool equal = true;
+	double start = now();
+	for (size_t i = 0; i < COMPARISONS; i++) {
+		char* stringA = json_stringify(a);
+		char* stringB = json_stringify(b);
+		equal = equal && strcmp(stringA, stringB) == 0;
+		free(stringA);
+		free(stringB);
+	}
+	report("stringify/strcmp", now() - start, COMPARISONS, 0);
+	
+	start = now();
+	for (size_t i = 0; i < COMPARISONS; i++) {
+		equal = equal && json_equal(a, b);
+	}
+	report("json_equal", now() - start, COMPARISONS, 0);
+	
+	start = now();
+	for (size_t i = 0; i < COMPARISONS; i++) {
+		equal = equal && json_equal_with(a, b, JSON_EQUAL_UNORDERED);
+	}
+	report("json_equal, unordered", now() - start, COMPARISONS, 0);
+	
+	start = now();
+	uint64_t hash = json_hash(a);
+	report("json_hash, first", now() - start, 1, 0);
+	
+	start = now();
+	for (size_t i = 0; i < COMPARISONS; i++) {
+		equal = equal && json_hash(a) == hash;
+	}
+	report("json_hash, cached", now() - start, COMPARISONS, 0);
+	
+	if (!equal)
+		printf("  comparison failed\n");
+	
+	json_free(a);
+	json_free(b);
+}
+
+void benchDiff() {
+	jsonValue_t** entries = malloc(sizeof(jsonValue_t*) * RECORDS);
+	for (size_t i = 0; i < RECORDS; i++) {
+		entries[i] = json_object(true, 2,
+			"id", json_long(i),
+			"name", json_string("a record")
+		);
+	}
+	jsonValue_t* a = json_object(true, 1, "records", json_array_direct(true, RECORDS, entries));
+	free(entries);
+	jsonValue_t* b = json_clone(a);
+	json_set(b, ".records.[1234].name", json_string("changed"));
+	
+	double start = now();
+	jsonValue_t* patch = NULL;
+	for (size_t i = 0; i < COMPARISONS; i++) {
+		json_free(patch);
+		patch = json_diff(a, b);
+	}
+	report("json_diff, one change", now() - start, COMPARISONS, 0);
+	
+	size_t full = json_stringify_length(b);
+	size_t delta = json_stringify_length(patch);
+	printf("  %zu bytes document, %zu bytes patch\n", full, delta);
+	
+	start = now();
+	for (size_t i = 0; i < COMPARISONS; i++) {
+		json_patch_apply(a, patch);
+	}
+	report("json_patch_apply", now() - start, COMPARISONS, 0);
+	
+	json_free(patch);
+	json_free(a);
+	json_free(b);
+}
+
+#define ROUTES (10000)
+#define LOOKUPS (400000)
+
+struct lookupThread {
+	pthread_t thread;
+	jsonValue_t* table;
+	size_t lookups;
+	size_t found;
+};
+
+static void* lookupRoutes(void* argument) {
+	struct lookupThread* lookup = argument;
+	char query[64];
+	
+	for (size_t i = 0; i < lookup->lookups; i++) {
+		snprintf(query, sizeof(query), ".routes.r%zu.target", (i * 7919) % ROUTES);
+		jsonValue_t* result = json_query(lookup->table, query);
+		if (result != NULL && result->type == JSON_STRING)
+			lookup->found++;
+		json_free(result);
+	}
+	
+	return NULL;
+}
+
+static double lookupRounds(jsonValue_t* table, size_t threads, size_t total) {
+	struct lookupThread lookups[threads];
+	
+	double start = now();
+	for (size_t i = 0; i < threads; i++) {
+		lookups[i] = (struct lookupThread) { .table = table, .lookups = total / threads };
+		pthread_create(&lookups[i].thread, NULL, &lookupRoutes, &lookups[i]);
+	}
+	size_t found = 0;
+	for (size_t i = 0; i < threads; i++) {
+		pthread_join(lookups[i].thread, NULL);
+		found += lookups[i].found;
+	}
+	double seconds = now() - start;
+	
+	if (found != total / threads * threads)
+		printf("  lookups failed\n");
+	
+	return seconds;
+}
+
+void benchFrozenReads() {
+	jsonValue_t* routes = json_object(true, 0);
+	char key[32];
+	char target[32];
+	for (size_t i = 0; i < ROUTES; i++) {
+		snprintf(key, sizeof(key), "r%zu", i);
+		snprintf(target, sizeof(target), "10.0.%zu.%zu", i / 256, i % 256);
+		json_object_set(routes, key, json_object(true, 2, "target", json_string(target), "weight", json_long(i % 100)));
+	}
+	jsonValue_t* table = json_object(true, 1, "routes", routes);
+	
+	// without the index every lookup searches the routes linearly
+	report("json_query, mutable, 1 thread", lookupRounds(table, 1, LOOKUPS / 100), LOOKUPS / 100, 0);
+	
+	double start = now();
+	json_freeze(table);
+	report("json_freeze", now() - start, ROUTES, 0);
+	
+	for (size_t threads = 1; threads <= 8; threads *= 2) {
+		char name[64];
+		snprintf(name, sizeof(name), "json_query, frozen, %zu threads", threads);
+		report(name, lookupRounds(table, threads, LOOKUPS), LOOKUPS, 0);
+	}
+	
+	json_free(table);
+}
+
+static size_t systemAllocations;
+
+static void* countingMalloc(void* context, size_t size) {
+	systemAllocations++;
+	return malloc(size);
+}
+
+static void* countingRealloc(void* context, void* pointer, size_t size) {
+	systemAllocations++;
+	return realloc(pointer, size);
+}
+
+static void countingFree(void* context, void* pointer) {
+	free(pointer);
+}
+
+#define ALLOCATOR_ROUNDS (20)
+
+static double allocatorRounds(const char* text) {
+	double start = now();
+	for (size_t i = 0; i < ALLOCATOR_ROUNDS; i++) {
+		jsonValue_t* value = json_parse(text);
+		jsonValue_t* clone = json_clone(value);
+		json_free(value);
+		json_free(clone);
+	}
+	return now() - start;
+}
+
+void benchAllocator() {
+	jsonValue_t** entries = malloc(sizeof(jsonValue_t*) * RECORDS);
+	for (size_t i = 0; i < RECORDS; i++) {
+		entries[i] = json_object(true, 3,
+			"id", json_long(i),
+			"name", json_string("a record"),
+			"values", json_array(true, 2, json_double(i / 3.0), json_bool(i % 2))
+		);
+	}
+	jsonValue_t* value = json_array_direct(true, RECORDS, entries);
+	free(entries);
+	char* text = json_stringify(value);
+	json_free(value);
+	
+	systemAllocations = 0;
+	json_set_allocator(&countingMalloc, &countingRealloc, &countingFree, NULL);
+	double seconds = allocatorRounds(text);
+	json_set_allocator(NULL, NULL, NULL, NULL);
+	report("parse/clone/free, malloc", seconds, ALLOCATOR_ROUNDS * RECORDS, 0);
+	printf("  %zu allocator calls\n", systemAllocations);
+	
+	jsonPool_t* pool = json_pool_new();
+	json_set_thread_allocator(&json_pool_malloc, &json_pool_realloc, &json_pool_free, pool);
+	seconds = allocatorRounds(text);
+	json_set_thread_allocator(NULL, NULL, NULL, NULL);
+	report("parse/clone/free, pool", seconds, ALLOCATOR_ROUNDS * RECORDS, 0);
+	printf("  %zu KiB in 64 KiB chunks, reused across rounds\n", json_pool_size(pool) / 1024);
+	json_pool_destroy(pool);
+	
+	jsonAllocatorStats_t stats = { 0 };
+	json_set_thread_allocator(&json_stats_malloc, &json_stats_realloc, &json_stats_free, &stats);
+	value = json_parse(text);
+	printf("  %zu bytes of text, %zu bytes parsed (peak %zu)\n", strlen(text), json_memory_usage(value, NULL), stats.peak);
+	json_free(value);
+	json_set_thread_allocator(NULL, NULL, NULL, NULL);
+	
+	free(text);
+}
+
+#define PRODUCTS (20000)
+
+void benchIntern() {
+	static const char* streets[] = { "Main St", "Elm St", "Oak Ave", "Pine Rd", "Cedar Ln" };
+	static const char* tags[] = { "new", "sale", "popular", "limited", "outdoor", "kitchen" };
+	char name[32];
+	
+	jsonValue_t** entries = malloc(sizeof(jsonValue_t*) * PRODUCTS);
+	for (size_t i = 0; i < PRODUCTS; i++) {
+		snprintf(name, sizeof(name), "product %zu", i);
+		entries[i] = json_object(true, 4,
+			"id", json_long(i),
+			"name", json_string(name),
+			"warehouse", json_object(true, 3,
+				"street", json_string(streets[i % 5]),
+				"city", json_string("Springfield"),
+				"zip", json_long(10000 + i % 5)
+			),
+			"tags", json_array(true, 2, json_string(tags[i % 6]), json_string(tags[i % 4]))
+		);
+	}
+	jsonValue_t* value = json_array_direct(true, PRODUCTS, entries);
+	free(entries);
+	char* text = json_stringify(value);
+	json_free(value);
+	size_t length = strlen(text);
+	
+	jsonAllocatorStats_t stats = { 0 };
+	json_set_thread_allocator(&json_stats_malloc, &json_stats_realloc, &json_stats_free, &stats);
+	
+	double start = now();
+	value = json_parse(text);
+	report("parse catalog", now() - start, PRODUCTS, length);
+	size_t plain = stats.bytes;
+	
+	start = now();
+	json_intern_subtrees(value);
+	report("json_intern_subtrees", now() - start, PRODUCTS, 0);
+	printf("  %zu KiB before, %zu KiB after interning\n", plain / 1024, stats.bytes / 1024);
+	json_free(value);
+	
+	start = now();
+	value = json_parse_with(text, length, JSON_PARSE_INTERN);
+	report("parse catalog, JSON_PARSE_INTERN", now() - start, PRODUCTS, length);
+	json_free(value);
+	
+	json_set_thread_allocator(NULL, NULL, NULL, NULL);
+	
+	free(text);
+}
+
+int main(int argc, char** argv) {
+	header("Number Formatting");
+	benchFormat();
+	
+	header("Stringify");
+	benchStringify();
+	benchStringifyStrings();
+	benchStringifyParallel();
+	benchStringifyCached();
+	benchStringifySpans();
+	
+	header("Concurrent Reads");
+	benchFrozenReads();
+	
+	header("Comparison");
+	benchEqual();
+	benchDiff();
+	
+	header("Allocation");
+	benchAllocator();
+	benchClone();
+	benchPush();
+	benchPersistent();
+	benchIntern();
+	
+	return 0;
+}
@@ -0,0 +1,322 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "json.h"
+#include "alloc.h"
+
+static void* json_default_malloc(void* context, size_t size) {
+	(void) context;
+	return malloc(size);
+}
+
+static void* json_default_realloc(void* context, void* pointer, size_t size) {
+	(void) context;
+	return realloc(pointer, size);
+}
+
+static void json_default_free(void* context, void* pointer) {
+	(void) context;
+	free(pointer);
+}
+
+struct jsonAllocator json_allocator_global = {
+	.malloc = &json_default_malloc,
+	.realloc = &json_default_realloc,
+	.free = &json_default_free,
+	.context = NULL,
+};
+
+__thread struct jsonAllocator json_allocator_thread = {
+	.malloc = NULL,
+	.realloc = NULL,
+	.free = NULL,
+	.context = NULL,
+};
+
+void json_set_allocator(jsonMallocFunction_t malloc, jsonReallocFunction_t realloc, jsonFreeFunction_t free, void* context) {
+	if (malloc == NULL || realloc == NULL || free == NULL) {
+		malloc = &json_default_malloc;
+		realloc = &json_default_realloc;
+		free = &json_default_free;
+		context = NULL;
+	}
+	
+	json_allocator_global = (struct jsonAllocator) {
+		.malloc = malloc,
+		.realloc = realloc,
+		.free = free,
+		.context = context,
+	};
+}
+
+void json_set_thread_allocator(jsonMallocFunction_t malloc, jsonReallocFunction_t realloc, jsonFreeFunction_t free, void* context) {
+	if (malloc == NULL || realloc == NULL || free == NULL) {
+		malloc = NULL;
+		realloc = NULL;
+		free = NULL;
+		context = NULL;
+	}
+	
+	json_allocator_thread = (struct jsonAllocator) {
+		.malloc = malloc,
+		.realloc = realloc,
+		.free = free,
+		.context = context,
+	};
+}
+
+/*
+ * Size-class pool: Small blocks are carved out of large chunks and kept in
+ * one free list per size class; freed blocks are reused but only returned
+ * to the system when the pool is destroyed. Every block starts with a
+ * header that holds its size class, since the free function doesn't get
+ * the size. Blocks larger than the largest class are passed to malloc().
+ * A pool is not thread-safe; use one pool per thread.
+ */
+
+#define JSON_POOL_CHUNK_SIZE (64 * 1024)
+#define JSON_POOL_HEADER_SIZE (sizeof(struct jsonPoolBlock))
+#define JSON_POOL_LARGE (UINT32_MAX)
+
+// block sizes without the header
+static const size_t json_pool_classes[] = {
+	8, 24, 40, 56, 88, 120, 184, 248, 376, 504,
+};
+
+#define JSON_POOL_CLASSES (sizeof(json_pool_classes) / sizeof(json_pool_classes[0]))
+
+struct jsonPoolBlock {
+	uint32_t sizeClass;
+	// only valid for large blocks
+	uint32_t size;
+};
+
+struct jsonPoolFree {
+	struct jsonPoolFree* next;
+};
+
+struct jsonPoolChunk {
+	struct jsonPoolChunk* next;
+};
+
+struct jsonPool {
+	struct jsonPoolFree* free[JSON_POOL_CLASSES];
+	struct jsonPoolChunk* chunks;
+	// unused memory at the end of the current chunk
+	char* current;
+	size_t remaining;
+	size_t size;
+};
+
+jsonPool_t* json_pool_new() {
+	jsonPool_t* pool = malloc(sizeof(jsonPool_t));
+	if (pool == NULL)
+		return NULL;
+	
+	memset(pool, 0, sizeof(jsonPool_t));
+	
+	return pool;
+}
+
+void json_pool_destroy(jsonPool_t* pool) {
+	if (pool == NULL)
+		return;
+	
+	struct jsonPoolChunk* chunk = pool->chunks;
+	while (chunk != NULL) {
+		struct jsonPoolChunk* next = chunk->next;
+		free(chunk);
+		chunk = next;
+	}
+	
+	free(pool);
+}
+
+size_t json_pool_size(jsonPool_t* pool) {
+	return pool->size;
+}
+
+static inline uint32_t json_pool_class(size_t size) {
+	for (uint32_t i = 0; i < JSON_POOL_CLASSES; i++) {
+		if (size <= json_pool_classes[i])
+			return i;
+	}
+	return JSON_POOL_LARGE;
+}
+
+static struct jsonPoolBlock* json_pool_carve(jsonPool_t* pool, size_t size) {
+	if (pool->remaining < size) {
+		struct jsonPoolChunk* chunk = malloc(JSON_POOL_CHUNK_SIZE);
+		if (chunk == NULL)
+			return NULL;
+		
+		chunk->next = pool->chunks;
+		pool->chunks = chunk;
+		pool->size += JSON_POOL_CHUNK_SIZE;
+		
+		// the rest of the old chunk is lost; it is smaller than the largest class
+		pool->current = (char*) chunk + sizeof(struct jsonPoolChunk);
+		pool->remaining = JSON_POOL_CHUNK_SIZE - sizeof(struct jsonPoolChunk);
+	}
+	
+	struct jsonPoolBlock* block = (struct jsonPoolBlock*) pool->current;
+	pool->current += size;
+	pool->remaining -= size;
+	
+	return block;
+}
+
+void* json_pool_malloc(void* context, size_t size) {
+	jsonPool_t* pool = context;
+	uint32_t sizeClass = json_pool_class(size);
+	struct jsonPoolBlock* block;
+	
+	if (sizeClass == JSON_POOL_LARGE) {
+		if (size > UINT32_MAX - JSON_POOL_HEADER_SIZE)
+			return NULL;
+		block = malloc(JSON_POOL_HEADER_SIZE + size);
+		if (block == NULL)
+			return NULL;
+		block->size = size;
+	} else if (pool->free[sizeClass] != NULL) {
+		block = (struct jsonPoolBlock*) pool->free[sizeClass];
+		pool->free[sizeClass] = pool->free[sizeClass]->next;
+	} else {
+		block = json_pool_carve(pool, JSON_POOL_HEADER_SIZE + json_pool_classes[sizeClass]);
+		if (block == NULL)
+			return NULL;
+	}
+	
+	block->sizeClass = sizeClass;
+	
+	return block + 1;
+}
+
+void json_pool_free(void* context, void* pointer) {
+	if (pointer == NULL)
+		return;
+	
+	jsonPool_t* pool = context;
+	struct jsonPoolBlock* block = ((struct jsonPoolBlock*) pointer) - 1;
+	
+	if (block->sizeClass == JSON_POOL_LARGE) {
+		free(block);
+		return;
+	}
+	
+	// the free list link overwrites the header
+	uint32_t sizeClass = block->sizeClass;
+	struct jsonPoolFree* entry = (struct jsonPoolFree*) block;
+	entry->next = pool->free[sizeClass];
+	pool->free[sizeClass] = entry;
+}
+
+void* json_pool_realloc(void* context, void* pointer, size_t size) {
+	if (pointer == NULL)
+		return json_pool_malloc(context, size);
+	
+	struct jsonPoolBlock* block = ((struct jsonPoolBlock*) pointer) - 1;
+	
+	size_t capacity;
+	if (block->sizeClass == JSON_POOL_LARGE) {
+		if (json_pool_class(size) == JSON_POOL_LARGE) {
+			if (size > UINT32_MAX - JSON_POOL_HEADER_SIZE)
+				return NULL;
+			block = realloc(block, JSON_POOL_HEADER_SIZE + size);
+			if (block == NULL)
+				return NULL;
+			block->size = size;
+			return block + 1;
+		}
+		capacity = block->size;
+	} else {
+		capacity = json_pool_classes[block->sizeClass];
+		if (size <= capacity)
+			return pointer;
+	}
+	
+	void* result = json_pool_malloc(context, size);
+	if (result == NULL)
+		return NULL;
+	
+	memcpy(result, pointer, capacity < size ? capacity : size);
+	json_pool_free(context, pointer);
+	
+	return result;
+}
+
+/*
+ * Counting allocator: passes requests to another allocator and keeps
+ * statistics in the jsonAllocatorStats_t given as context. Every block is
+ * prefixed with its size, so frees can be accounted. The counters are
+ * updated atomically; one instance can be used as the global allocator.
+ */
+
+#define JSON_STATS_HEADER_SIZE (16)
+
+static void json_stats_add(jsonAllocatorStats_t* stats, size_t size) {
+	size_t bytes = __atomic_add_fetch(&stats->bytes, size, __ATOMIC_RELAXED);
+	size_t peak = __atomic_load_n(&stats->peak, __ATOMIC_RELAXED);
+	while (bytes > peak && !__atomic_compare_exchange_n(&stats->peak, &peak, bytes, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+void* json_stats_malloc(void* context, size_t size) {
+	jsonAllocatorStats_t* stats = context;
+	
+	size_t* block;
+	if (stats->malloc != NULL)
+		block = stats->malloc(stats->context, size + JSON_STATS_HEADER_SIZE);
+	else
+		block = malloc(size + JSON_STATS_HEADER_SIZE);
+	
+	if (block == NULL)
+		return NULL;
+	
+	*block = size;
+	__atomic_add_fetch(&stats->allocations, 1, __ATOMIC_RELAXED);
+	json_stats_add(stats, size);
+	
+	return (char*) block + JSON_STATS_HEADER_SIZE;
+}
+
+void json_stats_free(void* context, void* pointer) {
+	if (pointer == NULL)
+		return;
+	
+	jsonAllocatorStats_t* stats = context;
+	size_t* block = (size_t*) ((char*) pointer - JSON_STATS_HEADER_SIZE);
+	
+	__atomic_add_fetch(&stats->frees, 1, __ATOMIC_RELAXED);
+	__atomic_sub_fetch(&stats->bytes, *block, __ATOMIC_RELAXED);
+	
+	if (stats->free != NULL)
+		stats->free(stats->context, block);
+	else
+		free(block);
+}
+
+void* json_stats_realloc(void* context, void* pointer, size_t size) {
+	if (pointer == NULL)
+		return json_stats_malloc(context, size);
+	
+	jsonAllocatorStats_t* stats = context;
+	size_t* block = (size_t*) ((char*) pointer - JSON_STATS_HEADER_SIZE);
+	size_t previous = *block;
+	
+	if (stats->realloc != NULL)
+		block = stats->realloc(stats->context, block, size + JSON_STATS_HEADER_SIZE);
+	else
+		block = realloc(block, size + JSON_STATS_HEADER_SIZE);
+	
+	if (block == NULL)
+		return NULL;
+	
+	*block = size;
+	if (size >= previous)
+		json_stats_add(stats, size - previous);
+	else
+		__atomic_sub_fetch(&stats->bytes, previous - size, __ATOMIC_RELAXED);
+	
+	return (char*) block + JSON_STATS_HEADER_SIZE;
+}
@@ -0,0 +1,74 @@
+#ifndef JSON_ALLOC_H
+#define JSON_ALLOC_H
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "json.h"
+
+/*
+ * All allocations of the library go through these functions. They use the
+ * allocator of the current thread if one is set and the global allocator
+ * otherwise (see json_set_allocator()).
+ */
+
+struct jsonAllocator {
+	jsonMallocFunction_t malloc;
+	jsonReallocFunction_t realloc;
+	jsonFreeFunction_t free;
+	void* context;
+};
+
+extern struct jsonAllocator json_allocator_global;
+extern __thread struct jsonAllocator json_allocator_thread;
+
+static inline struct jsonAllocator* json_allocator() {
+	if (json_allocator_thread.malloc != NULL)
+		return &json_allocator_thread;
+	return &json_allocator_global;
+}
+
+static inline void* json_alloc(size_t size) {
+	struct jsonAllocator* allocator = json_allocator();
+	return allocator->malloc(allocator->context, size);
+}
+
+static inline void* json_realloc(void* pointer, size_t size) {
+	struct jsonAllocator* allocator = json_allocator();
+	return allocator->realloc(allocator->context, pointer, size);
+}
+
+static inline void json_dealloc(void* pointer) {
+	struct jsonAllocator* allocator = json_allocator();
+	allocator->free(allocator->context, pointer);
+}
+
+static inline void* json_calloc(size_t count, size_t size) {
+	if (size != 0 && count > (size_t) -1 / size)
+		return NULL;
+	
+	void* pointer = json_alloc(count * size);
+	if (pointer != NULL)
+		memset(pointer, 0, count * size);
+	return pointer;
+}
+
+static inline char* json_strdup(const char* string) {
+	size_t length = strlen(string) + 1;
+	char* copy = json_alloc(length);
+	if (copy != NULL)
+		memcpy(copy, string, length);
+	return copy;
+}
+
+static inline char* json_strndup(const char* string, size_t length) {
+	length = strnlen(string, length);
+	char* copy = json_alloc(length + 1);
+	if (copy != NULL) {
+		memcpy(copy, string, length);
+		copy[length] = '\0';
+	}
+	return copy;
+}
+
+#endif
@@ -5,47 +5,498 @@
 #include <string.h>
 
 #include "json.h"
+#include "alloc.h"
+#include "container.h"
 
-void json_free_r(jsonValue_t* value) {
-	jsonArray_t array;
-	jsonObject_t object;
+struct jsonContainerInfo* json_container_info(jsonValue_t* value) {
+	struct jsonContainerInfo** info = json_container_info_ref(value);
+	if (info == NULL)
+		return NULL;
+	
+	struct jsonContainerInfo* current = __atomic_load_n(info, __ATOMIC_ACQUIRE);
+	if (current != NULL)
+		return current;
+	
+	// shared containers may be accessed by several threads
+	struct jsonContainerInfo* created = json_calloc(1, sizeof(struct jsonContainerInfo));
+	if (created == NULL)
+		return NULL;
+	
+	if (!__atomic_compare_exchange_n(info, &current, created, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		json_dealloc(created);
+		return current;
+	}
+	
+	return created;
+}
 
-	switch(value->type) {
-		case JSON_NULL:
-			break;
-		case JSON_ARRAY:
-			array = value->value.array;
-			for (int i = 0; i < array.size; i++) {
-				json_free_r(&(array.entries[i]));
+// entries with room for size entries after the header; the info is NULL
+void* json_entries_alloc(size_t size, size_t entrySize) {
+	struct jsonEntriesHeader* header = json_alloc(sizeof(struct jsonEntriesHeader) + size * entrySize);
+	if (header == NULL)
+		return NULL;
+	
+	header->info = NULL;
+	header->document = NULL;
+	return header + 1;
+}
+
+// the header (and with it the info) moves with the entries
+void* json_entries_realloc(void* entries, size_t size, size_t entrySize) {
+	if (entries == NULL)
+		return json_entries_alloc(size, entrySize);
+	
+	struct jsonEntriesHeader* header = json_realloc(json_entries_header(entries), sizeof(struct jsonEntriesHeader) + size * entrySize);
+	return header == NULL ? NULL : header + 1;
+}
+
+// doesn't free the info
+void json_entries_free(void* entries) {
+	if (entries == NULL)
+		return;
+	
+	json_document_release(json_entries_header(entries)->document);
+	json_dealloc(json_entries_header(entries));
+}
+
+void json_document_release(struct jsonDocument* document) {
+	if (document != NULL && __atomic_sub_fetch(&document->references, 1, __ATOMIC_ACQ_REL) == 0)
+		json_dealloc(document);
+}
+
+void json_source_release(struct jsonSource* source) {
+	if (source != NULL && __atomic_sub_fetch(&source->references, 1, __ATOMIC_ACQ_REL) == 0)
+		json_dealloc(source);
+}
+
+// drops one owner of a container; returns true if there are other owners left
+static inline bool json_container_release(struct jsonContainerInfo* info) {
+	return info != NULL && __atomic_fetch_sub(&info->shares, 1, __ATOMIC_ACQ_REL) > 0;
+}
+
+// target becomes an additional owner of the payload of value; strings are copied
+static int json_share_r(jsonValue_t* value, jsonValue_t* target) {
+	if (value->type == JSON_ARRAY || value->type == JSON_OBJECT) {
+		// both have to reference the same info
+		struct jsonContainerInfo* info = json_container_info(value);
+		if (info == NULL)
+			return -1;
+		
+		__atomic_add_fetch(&info->shares, 1, __ATOMIC_RELAXED);
+	}
+	
+	*target = *value;
+	
+	if (value->type == JSON_STRING) {
+		target->value.string = json_strdup(value->value.string);
+		if (target->value.string == NULL)
+			return -1;
+	}
+	
+	return 0;
+}
+
+void json_free_r(jsonValue_t* value);
+
+// gives the container its own copy of the entries before it is modified; children stay shared
+int json_container_unshare(jsonValue_t* value) {
+	struct jsonContainerInfo* info = json_container_info_get(value);
+	if (info == NULL)
+		return 0;
+	// other owners of frozen entries get a modifiable copy; the last one can't modify them
+	if (__atomic_load_n(&info->shares, __ATOMIC_ACQUIRE) == 0)
+		return info->frozen ? -1 : 0;
+	
+	jsonValue_t copy = *value;
+	
+	if (value->type == JSON_ARRAY) {
+		size_t size = value->value.array.size;
+		copy.value.array.entries = json_entries_alloc(size, sizeof(jsonValue_t));
+		if (copy.value.array.entries == NULL)
+			return -1;
+		
+		for (size_t i = 0; i < size; i++) {
+			if (json_share_r(&value->value.array.entries[i], &copy.value.array.entries[i]) < 0) {
+				copy.value.array.size = i;
+				json_free_r(&copy);
+				return -1;
+			}
+		}
+	} else {
+		size_t size = value->value.object.size;
+		copy.value.object.entries = json_entries_alloc(size, sizeof(jsonObjectEntry_t));
+		if (copy.value.object.entries == NULL)
+			return -1;
+		
+		for (size_t i = 0; i < size; i++) {
+			copy.value.object.entries[i].key = json_strdup(value->value.object.entries[i].key);
+			if (copy.value.object.entries[i].key == NULL) {
+				copy.value.object.size = i;
+				json_free_r(&copy);
+				return -1;
+			}
+			if (json_share_r(&value->value.object.entries[i].value, &copy.value.object.entries[i].value) < 0) {
+				json_dealloc(copy.value.object.entries[i].key);
+				copy.value.object.size = i;
+				json_free_r(&copy);
+				return -1;
 			}
-			free(array.entries);
+		}
+	}
+	
+	// the copy stays in the document, so modifying it still invalidates the containers above
+	struct jsonDocument* document = json_container_document(value);
+	if (document != NULL) {
+		__atomic_add_fetch(&document->references, 1, __ATOMIC_RELAXED);
+		json_container_header(&copy)->document = document;
+	}
+	
+	// drop this owner from the shared payload
+	jsonValue_t shared = *value;
+	*value = copy;
+	json_free_r(&shared);
+	
+	return 0;
+}
+
+void json_container_info_free(struct jsonContainerInfo* info) {
+	if (info == NULL)
+		return;
+	
+	json_dealloc(info->cache);
+	json_dealloc(info->index);
+	json_dealloc(info->spans);
+	json_source_release(info->source);
+	json_dealloc(info);
+}
+
+// a container was modified without marking the containers above it
+void json_container_changed(jsonValue_t* value) {
+	struct jsonDocument* document = json_container_document(value);
+	if (document != NULL)
+		__atomic_add_fetch(&document->generation, 1, __ATOMIC_RELEASE);
+}
+
+// moves a container into another document; data that is still valid is kept
+static void json_document_move(jsonValue_t* value, struct jsonEntriesHeader* header, struct jsonDocument* document) {
+	struct jsonContainerInfo* info = header->info;
+	uint64_t generation = __atomic_load_n(&document->generation, __ATOMIC_ACQUIRE);
+	
+	if (info != NULL) {
+		if (info->cache != NULL && json_container_current(value, info, info->cache->generation)) {
+			info->cache->generation = generation;
+		} else {
+			json_dealloc(info->cache);
+			info->cache = NULL;
+		}
+		
+		if (json_container_current(value, info, info->spanGeneration)) {
+			info->spanGeneration = generation;
+		} else {
+			info->span.length = 0;
+			json_dealloc(info->spans);
+			info->spans = NULL;
+			info->spanCount = 0;
+		}
+		
+		if (json_container_current(value, info, info->hashGeneration)) {
+			info->hashGeneration = generation;
+		} else {
+			info->hashed = false;
+		}
+	}
+	
+	__atomic_add_fetch(&document->references, 1, __ATOMIC_RELAXED);
+	json_document_release(header->document);
+	header->document = document;
+}
+
+static void json_document_adopt_r(jsonValue_t* value, struct jsonDocument* document) {
+	struct jsonEntriesHeader* header = json_container_header(value);
+	if (header == NULL || header->document == document)
+		return;
+	
+	// shared containers are only modified through json_set(), which marks the path; frozen ones never change
+	struct jsonContainerInfo* info = header->info;
+	if (info != NULL && (info->frozen || __atomic_load_n(&info->shares, __ATOMIC_ACQUIRE) > 0))
+		return;
+	
+	json_document_move(value, header, document);
+	
+	if (value->type == JSON_ARRAY) {
+		for (size_t i = 0; i < value->value.array.size; i++) {
+			json_document_adopt_r(&value->value.array.entries[i], document);
+		}
+	} else {
+		for (size_t i = 0; i < value->value.object.size; i++) {
+			json_document_adopt_r(&value->value.object.entries[i].value, document);
+		}
+	}
+}
+
+// value was added to the container and joins its document
+void json_document_adopt(jsonValue_t* container, jsonValue_t* value) {
+	struct jsonDocument* document = json_container_document(container);
+	if (document != NULL)
+		json_document_adopt_r(value, document);
+}
+
+// gives a container that doesn't belong to a document yet a new one, so it can record data
+int json_document_attach(jsonValue_t* value) {
+	struct jsonEntriesHeader* header = json_container_header(value);
+	if (header == NULL || header->document != NULL)
+		return 0;
+	
+	struct jsonContainerInfo* info = header->info;
+	if (info != NULL && (info->frozen || __atomic_load_n(&info->shares, __ATOMIC_ACQUIRE) > 0))
+		return 0;
+	
+	struct jsonDocument* document = json_alloc(sizeof(struct jsonDocument));
+	if (document == NULL)
+		return -1;
+	document->references = 1;
+	document->generation = 0;
+	
+	json_document_adopt_r(value, document);
+	json_document_release(document);
+	
+	return 0;
+}
+
+// drops cached data of the container after it was modified; frozen containers keep theirs
+void json_container_dirty(jsonValue_t* value) {
+	struct jsonContainerInfo* info = json_container_info_get(value);
+	if (info == NULL || info->frozen)
+		return;
+	
+	json_dealloc(info->cache);
+	info->cache = NULL;
+	info->span.length = 0;
+	info->hashed = false;
+}
+
+// entry i of the container was replaced or modified
+void json_container_entry_dirty(jsonValue_t* value, size_t i) {
+	struct jsonContainerInfo* info = json_container_info_get(value);
+	if (info == NULL || info->frozen || i >= info->spanCount)
+		return;
+	
+	info->spans[i].length = 0;
+}
+
+// entries were added, removed or moved
+void json_container_entries_dirty(jsonValue_t* value) {
+	struct jsonContainerInfo* info = json_container_info_get(value);
+	if (info == NULL || info->frozen)
+		return;
+	
+	json_dealloc(info->spans);
+	info->spans = NULL;
+	info->spanCount = 0;
+}
+
+/*
+ * json_free_r() and json_clone_r() use an explicit work stack instead of
+ * recursion, so deeply nested documents can't overflow the call stack. The
+ * first items are kept on the call stack; deeper documents move the stack
+ * to the heap. If that fails the subtree is processed by a nested call.
+ */
+
+#define JSON_WORK_STACK_LOCAL (32)
+
+struct jsonFreeStack {
+	size_t size;
+	size_t capacity;
+	jsonValue_t* items;
+	jsonValue_t local[JSON_WORK_STACK_LOCAL];
+};
+
+struct jsonCloneItem {
+	jsonValue_t* value;
+	jsonValue_t* clone;
+};
+
+struct jsonCloneStack {
+	size_t size;
+	size_t capacity;
+	struct jsonCloneItem* items;
+	struct jsonCloneItem local[JSON_WORK_STACK_LOCAL];
+};
+
+// grows a work stack if it is full; returns false if that fails
+static bool json_work_stack_reserve(void** items, void* local, size_t* capacity, size_t size, size_t itemSize) {
+	if (size < *capacity)
+		return true;
+	
+	void* grown;
+	if (*items == local) {
+		grown = json_alloc(itemSize * *capacity * 2);
+		if (grown != NULL)
+			memcpy(grown, local, itemSize * size);
+	} else {
+		grown = json_realloc(*items, itemSize * *capacity * 2);
+	}
+	
+	if (grown == NULL)
+		return false;
+	
+	*items = grown;
+	*capacity *= 2;
+	
+	return true;
+}
+
+static inline void json_free_entry(struct jsonFreeStack* stack, jsonValue_t* entry) {
+	switch(entry->type) {
+		case JSON_STRING:
+			json_dealloc(entry->value.string);
 			break;
+		case JSON_ARRAY:
 		case JSON_OBJECT:
-			object = value->value.object;
-			for (int i = 0; i < object.size; i++) {
-				free(object.entries[i].key);
-				json_free_r(&(object.entries[i].value));
+			if (json_work_stack_reserve((void**) &stack->items, stack->local, &stack->capacity, stack->size, sizeof(jsonValue_t))) {
+				stack->items[stack->size++] = *entry;
+			} else {
+				json_free_r(entry);
 			}
-			free(object.entries);
-			break;
-		case JSON_STRING:
-			free(value->value.string);
 			break;
 		default:
 			break;
 	}
 }
 
+void json_free_r(jsonValue_t* value) {
+	if (value->type != JSON_ARRAY && value->type != JSON_OBJECT) {
+		if (value->type == JSON_STRING)
+			json_dealloc(value->value.string);
+		return;
+	}
+	
+	struct jsonFreeStack stack;
+	stack.size = 1;
+	stack.capacity = JSON_WORK_STACK_LOCAL;
+	stack.items = stack.local;
+	stack.local[0] = *value;
+	
+	while (stack.size > 0) {
+		jsonValue_t current = stack.items[--stack.size];
+		
+		if (current.type == JSON_ARRAY) {
+			jsonArray_t array = current.value.array;
+			struct jsonContainerInfo* info = json_container_info_get(&current);
+			if (json_container_release(info))
+				continue;
+			
+			for (size_t i = 0; i < array.size; i++) {
+				json_free_entry(&stack, &(array.entries[i]));
+			}
+			json_entries_free(array.entries);
+			json_container_info_free(info);
+		} else {
+			jsonObject_t object = current.value.object;
+			struct jsonContainerInfo* info = json_container_info_get(&current);
+			if (json_container_release(info))
+				continue;
+			
+			for (size_t i = 0; i < object.size; i++) {
+				json_dealloc(object.entries[i].key);
+				json_free_entry(&stack, &(object.entries[i].value));
+			}
+			json_entries_free(object.entries);
+			json_container_info_free(info);
+		}
+	}
+	
+	if (stack.items != stack.local)
+		json_dealloc(stack.items);
+}
+
 void json_free(jsonValue_t* value) {
 	if (value == NULL)
 		return;
 
 	json_free_r(value);
-	free(value);
+	json_dealloc(value);
+}
+
+/*
+ * Memory held by a value: the struct itself, entry arrays (with their
+ * unused capacity), strings and container bookkeeping. Entries that are
+ * shared with other values (json_share()) are counted for each owner; the
+ * source text of a document parsed with JSON_PARSE_SPANS only once.
+ */
+
+struct jsonMemoryContext {
+	jsonMemoryUsage_t* usage;
+	struct jsonSource* source;
+};
+
+static void json_memory_usage_r(struct jsonMemoryContext* context, jsonValue_t* value) {
+	jsonMemoryUsage_t* usage = context->usage;
+	usage->values++;
+	
+	if (value->type == JSON_STRING) {
+		usage->strings++;
+		usage->stringBytes += strlen(value->value.string) + 1;
+		return;
+	}
+	
+	if (value->type != JSON_ARRAY && value->type != JSON_OBJECT)
+		return;
+	
+	struct jsonContainerInfo* info = json_container_info_get(value);
+	size_t size = value->type == JSON_ARRAY ? value->value.array.size : value->value.object.size;
+	size_t entrySize = value->type == JSON_ARRAY ? sizeof(jsonValue_t) : sizeof(jsonObjectEntry_t);
+	
+	usage->containers++;
+	usage->entries += size;
+	usage->bytes += size * entrySize;
+	usage->overhead += sizeof(struct jsonEntriesHeader);
+	
+	if (info != NULL) {
+		if (info->capacity > size)
+			usage->slack += (info->capacity - size) * entrySize;
+		
+		usage->overhead += sizeof(struct jsonContainerInfo) + info->spanCount * sizeof(jsonSpan_t) + info->indexSlots * sizeof(size_t);
+		if (info->cache != NULL)
+			usage->overhead += sizeof(struct jsonCache) + info->cache->length;
+		if (info->source != NULL && info->source != context->source) {
+			usage->overhead += sizeof(struct jsonSource) + info->source->length;
+			context->source = info->source;
+		}
+	}
+	
+	for (size_t i = 0; i < size; i++) {
+		if (value->type == JSON_ARRAY) {
+			json_memory_usage_r(context, &value->value.array.entries[i]);
+		} else {
+			usage->strings++;
+			usage->stringBytes += strlen(value->value.object.entries[i].key) + 1;
+			json_memory_usage_r(context, &value->value.object.entries[i].value);
+		}
+	}
+}
+
+size_t json_memory_usage(jsonValue_t* value, jsonMemoryUsage_t* usage) {
+	jsonMemoryUsage_t local;
+	if (usage == NULL)
+		usage = &local;
+	
+	*usage = (jsonMemoryUsage_t) { 0 };
+	struct jsonMemoryContext context = {
+		.usage = usage,
+		.source = NULL,
+	};
+	
+	json_memory_usage_r(&context, value);
+	
+	// the struct of the value itself; entries are part of the entry arrays
+	usage->bytes += sizeof(jsonValue_t) + usage->stringBytes + usage->slack + usage->overhead;
+	
+	return usage->bytes;
 }
 
 jsonValue_t* json_value() {
-	jsonValue_t* value = malloc(sizeof(jsonValue_t));
+	jsonValue_t* value = json_alloc(sizeof(jsonValue_t));
 	return value;
 }
 
@@ -89,9 +540,9 @@ jsonValue_t* json_string(const char* s) {
 	if (value == NULL)
 		return NULL;
 	value->type = JSON_STRING;
-	value->value.string = strdup(s);
+	value->value.string = json_strdup(s);
 	if (value->value.string == NULL) {
-		free(value);
+		json_dealloc(value);
 		return NULL;
 	}
 	return value;
@@ -103,9 +554,9 @@ jsonValue_t* json_array(bool freeAfterwards, size_t size, ...) {
 		return NULL;
 	value->type = JSON_ARRAY;
 	value->value.array.size = size;
-	value->value.array.entries = malloc(sizeof(jsonValue_t) * size);
+	value->value.array.entries = json_entries_alloc(size, sizeof(jsonValue_t));
 	if (value->value.array.entries == NULL) {
-		free(value);
+		json_dealloc(value);
 		return NULL;
 	}
 	
@@ -130,14 +581,14 @@ jsonValue_t* json_array(bool freeAfterwards, size_t size, ...) {
 		value->value.array.entries[i] = *entry;
 		
 		if (freeAfterwards) {
-			free(entry);
+			json_dealloc(entry);
 		}
 	}
 	va_end(ap);
 	
 	if (abort) {
-		free(value->value.array.entries);
-		free(value);
+		json_entries_free(value->value.array.entries);
+		json_dealloc(value);
 		return NULL;
 	}
 	
@@ -150,9 +601,9 @@ jsonValue_t* json_array_direct(bool freeAfterwards, size_t size, jsonValue_t* va
 		return NULL;
 	value->type = JSON_ARRAY;
 	value->value.array.size = size;
-	value->value.array.entries = malloc(sizeof(jsonValue_t) * size);
+	value->value.array.entries = json_entries_alloc(size, sizeof(jsonValue_t));
 	if (value->value.array.entries == NULL) {
-		free(value);
+		json_dealloc(value);
 		return NULL;
 	}
 	
@@ -172,13 +623,13 @@ jsonValue_t* json_array_direct(bool freeAfterwards, size_t size, jsonValue_t* va
 		value->value.array.entries[i] = *(values[i]);
 	
 		if (freeAfterwards) {
-			free(values[i]);
+			json_dealloc(values[i]);
 		}
 	}
 	
 	if (abort) {
-		free(value->value.array.entries);
-		free(value);
+		json_entries_free(value->value.array.entries);
+		json_dealloc(value);
 		return NULL;
 	}
 	
@@ -192,12 +643,13 @@ jsonValue_t* json_object(bool freeAfterwards, size_t size, ...) {
 	value->type = JSON_OBJECT;
 	value->value.object.size = size;
 	
-	// using calloc so the memory is set to 0
-	value->value.object.entries = calloc(size, sizeof(jsonObjectEntry_t));
+	value->value.object.entries = json_entries_alloc(size, sizeof(jsonObjectEntry_t));
 	if (value->value.object.entries == NULL) {
-		free(value);
+		json_dealloc(value);
 		return NULL;
 	}
+	// set to 0, so the keys can be freed if it fails
+	memset(value->value.object.entries, 0, sizeof(jsonObjectEntry_t) * size);
 	
 	bool abort = false;
 	
@@ -223,11 +675,12 @@ jsonValue_t* json_object(bool freeAfterwards, size_t size, ...) {
 		}
 		
 		if (!abort) {
-			value->value.object.entries[i].key = strdup(key);
+			value->value.object.entries[i].key = json_strdup(key);
 			value->value.object.entries[i].value = *entry;
+			abort = value->value.object.entries[i].key == NULL;
 		}
 		if (freeAfterwards) {
-			free(entry);
+			json_dealloc(entry);
 		}
 	}
 	va_end(ap);
@@ -235,11 +688,11 @@ jsonValue_t* json_object(bool freeAfterwards, size_t size, ...) {
 	if (abort) {
 		for (size_t i = 0; i < size; i++) {
 			if (value->value.object.entries[i].key != NULL) {
-				free(value->value.object.entries[i].key);
+				json_dealloc(value->value.object.entries[i].key);
 			}
 		}
-		free(value->value.object.entries);
-		free(value);
+		json_entries_free(value->value.object.entries);
+		json_dealloc(value);
 		return NULL;
 	}
 	
@@ -296,59 +749,75 @@ void json_print(jsonValue_t* value) {
 	json_print_r(value, 0);
 }
 
-int json_clone_r(jsonValue_t* value, jsonValue_t* clone) {
+int json_clone_r(jsonValue_t* value, jsonValue_t* clone);
+
+static inline bool json_clone_push(struct jsonCloneStack* stack, jsonValue_t* value, jsonValue_t* clone) {
+	if (value->type != JSON_STRING && value->type != JSON_ARRAY && value->type != JSON_OBJECT) {
+		*clone = *value;
+		return true;
+	}
+	
+	if (!json_work_stack_reserve((void**) &stack->items, stack->local, &stack->capacity, stack->size, sizeof(struct jsonCloneItem)))
+		return json_clone_r(value, clone) == 0;
+	
+	stack->items[stack->size++] = (struct jsonCloneItem) {
+		.value = value,
+		.clone = clone,
+	};
+	
+	return true;
+}
+
+// copies one value; children are pushed to the stack. Until they are processed they are null.
+static bool json_clone_item(struct jsonCloneStack* stack, jsonValue_t* value, jsonValue_t* clone) {
 	*clone = *value;
 	
 	switch(value->type) {
 		case JSON_STRING:
-			clone->value.string = strdup(value->value.string);
+			clone->value.string = json_strdup(value->value.string);
 			if (clone->value.string == NULL) {
-				return -1;
+				clone->type = JSON_NULL;
+				return false;
 			}
 			break;
 		case JSON_ARRAY:
-			clone->value.array.size = value->value.array.size;
-			clone->value.array.entries = malloc(sizeof(jsonValue_t) * clone->value.array.size);
+			clone->value.array.entries = json_entries_alloc(clone->value.array.size, sizeof(jsonValue_t));
 			
 			if (clone->value.array.entries == NULL) {
-				return -1;
+				clone->type = JSON_NULL;
+				return false;
+			}
+			
+			for (size_t i = 0; i < clone->value.array.size; i++) {
+				clone->value.array.entries[i].type = JSON_NULL;
 			}
 			
 			for (size_t i = 0; i < clone->value.array.size; i++) {
-				if (json_clone_r(&(value->value.array.entries[i]), &(clone->value.array.entries[i])) < 0) {
-					free(clone->value.array.entries);
-					return -1;
-				}
+				if (!json_clone_push(stack, &(value->value.array.entries[i]), &(clone->value.array.entries[i])))
+					return false;
 			}
 			
 			break;
 		case JSON_OBJECT:
-			clone->value.object.size = value->value.object.size;
-			clone->value.object.entries = malloc(sizeof(jsonObjectEntry_t) * clone->value.object.size);
+			clone->value.object.entries = json_entries_alloc(clone->value.object.size, sizeof(jsonObjectEntry_t));
 			
 			if (clone->value.object.entries == NULL) {
-				return -1;
+				clone->type = JSON_NULL;
+				return false;
 			}
 			
 			for (size_t i = 0; i < clone->value.object.size; i++) {
-				bool okay = true;
+				clone->value.object.entries[i].key = NULL;
+				clone->value.object.entries[i].value.type = JSON_NULL;
+			}
 			
-				clone->value.object.entries[i].key = strdup(value->value.object.entries[i].key);
-				if (clone->value.object.entries[i].key == NULL) {
-					okay = false;
-				} else if (json_clone_r(&(value->value.object.entries[i].value), &(clone->value.object.entries[i].value)) < 0) {
-					free(clone->value.object.entries[i].key);
-					okay = false;
-				}
+			for (size_t i = 0; i < clone->value.object.size; i++) {
+				clone->value.object.entries[i].key = json_strdup(value->value.object.entries[i].key);
+				if (clone->value.object.entries[i].key == NULL)
+					return false;
 				
-				if (!okay) {
-					for (size_t j = 0; j < i; j++) {
-						free(clone->value.object.entries[j].key);
-						json_free_r(&(clone->value.object.entries[j].value));
-					}
-					free(clone->value.object.entries);
-					return -1;
-				}
+				if (!json_clone_push(stack, &(value->value.object.entries[i].value), &(clone->value.object.entries[i].value)))
+					return false;
 			}
 			
 			break;
@@ -358,17 +827,65 @@ int json_clone_r(jsonValue_t* value, jsonValue_t* clone) {
 			break;
 	}
 	
+	return true;
+}
+
+int json_clone_r(jsonValue_t* value, jsonValue_t* clone) {
+	struct jsonCloneStack stack;
+	stack.size = 0;
+	stack.capacity = JSON_WORK_STACK_LOCAL;
+	stack.items = stack.local;
+	
+	bool okay = json_clone_item(&stack, value, clone);
+	
+	while (okay && stack.size > 0) {
+		struct jsonCloneItem item = stack.items[--stack.size];
+		okay = json_clone_item(&stack, item.value, item.clone);
+	}
+	
+	if (stack.items != stack.local)
+		json_dealloc(stack.items);
+	
+	if (!okay) {
+		// everything that wasn't copied yet is null
+		json_free_r(clone);
+		return -1;
+	}
+	
 	return 0;
 }
 
+static bool json_shared_clones = false;
+
+void json_set_shared_clones(bool enabled) {
+	json_shared_clones = enabled;
+}
+
+jsonValue_t* json_share(jsonValue_t* value) {
+	jsonValue_t* clone = json_alloc(sizeof(jsonValue_t));
+	if (clone == NULL) {
+		return NULL;
+	}
+	
+	if (json_share_r(value, clone) < 0) {
+		json_dealloc(clone);
+		return NULL;
+	}
+	
+	return clone;
+}
+
 jsonValue_t* json_clone(jsonValue_t* value) {
-	jsonValue_t* clone = malloc(sizeof(jsonValue_t));
+	if (json_shared_clones)
+		return json_share(value);
+
+	jsonValue_t* clone = json_alloc(sizeof(jsonValue_t));
 	if (clone == NULL) {
 		return NULL;
 	}
 		
 	if (json_clone_r(value, clone) < 0) {
-		free(clone);
+		json_dealloc(clone);
 		return NULL;
 	}
 	
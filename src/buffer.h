@@ -0,0 +1,69 @@
+#ifndef JSON_BUFFER_H
+#define JSON_BUFFER_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "json.h"
+
+/*
+ * Output buffer used by the serializers. Writes never fail individually; if
+ * an allocation (or the sink) fails the buffer is marked as failed and all
+ * further writes are ignored.
+ * Without a sink the buffer grows geometrically. With a sink the content is
+ * flushed to the sink whenever the buffer is full. Fixed buffers fail once
+ * they are full.
+ */
+
+typedef struct jsonBuffer {
+	char* data;
+	size_t length;
+	size_t capacity;
+	bool failed;
+	// caller-provided memory; the buffer can't grow
+	bool fixed;
+	jsonWriteFunction_t write;
+	void* context;
+	// used for string values; lets the iovec output reference strings instead of copying them
+	void (*stringWriter)(struct jsonBuffer* buffer, const char* string);
+	struct jsonIovList* iov;
+	// store the output of every large container in its cache (json_cache())
+	bool cacheAll;
+} jsonBuffer_t;
+
+#define JSON_BUFFER_INITIAL_CAPACITY (256)
+#define JSON_BUFFER_STREAM_CAPACITY (64 * 1024)
+
+int json_buffer_init(jsonBuffer_t* buffer, size_t capacity);
+void json_buffer_init_fixed(jsonBuffer_t* buffer, char* data, size_t capacity);
+int json_buffer_init_sink(jsonBuffer_t* buffer, size_t capacity, jsonWriteFunction_t write, void* context);
+int json_buffer_flush(jsonBuffer_t* buffer);
+void json_buffer_destroy(jsonBuffer_t* buffer);
+char* json_buffer_grow(jsonBuffer_t* buffer, size_t size);
+char* json_buffer_finish(jsonBuffer_t* buffer);
+
+// returns a pointer to at least size writable bytes or NULL if the buffer failed
+static inline char* json_buffer_reserve(jsonBuffer_t* buffer, size_t size) {
+	if (buffer->capacity - buffer->length >= size)
+		return buffer->data + buffer->length;
+	return json_buffer_grow(buffer, size);
+}
+
+static inline void json_buffer_put(jsonBuffer_t* buffer, char c) {
+	char* target = json_buffer_reserve(buffer, 1);
+	if (target == NULL)
+		return;
+	*target = c;
+	buffer->length++;
+}
+
+static inline void json_buffer_write(jsonBuffer_t* buffer, const char* data, size_t length) {
+	char* target = json_buffer_reserve(buffer, length);
+	if (target == NULL)
+		return;
+	memcpy(target, data, length);
+	buffer->length += length;
+}
+
+#endif
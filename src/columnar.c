@@ -0,0 +1,399 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "json.h"
+#include "alloc.h"
+
+#define JSON_COLUMN_STRING_CHUNK_SIZE (4096)
+
+static void json_column_set_null(jsonColumn_t* column, size_t row) {
+	column->nulls[row / 8] |= 1 << (row % 8);
+}
+
+bool json_column_is_null(jsonColumn_t* column, size_t row) {
+	return (column->nulls[row / 8] >> (row % 8)) & 1;
+}
+
+static int json_column_init(jsonColumn_t* column, size_t size) {
+	column->type = JSON_NULL;
+	column->size = size;
+	column->values.integers = NULL;
+	column->offsets = NULL;
+	column->data = NULL;
+	column->dataCapacity = 0;
+	column->nulls = json_calloc((size + 7) / 8 + 1, sizeof(unsigned char));
+	if (column->nulls == NULL)
+		return -1;
+	return 0;
+}
+
+void json_columns_free(jsonColumn_t* columns, size_t n) {
+	if (columns == NULL)
+		return;
+	
+	for (size_t i = 0; i < n; i++) {
+		json_dealloc(columns[i].nulls);
+		json_dealloc(columns[i].values.integers);
+		json_dealloc(columns[i].offsets);
+		json_dealloc(columns[i].data);
+	}
+	json_dealloc(columns);
+}
+
+// the type of a column is fixed by its first non-null value; longs are promoted to doubles
+static int json_column_type(jsonColumn_t* column, jsonValueType_t type, size_t row) {
+	if (column->type == type)
+		return 0;
+	
+	if (column->type == JSON_NULL) {
+		size_t size = column->size > 0 ? column->size : 1;
+		switch(type) {
+			case JSON_LONG:
+			case JSON_DOUBLE:
+				// both need 8 bytes; a buffer for one can be reused for the other
+				column->values.integers = json_alloc(sizeof(long long) * size);
+				break;
+			case JSON_BOOL:
+				column->values.booleans = json_alloc(sizeof(bool) * size);
+				break;
+			case JSON_STRING:
+				column->offsets = json_alloc(sizeof(size_t) * (size + 1));
+				column->values.integers = NULL;
+				if (column->offsets == NULL)
+					return -1;
+				// rows before this one are null
+				for (size_t i = 0; i <= row; i++)
+					column->offsets[i] = 0;
+				column->type = type;
+				return 0;
+			default:
+				return -1;
+		}
+		if (column->values.integers == NULL)
+			return -1;
+		column->type = type;
+		return 0;
+	}
+	
+	if (column->type == JSON_LONG && type == JSON_DOUBLE) {
+		for (size_t i = 0; i < row; i++) {
+			column->values.reals[i] = column->values.integers[i];
+		}
+		column->type = JSON_DOUBLE;
+		return 0;
+	}
+	if (column->type == JSON_DOUBLE && type == JSON_LONG) {
+		return 0;
+	}
+	
+	return -1;
+}
+
+static int json_column_add_string(jsonColumn_t* column, size_t row, const char* string) {
+	size_t length = strlen(string) + 1;
+	size_t offset = column->offsets[row];
+	
+	if (offset + length > column->dataCapacity) {
+		size_t capacity = column->dataCapacity * 2;
+		if (capacity < offset + length)
+			capacity = offset + length + JSON_COLUMN_STRING_CHUNK_SIZE;
+		char* data = json_realloc(column->data, capacity);
+		if (data == NULL)
+			return -1;
+		column->data = data;
+		column->dataCapacity = capacity;
+	}
+	
+	memcpy(column->data + offset, string, length);
+	column->offsets[row + 1] = offset + length;
+	
+	return 0;
+}
+
+static int json_column_add(jsonColumn_t* column, size_t row, jsonValue_t* value) {
+	if (value == NULL || value->type == JSON_NULL) {
+		json_column_set_null(column, row);
+		switch(column->type) {
+			case JSON_LONG:
+				column->values.integers[row] = 0;
+				break;
+			case JSON_DOUBLE:
+				column->values.reals[row] = 0;
+				break;
+			case JSON_BOOL:
+				column->values.booleans[row] = false;
+				break;
+			case JSON_STRING:
+				column->offsets[row + 1] = column->offsets[row];
+				break;
+			default:
+				break;
+		}
+		return 0;
+	}
+	
+	if (column->type == JSON_NULL) {
+		// all previous rows are null
+		if (json_column_type(column, value->type, row) < 0)
+			return -1;
+		if (column->type != JSON_STRING) {
+			memset(column->values.integers, 0, (column->type == JSON_BOOL ? sizeof(bool) : sizeof(long long)) * row);
+		}
+	} else if (json_column_type(column, value->type, row) < 0) {
+		return -1;
+	}
+	
+	switch(column->type) {
+		case JSON_LONG:
+			column->values.integers[row] = value->value.integer;
+			break;
+		case JSON_DOUBLE:
+			column->values.reals[row] = value->type == JSON_LONG ? value->value.integer : value->value.real;
+			break;
+		case JSON_BOOL:
+			column->values.booleans[row] = value->value.boolean;
+			break;
+		case JSON_STRING:
+			return json_column_add_string(column, row, value->value.string);
+		default:
+			return -1;
+	}
+	
+	return 0;
+}
+
+int json_array_to_columns(jsonValue_t* array, const char* fields[], size_t n, jsonColumn_t** columns) {
+	if (array->type != JSON_ARRAY)
+		return -1;
+	
+	size_t size = array->value.array.size;
+	
+	*columns = json_alloc(sizeof(jsonColumn_t) * (n > 0 ? n : 1));
+	// per field: position of the key in the previous object
+	size_t* positions = json_calloc(n > 0 ? n : 1, sizeof(size_t));
+	if (*columns == NULL || positions == NULL) {
+		json_dealloc(*columns);
+		json_dealloc(positions);
+		*columns = NULL;
+		return -1;
+	}
+	
+	for (size_t j = 0; j < n; j++) {
+		if (json_column_init(&(*columns)[j], size) < 0) {
+			json_columns_free(*columns, j);
+			json_dealloc(positions);
+			*columns = NULL;
+			return -1;
+		}
+	}
+	
+	for (size_t i = 0; i < size; i++) {
+		jsonValue_t* entry = &array->value.array.entries[i];
+		jsonObjectEntry_t* entries = NULL;
+		size_t entriesSize = 0;
+		
+		if (entry->type == JSON_OBJECT) {
+			entries = entry->value.object.entries;
+			entriesSize = entry->value.object.size;
+		}
+		
+		for (size_t j = 0; j < n; j++) {
+			jsonValue_t* value = NULL;
+			size_t position = positions[j];
+			
+			// objects of the same shape have the key at the same position
+			if (position < entriesSize && strcmp(entries[position].key, fields[j]) == 0) {
+				value = &entries[position].value;
+			} else {
+				for (size_t k = 0; k < entriesSize; k++) {
+					if (strcmp(entries[k].key, fields[j]) == 0) {
+						value = &entries[k].value;
+						positions[j] = k;
+						break;
+					}
+				}
+			}
+			
+			if (json_column_add(&(*columns)[j], i, value) < 0) {
+				json_columns_free(*columns, n);
+				json_dealloc(positions);
+				*columns = NULL;
+				return -1;
+			}
+		}
+	}
+	
+	json_dealloc(positions);
+	
+	return 0;
+}
+
+#define JSON_REDUCE_LANES (4)
+
+static void json_reduce_longs(jsonValue_t* entries, size_t size, int operations, jsonReduction_t* out) {
+	long long sum[JSON_REDUCE_LANES] = { 0 };
+	long long min[JSON_REDUCE_LANES];
+	long long max[JSON_REDUCE_LANES];
+	
+	for (size_t l = 0; l < JSON_REDUCE_LANES; l++) {
+		min[l] = entries[0].value.integer;
+		max[l] = entries[0].value.integer;
+	}
+	
+	// independent accumulators per lane break the dependency chain
+	size_t i = 0;
+	if (operations & (JSON_REDUCE_MIN | JSON_REDUCE_MAX)) {
+		for (; i + JSON_REDUCE_LANES <= size; i += JSON_REDUCE_LANES) {
+			for (size_t l = 0; l < JSON_REDUCE_LANES; l++) {
+				long long v = entries[i + l].value.integer;
+				sum[l] += v;
+				min[l] = v < min[l] ? v : min[l];
+				max[l] = v > max[l] ? v : max[l];
+			}
+		}
+	} else {
+		for (; i + JSON_REDUCE_LANES <= size; i += JSON_REDUCE_LANES) {
+			for (size_t l = 0; l < JSON_REDUCE_LANES; l++) {
+				sum[l] += entries[i + l].value.integer;
+			}
+		}
+	}
+	for (; i < size; i++) {
+		long long v = entries[i].value.integer;
+		sum[0] += v;
+		min[0] = v < min[0] ? v : min[0];
+		max[0] = v > max[0] ? v : max[0];
+	}
+	
+	for (size_t l = 1; l < JSON_REDUCE_LANES; l++) {
+		sum[0] += sum[l];
+		min[0] = min[l] < min[0] ? min[l] : min[0];
+		max[0] = max[l] > max[0] ? max[l] : max[0];
+	}
+	
+	out->sum = (jsonValue_t) { .type = JSON_LONG, .value.integer = sum[0] };
+	out->min = (jsonValue_t) { .type = JSON_LONG, .value.integer = min[0] };
+	out->max = (jsonValue_t) { .type = JSON_LONG, .value.integer = max[0] };
+	out->mean = ((double) sum[0]) / size;
+}
+
+static void json_reduce_doubles(jsonValue_t* entries, size_t size, int operations, jsonReduction_t* out) {
+	double sum[JSON_REDUCE_LANES] = { 0 };
+	double min[JSON_REDUCE_LANES];
+	double max[JSON_REDUCE_LANES];
+	
+	for (size_t l = 0; l < JSON_REDUCE_LANES; l++) {
+		min[l] = entries[0].value.real;
+		max[l] = entries[0].value.real;
+	}
+	
+	size_t i = 0;
+	if (operations & (JSON_REDUCE_MIN | JSON_REDUCE_MAX)) {
+		for (; i + JSON_REDUCE_LANES <= size; i += JSON_REDUCE_LANES) {
+			for (size_t l = 0; l < JSON_REDUCE_LANES; l++) {
+				double v = entries[i + l].value.real;
+				sum[l] += v;
+				min[l] = v < min[l] ? v : min[l];
+				max[l] = v > max[l] ? v : max[l];
+			}
+		}
+	} else {
+		for (; i + JSON_REDUCE_LANES <= size; i += JSON_REDUCE_LANES) {
+			for (size_t l = 0; l < JSON_REDUCE_LANES; l++) {
+				sum[l] += entries[i + l].value.real;
+			}
+		}
+	}
+	for (; i < size; i++) {
+		double v = entries[i].value.real;
+		sum[0] += v;
+		min[0] = v < min[0] ? v : min[0];
+		max[0] = v > max[0] ? v : max[0];
+	}
+	
+	for (size_t l = 1; l < JSON_REDUCE_LANES; l++) {
+		sum[0] += sum[l];
+		min[0] = min[l] < min[0] ? min[l] : min[0];
+		max[0] = max[l] > max[0] ? max[l] : max[0];
+	}
+	
+	out->sum = (jsonValue_t) { .type = JSON_DOUBLE, .value.real = sum[0] };
+	out->min = (jsonValue_t) { .type = JSON_DOUBLE, .value.real = min[0] };
+	out->max = (jsonValue_t) { .type = JSON_DOUBLE, .value.real = max[0] };
+	out->mean = sum[0] / size;
+}
+
+// mixed integers and floating point numbers; non-numeric entries are skipped
+static void json_reduce_mixed(jsonValue_t* entries, size_t size, jsonReduction_t* out) {
+	double sum = 0;
+	double min = 0;
+	double max = 0;
+	size_t count = 0;
+	
+	for (size_t i = 0; i < size; i++) {
+		double v;
+		if (entries[i].type == JSON_LONG) {
+			v = entries[i].value.integer;
+		} else if (entries[i].type == JSON_DOUBLE) {
+			v = entries[i].value.real;
+		} else {
+			continue;
+		}
+		
+		if (count++ == 0) {
+			min = v;
+			max = v;
+		}
+		sum += v;
+		min = v < min ? v : min;
+		max = v > max ? v : max;
+	}
+	
+	out->count = count;
+	out->sum = (jsonValue_t) { .type = JSON_DOUBLE, .value.real = sum };
+	out->min = (jsonValue_t) { .type = count > 0 ? JSON_DOUBLE : JSON_NULL, .value.real = min };
+	out->max = (jsonValue_t) { .type = count > 0 ? JSON_DOUBLE : JSON_NULL, .value.real = max };
+	out->mean = count > 0 ? sum / count : 0;
+}
+
+int json_array_reduce(jsonValue_t* value, int operations, jsonReduction_t* out) {
+	if (value->type != JSON_ARRAY)
+		return -1;
+	
+	jsonValue_t* entries = value->value.array.entries;
+	size_t size = value->value.array.size;
+	
+	out->count = 0;
+	out->sum = (jsonValue_t) { .type = JSON_LONG, .value.integer = 0 };
+	out->min = (jsonValue_t) { .type = JSON_NULL };
+	out->max = (jsonValue_t) { .type = JSON_NULL };
+	out->mean = 0;
+	
+	if (size == 0)
+		return 0;
+	
+	size_t longs = 0;
+	size_t doubles = 0;
+	for (size_t i = 0; i < size; i++) {
+		longs += entries[i].type == JSON_LONG;
+		doubles += entries[i].type == JSON_DOUBLE;
+	}
+	
+	if (operations == JSON_REDUCE_COUNT) {
+		out->count = longs + doubles;
+		return 0;
+	}
+	
+	if (longs == size) {
+		out->count = size;
+		json_reduce_longs(entries, size, operations, out);
+	} else if (doubles == size) {
+		out->count = size;
+		json_reduce_doubles(entries, size, operations, out);
+	} else if (longs + doubles > 0) {
+		json_reduce_mixed(entries, size, out);
+	}
+	
+	return 0;
+}
@@ -0,0 +1,190 @@
+#ifndef JSON_CONTAINER_H
+#define JSON_CONTAINER_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "json.h"
+
+/*
+ * Optional per-container data. The entries of arrays and objects are
+ * allocated with a header in front (json_entries_alloc()) that points to
+ * it; the pointer is NULL until a feature needs it, so plain documents
+ * don't pay for it and the values stay small. Shared clones share the
+ * entries and therefore the info.
+ */
+
+// scope of the data recorded in containers (cached output, source spans, hashes); see json_container_current()
+struct jsonDocument {
+	size_t references;
+	uint64_t generation;
+};
+
+// copy of the parser input, shared by all containers of a document parsed with JSON_PARSE_SPANS
+struct jsonSource {
+	size_t references;
+	size_t length;
+	char data[];
+};
+
+// serialized form of a container; published as a whole, so readers on other threads see a complete one
+struct jsonCache {
+	uint64_t generation;
+	size_t length;
+	char data[];
+};
+
+struct jsonContainerInfo {
+	// number of additional values sharing the entries (json_share()); 0 if exclusive
+	size_t shares;
+	// allocated entries; only valid if it is at least the size of the container
+	size_t capacity;
+	
+	// the container keeps a copy of its serialized form
+	bool cached;
+	// serialized form; NULL while the container is dirty
+	struct jsonCache* cache;
+	
+	// json_hash() of the container; only valid if hashed is set. Readers store it, so it's guarded by hashSequence (see equal.c)
+	uint64_t hashSequence;
+	bool hashed;
+	uint64_t hash;
+	uint64_t hashGeneration;
+	
+	// set by json_freeze(); the container and its entries can't be modified anymore
+	bool frozen;
+	// open addressing table of entry index + 1 by key hash for large frozen objects; NULL if there is none
+	size_t* index;
+	size_t indexSlots;
+	
+	// source text of the container and its entries; a length of 0 marks a modified value
+	struct jsonSource* source;
+	jsonSpan_t span;
+	jsonSpan_t* spans;
+	size_t spanCount;
+	uint64_t spanGeneration;
+};
+
+struct jsonEntriesHeader {
+	struct jsonContainerInfo* info;
+	// document the container belongs to; NULL if it didn't record anything
+	struct jsonDocument* document;
+};
+
+static inline struct jsonEntriesHeader* json_entries_header(void* entries) {
+	return (struct jsonEntriesHeader*) entries - 1;
+}
+
+// NULL for non-containers
+static inline struct jsonEntriesHeader* json_container_header(jsonValue_t* value) {
+	void* entries;
+	switch(value->type) {
+		case JSON_ARRAY:
+			entries = value->value.array.entries;
+			break;
+		case JSON_OBJECT:
+			entries = value->value.object.entries;
+			break;
+		default:
+			return NULL;
+	}
+	
+	return entries == NULL ? NULL : json_entries_header(entries);
+}
+
+static inline struct jsonContainerInfo** json_container_info_ref(jsonValue_t* value) {
+	struct jsonEntriesHeader* header = json_container_header(value);
+	return header == NULL ? NULL : &header->info;
+}
+
+static inline struct jsonDocument* json_container_document(jsonValue_t* value) {
+	struct jsonEntriesHeader* header = json_container_header(value);
+	return header == NULL ? NULL : header->document;
+}
+
+/*
+ * json_array_push() and the other modifying functions only mark the
+ * container they modify; the containers above it aren't known. So they
+ * advance the generation of its document instead, and cached output,
+ * source text and hashes the document recorded in an older generation
+ * aren't trusted anymore. Values added to a container join its document
+ * (json_document_adopt()), so the containers above are always in the same
+ * document. Path-based modifications (json_set(), patches) mark all
+ * containers on the path and keep the generation. Frozen containers can't
+ * change, so their data is always valid.
+ */
+static inline bool json_container_current(jsonValue_t* value, struct jsonContainerInfo* info, uint64_t generation) {
+	if (info->frozen)
+		return true;
+	
+	struct jsonDocument* document = json_container_document(value);
+	return document != NULL && generation == __atomic_load_n(&document->generation, __ATOMIC_ACQUIRE);
+}
+
+static inline struct jsonContainerInfo* json_container_info_get(jsonValue_t* value) {
+	struct jsonContainerInfo** info = json_container_info_ref(value);
+	return info == NULL ? NULL : *info;
+}
+
+static inline bool json_container_frozen(jsonValue_t* value) {
+	struct jsonContainerInfo* info = json_container_info_get(value);
+	return info != NULL && info->frozen;
+}
+
+// frozen and not shared: modifications can't copy the entries and have to fail
+static inline bool json_container_readonly(jsonValue_t* value) {
+	struct jsonContainerInfo* info = json_container_info_get(value);
+	return info != NULL && info->frozen && __atomic_load_n(&info->shares, __ATOMIC_ACQUIRE) == 0;
+}
+
+// source text of an unmodified container; NULL otherwise
+static inline const char* json_container_source(jsonValue_t* value, size_t* length) {
+	struct jsonContainerInfo* info = json_container_info_get(value);
+	if (info == NULL || info->source == NULL || info->span.length == 0 || !json_container_current(value, info, info->spanGeneration))
+		return NULL;
+	
+	*length = info->span.length;
+	return info->source->data + info->span.offset;
+}
+
+// source text of the unmodified scalar entry i of a container; containers have their own span
+static inline const char* json_container_entry_source(jsonValue_t* container, size_t i, jsonValue_t* entry, size_t* length) {
+	struct jsonContainerInfo* info = json_container_info_get(container);
+	if (info == NULL || i >= info->spanCount || info->spans[i].length == 0)
+		return NULL;
+	if (entry->type == JSON_ARRAY || entry->type == JSON_OBJECT || !json_container_current(container, info, info->spanGeneration))
+		return NULL;
+	
+	*length = info->spans[i].length;
+	return info->source->data + info->spans[i].offset;
+}
+
+// cached output of an unmodified container; NULL otherwise
+static inline const char* json_container_cache(jsonValue_t* value, size_t* length) {
+	struct jsonContainerInfo* info = json_container_info_get(value);
+	struct jsonCache* cache = info == NULL ? NULL : __atomic_load_n(&info->cache, __ATOMIC_ACQUIRE);
+	if (cache == NULL || !json_container_current(value, info, cache->generation))
+		return NULL;
+	
+	*length = cache->length;
+	return cache->data;
+}
+
+void* json_entries_alloc(size_t size, size_t entrySize);
+void* json_entries_realloc(void* entries, size_t size, size_t entrySize);
+void json_entries_free(void* entries);
+struct jsonContainerInfo* json_container_info(jsonValue_t* value);
+void json_container_info_free(struct jsonContainerInfo* info);
+int json_container_unshare(jsonValue_t* value);
+void json_container_dirty(jsonValue_t* value);
+void json_container_changed(jsonValue_t* value);
+int json_document_attach(jsonValue_t* value);
+void json_document_adopt(jsonValue_t* container, jsonValue_t* value);
+void json_document_release(struct jsonDocument* document);
+void json_container_entry_dirty(jsonValue_t* value, size_t i);
+void json_container_entries_dirty(jsonValue_t* value);
+void json_source_release(struct jsonSource* source);
+size_t json_container_key(jsonValue_t* object, const char* key);
+
+#endif
@@ -0,0 +1,264 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "json.h"
+#include "alloc.h"
+#include "container.h"
+
+/*
+ * Structural equality and hashing. Hashes of containers with at least
+ * JSON_HASH_MIN_ENTRIES entries are kept in the container info until the
+ * container is modified (see json_container_dirty() and
+ * json_container_current()); smaller ones are cheaper to hash again than to
+ * allocate the info for. Only containers that belong to a document keep
+ * their hash, so json_hash() gives the value a document if needed.
+ *
+ * Hashes are stored by readers, possibly on several threads that share the
+ * container. A sequence lock keeps the hash and the generation it was
+ * computed in together: a writer makes the sequence odd while it stores
+ * (other writers skip storing meanwhile), and readers that see an odd or
+ * changed sequence treat the hash as missing.
+ *
+ * Object hashes don't depend on the order of the keys, so they can be used
+ * for both ordered and unordered comparison.
+ */
+
+#define JSON_HASH_MIN_ENTRIES (16)
+
+// objects with fewer entries are compared by searching instead of sorting
+#define JSON_EQUAL_SORT_ENTRIES (16)
+
+static inline uint64_t json_hash_mix(uint64_t hash) {
+	hash ^= hash >> 30;
+	hash *= 0xbf58476d1ce4e5b9ull;
+	hash ^= hash >> 27;
+	hash *= 0x94d049bb133111ebull;
+	hash ^= hash >> 31;
+	return hash;
+}
+
+uint64_t json_hash_string(const char* string) {
+	uint64_t hash = 14695981039346656037ull;
+	for (; *string != '\0'; string++) {
+		hash ^= (unsigned char) *string;
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+static uint64_t json_hash_r(jsonValue_t* value);
+
+static uint64_t json_hash_container(jsonValue_t* value) {
+	uint64_t hash = json_hash_mix(value->type + 1);
+	
+	if (value->type == JSON_ARRAY) {
+		for (size_t i = 0; i < value->value.array.size; i++) {
+			hash = json_hash_mix(hash * 31 + json_hash_r(&value->value.array.entries[i]));
+		}
+	} else {
+		// sum of the entry hashes; independent of the order
+		uint64_t entries = value->value.object.size;
+		for (size_t i = 0; i < value->value.object.size; i++) {
+			jsonObjectEntry_t* entry = &value->value.object.entries[i];
+			entries += json_hash_mix(json_hash_string(entry->key) ^ json_hash_mix(json_hash_r(&entry->value)));
+		}
+		hash = json_hash_mix(hash ^ entries);
+	}
+	
+	return hash;
+}
+
+// stored hash of a container; false if there is none
+bool json_hash_cached(jsonValue_t* value, uint64_t* hash) {
+	struct jsonContainerInfo* info = json_container_info_get(value);
+	if (info == NULL)
+		return false;
+	
+	uint64_t sequence = __atomic_load_n(&info->hashSequence, __ATOMIC_ACQUIRE);
+	if (sequence & 1)
+		return false;
+	
+	// a value from a newer store makes its odd sequence visible below
+	bool hashed = __atomic_load_n(&info->hashed, __ATOMIC_ACQUIRE);
+	uint64_t generation = __atomic_load_n(&info->hashGeneration, __ATOMIC_ACQUIRE);
+	uint64_t stored = __atomic_load_n(&info->hash, __ATOMIC_ACQUIRE);
+	
+	if (__atomic_load_n(&info->hashSequence, __ATOMIC_RELAXED) != sequence)
+		return false;
+	
+	if (!hashed || !json_container_current(value, info, generation))
+		return false;
+	
+	*hash = stored;
+	return true;
+}
+
+static void json_hash_store(jsonValue_t* value, struct jsonContainerInfo* info, uint64_t hash) {
+	struct jsonDocument* document = json_container_document(value);
+	if (document == NULL)
+		return;
+	
+	uint64_t sequence = __atomic_load_n(&info->hashSequence, __ATOMIC_RELAXED);
+	if ((sequence & 1) || !__atomic_compare_exchange_n(&info->hashSequence, &sequence, sequence + 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+		return;
+	
+	__atomic_store_n(&info->hashGeneration, __atomic_load_n(&document->generation, __ATOMIC_ACQUIRE), __ATOMIC_RELEASE);
+	__atomic_store_n(&info->hash, hash, __ATOMIC_RELEASE);
+	__atomic_store_n(&info->hashed, true, __ATOMIC_RELEASE);
+	
+	__atomic_store_n(&info->hashSequence, sequence + 2, __ATOMIC_RELEASE);
+}
+
+static uint64_t json_hash_r(jsonValue_t* value) {
+	uint64_t hash;
+	double real;
+	
+	switch(value->type) {
+		case JSON_ARRAY:
+		case JSON_OBJECT: {
+			if (json_hash_cached(value, &hash))
+				return hash;
+			
+			hash = json_hash_container(value);
+			
+			size_t size = value->type == JSON_ARRAY ? value->value.array.size : value->value.object.size;
+			struct jsonContainerInfo* info = json_container_info_get(value);
+			if (info == NULL && size >= JSON_HASH_MIN_ENTRIES && json_container_document(value) != NULL)
+				info = json_container_info(value);
+			
+			if (info != NULL)
+				json_hash_store(value, info, hash);
+			
+			return hash;
+		}
+		case JSON_STRING:
+			return json_hash_mix(json_hash_string(value->value.string) ^ JSON_STRING);
+		case JSON_LONG:
+			return json_hash_mix((uint64_t) value->value.integer ^ ((uint64_t) JSON_LONG << 56));
+		case JSON_DOUBLE:
+			// 0.0 and -0.0 are equal
+			real = value->value.real == 0 ? 0 : value->value.real;
+			memcpy(&hash, &real, sizeof(hash));
+			return json_hash_mix(hash ^ ((uint64_t) JSON_DOUBLE << 56));
+		case JSON_BOOL:
+			return json_hash_mix((value->value.boolean ? 2 : 1) ^ ((uint64_t) JSON_BOOL << 56));
+		default:
+			return json_hash_mix((uint64_t) value->type << 56);
+	}
+}
+
+uint64_t json_hash(jsonValue_t* value) {
+	// without a document the hashes are only computed
+	json_document_attach(value);
+	
+	return json_hash_r(value);
+}
+
+static bool json_equal_r(jsonValue_t* a, jsonValue_t* b, int flags);
+
+static int json_equal_compare_keys(const void* a, const void* b) {
+	return strcmp((*(jsonObjectEntry_t**) a)->key, (*(jsonObjectEntry_t**) b)->key);
+}
+
+// a and b are the entries from the first differing key on
+static bool json_equal_unordered(jsonObjectEntry_t* a, jsonObjectEntry_t* b, size_t size, int flags) {
+	jsonObjectEntry_t** sorted = size >= JSON_EQUAL_SORT_ENTRIES ? json_alloc(sizeof(jsonObjectEntry_t*) * size * 2) : NULL;
+	
+	if (sorted == NULL) {
+		for (size_t i = 0; i < size; i++) {
+			size_t j;
+			for (j = 0; j < size && strcmp(a[i].key, b[j].key) != 0; j++);
+			if (j == size || !json_equal_r(&a[i].value, &b[j].value, flags))
+				return false;
+		}
+		return true;
+	}
+	
+	for (size_t i = 0; i < size; i++) {
+		sorted[i] = &a[i];
+		sorted[size + i] = &b[i];
+	}
+	qsort(sorted, size, sizeof(jsonObjectEntry_t*), &json_equal_compare_keys);
+	qsort(sorted + size, size, sizeof(jsonObjectEntry_t*), &json_equal_compare_keys);
+	
+	bool equal = true;
+	for (size_t i = 0; equal && i < size; i++) {
+		equal = strcmp(sorted[i]->key, sorted[size + i]->key) == 0;
+	}
+	for (size_t i = 0; equal && i < size; i++) {
+		equal = json_equal_r(&sorted[i]->value, &sorted[size + i]->value, flags);
+	}
+	
+	json_dealloc(sorted);
+	
+	return equal;
+}
+
+static bool json_equal_r(jsonValue_t* a, jsonValue_t* b, int flags) {
+	if (a == b)
+		return true;
+	if (a->type != b->type)
+		return false;
+	
+	uint64_t hashA, hashB;
+	
+	switch(a->type) {
+		case JSON_ARRAY:
+			if (a->value.array.size != b->value.array.size)
+				return false;
+			// shared clones
+			if (a->value.array.entries == b->value.array.entries)
+				return true;
+			if (json_hash_cached(a, &hashA) && json_hash_cached(b, &hashB) && hashA != hashB)
+				return false;
+			
+			for (size_t i = 0; i < a->value.array.size; i++) {
+				if (!json_equal_r(&a->value.array.entries[i], &b->value.array.entries[i], flags))
+					return false;
+			}
+			return true;
+		
+		case JSON_OBJECT:
+			if (a->value.object.size != b->value.object.size)
+				return false;
+			if (a->value.object.entries == b->value.object.entries)
+				return true;
+			if (json_hash_cached(a, &hashA) && json_hash_cached(b, &hashB) && hashA != hashB)
+				return false;
+			
+			for (size_t i = 0; i < a->value.object.size; i++) {
+				jsonObjectEntry_t* entryA = &a->value.object.entries[i];
+				jsonObjectEntry_t* entryB = &b->value.object.entries[i];
+				
+				if (strcmp(entryA->key, entryB->key) != 0) {
+					if (flags & JSON_EQUAL_UNORDERED)
+						return json_equal_unordered(entryA, entryB, a->value.object.size - i, flags);
+					return false;
+				}
+				if (!json_equal_r(&entryA->value, &entryB->value, flags))
+					return false;
+			}
+			return true;
+		
+		case JSON_STRING:
+			return strcmp(a->value.string, b->value.string) == 0;
+		case JSON_LONG:
+			return a->value.integer == b->value.integer;
+		case JSON_DOUBLE:
+			return a->value.real == b->value.real;
+		case JSON_BOOL:
+			return a->value.boolean == b->value.boolean;
+		default:
+			return true;
+	}
+}
+
+bool json_equal_with(jsonValue_t* a, jsonValue_t* b, int flags) {
+	return json_equal_r(a, b, flags);
+}
+
+bool json_equal(jsonValue_t* a, jsonValue_t* b) {
+	return json_equal_r(a, b, 0);
+}
@@ -0,0 +1,440 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+
+#include "format.h"
+
+/*
+ * Number formatting for the serializers.
+ *
+ * Doubles are formatted with the Grisu2 algorithm (Florian Loitsch, "Printing
+ * Floating-Point Numbers Quickly and Accurately with Integers", 2010) in the
+ * variant with boundaries as used by nlohmann/json. The output is the
+ * shortest (or very close to shortest) string that parses back to the same
+ * value. Integers are formatted two digits at a time.
+ */
+
+static const char json_digit_pairs[] =
+	"00010203040506070809"
+	"10111213141516171819"
+	"20212223242526272829"
+	"30313233343536373839"
+	"40414243444546474849"
+	"50515253545556575859"
+	"60616263646566676869"
+	"70717273747576777879"
+	"80818283848586878889"
+	"90919293949596979899";
+
+static size_t json_format_unsigned(char* buffer, unsigned long long value) {
+	char tmp[20];
+	size_t i = sizeof(tmp);
+	
+	while (value >= 100) {
+		unsigned int pair = (value % 100) * 2;
+		value /= 100;
+		tmp[--i] = json_digit_pairs[pair + 1];
+		tmp[--i] = json_digit_pairs[pair];
+	}
+	if (value >= 10) {
+		unsigned int pair = value * 2;
+		tmp[--i] = json_digit_pairs[pair + 1];
+		tmp[--i] = json_digit_pairs[pair];
+	} else {
+		tmp[--i] = '0' + value;
+	}
+	
+	size_t length = sizeof(tmp) - i;
+	memcpy(buffer, tmp + i, length);
+	buffer[length] = '\0';
+	
+	return length;
+}
+
+size_t json_format_long(char* buffer, long long value) {
+	if (value < 0) {
+		buffer[0] = '-';
+		return json_format_unsigned(buffer + 1, 0ULL - (unsigned long long) value) + 1;
+	}
+	return json_format_unsigned(buffer, value);
+}
+
+typedef struct {
+	uint64_t f;
+	int e;
+} diyfp_t;
+
+static diyfp_t diyfp_sub(diyfp_t x, diyfp_t y) {
+	return (diyfp_t) { x.f - y.f, x.e };
+}
+
+// returns x * y rounded to 64 bits
+static diyfp_t diyfp_mul(diyfp_t x, diyfp_t y) {
+	uint64_t xLow = x.f & 0xFFFFFFFFu;
+	uint64_t xHigh = x.f >> 32;
+	uint64_t yLow = y.f & 0xFFFFFFFFu;
+	uint64_t yHigh = y.f >> 32;
+	
+	uint64_t p0 = xLow * yLow;
+	uint64_t p1 = xLow * yHigh;
+	uint64_t p2 = xHigh * yLow;
+	uint64_t p3 = xHigh * yHigh;
+	
+	uint64_t q = (p0 >> 32) + (p1 & 0xFFFFFFFFu) + (p2 & 0xFFFFFFFFu);
+	q += 1u << 31;
+	
+	return (diyfp_t) { p3 + (p2 >> 32) + (p1 >> 32) + (q >> 32), x.e + y.e + 64 };
+}
+
+static diyfp_t diyfp_normalize(diyfp_t x) {
+	while ((x.f >> 63) == 0) {
+		x.f <<= 1;
+		x.e--;
+	}
+	return x;
+}
+
+static diyfp_t diyfp_normalize_to(diyfp_t x, int e) {
+	return (diyfp_t) { x.f << (x.e - e), e };
+}
+
+typedef struct {
+	diyfp_t w;
+	diyfp_t minus;
+	diyfp_t plus;
+} jsonBoundaries_t;
+
+// value = f * 2^e with precision bits of mantissa (including the hidden bit)
+static jsonBoundaries_t json_compute_boundaries(uint64_t bits, int precision, int maxExponent) {
+	const int bias = maxExponent - 1 + (precision - 1);
+	const int minExponent = 1 - bias;
+	const uint64_t hiddenBit = ((uint64_t) 1) << (precision - 1);
+	
+	uint64_t exponent = bits >> (precision - 1);
+	uint64_t fraction = bits & (hiddenBit - 1);
+	
+	diyfp_t v = exponent == 0 ?
+		(diyfp_t) { fraction, minExponent } :
+		(diyfp_t) { fraction + hiddenBit, (int) exponent - bias };
+	
+	// the lower boundary is closer if the fraction is 0 (except for the smallest normal number)
+	bool lowerCloser = fraction == 0 && exponent > 1;
+	diyfp_t plus = { 2 * v.f + 1, v.e - 1 };
+	diyfp_t minus = lowerCloser ?
+		(diyfp_t) { 4 * v.f - 1, v.e - 2 } :
+		(diyfp_t) { 2 * v.f - 1, v.e - 1 };
+	
+	jsonBoundaries_t result;
+	result.plus = diyfp_normalize(plus);
+	result.minus = diyfp_normalize_to(minus, result.plus.e);
+	result.w = diyfp_normalize(v);
+	return result;
+}
+
+#define GRISU_ALPHA (-60)
+#define GRISU_GAMMA (-32)
+
+typedef struct {
+	uint64_t f;
+	int e;
+	int k;
+} jsonCachedPower_t;
+
+// normalized 10^k for k = -300, -292, ..., 340
+static const jsonCachedPower_t json_cached_powers[] = {
+	{ 0xAB70FE17C79AC6CAULL, -1060, -300 },
+	{ 0xFF77B1FCBEBCDC4FULL, -1034, -292 },
+	{ 0xBE5691EF416BD60CULL, -1007, -284 },
+	{ 0x8DD01FAD907FFC3CULL, -980, -276 },
+	{ 0xD3515C2831559A83ULL, -954, -268 },
+	{ 0x9D71AC8FADA6C9B5ULL, -927, -260 },
+	{ 0xEA9C227723EE8BCBULL, -901, -252 },
+	{ 0xAECC49914078536DULL, -874, -244 },
+	{ 0x823C12795DB6CE57ULL, -847, -236 },
+	{ 0xC21094364DFB5637ULL, -821, -228 },
+	{ 0x9096EA6F3848984FULL, -794, -220 },
+	{ 0xD77485CB25823AC7ULL, -768, -212 },
+	{ 0xA086CFCD97BF97F4ULL, -741, -204 },
+	{ 0xEF340A98172AACE5ULL, -715, -196 },
+	{ 0xB23867FB2A35B28EULL, -688, -188 },
+	{ 0x84C8D4DFD2C63F3BULL, -661, -180 },
+	{ 0xC5DD44271AD3CDBAULL, -635, -172 },
+	{ 0x936B9FCEBB25C996ULL, -608, -164 },
+	{ 0xDBAC6C247D62A584ULL, -582, -156 },
+	{ 0xA3AB66580D5FDAF6ULL, -555, -148 },
+	{ 0xF3E2F893DEC3F126ULL, -529, -140 },
+	{ 0xB5B5ADA8AAFF80B8ULL, -502, -132 },
+	{ 0x87625F056C7C4A8BULL, -475, -124 },
+	{ 0xC9BCFF6034C13053ULL, -449, -116 },
+	{ 0x964E858C91BA2655ULL, -422, -108 },
+	{ 0xDFF9772470297EBDULL, -396, -100 },
+	{ 0xA6DFBD9FB8E5B88FULL, -369, -92 },
+	{ 0xF8A95FCF88747D94ULL, -343, -84 },
+	{ 0xB94470938FA89BCFULL, -316, -76 },
+	{ 0x8A08F0F8BF0F156BULL, -289, -68 },
+	{ 0xCDB02555653131B6ULL, -263, -60 },
+	{ 0x993FE2C6D07B7FACULL, -236, -52 },
+	{ 0xE45C10C42A2B3B06ULL, -210, -44 },
+	{ 0xAA242499697392D3ULL, -183, -36 },
+	{ 0xFD87B5F28300CA0EULL, -157, -28 },
+	{ 0xBCE5086492111AEBULL, -130, -20 },
+	{ 0x8CBCCC096F5088CCULL, -103, -12 },
+	{ 0xD1B71758E219652CULL, -77, -4 },
+	{ 0x9C40000000000000ULL, -50, 4 },
+	{ 0xE8D4A51000000000ULL, -24, 12 },
+	{ 0xAD78EBC5AC620000ULL, 3, 20 },
+	{ 0x813F3978F8940984ULL, 30, 28 },
+	{ 0xC097CE7BC90715B3ULL, 56, 36 },
+	{ 0x8F7E32CE7BEA5C70ULL, 83, 44 },
+	{ 0xD5D238A4ABE98068ULL, 109, 52 },
+	{ 0x9F4F2726179A2245ULL, 136, 60 },
+	{ 0xED63A231D4C4FB27ULL, 162, 68 },
+	{ 0xB0DE65388CC8ADA8ULL, 189, 76 },
+	{ 0x83C7088E1AAB65DBULL, 216, 84 },
+	{ 0xC45D1DF942711D9AULL, 242, 92 },
+	{ 0x924D692CA61BE758ULL, 269, 100 },
+	{ 0xDA01EE641A708DEAULL, 295, 108 },
+	{ 0xA26DA3999AEF774AULL, 322, 116 },
+	{ 0xF209787BB47D6B85ULL, 348, 124 },
+	{ 0xB454E4A179DD1877ULL, 375, 132 },
+	{ 0x865B86925B9BC5C2ULL, 402, 140 },
+	{ 0xC83553C5C8965D3DULL, 428, 148 },
+	{ 0x952AB45CFA97A0B3ULL, 455, 156 },
+	{ 0xDE469FBD99A05FE3ULL, 481, 164 },
+	{ 0xA59BC234DB398C25ULL, 508, 172 },
+	{ 0xF6C69A72A3989F5CULL, 534, 180 },
+	{ 0xB7DCBF5354E9BECEULL, 561, 188 },
+	{ 0x88FCF317F22241E2ULL, 588, 196 },
+	{ 0xCC20CE9BD35C78A5ULL, 614, 204 },
+	{ 0x98165AF37B2153DFULL, 641, 212 },
+	{ 0xE2A0B5DC971F303AULL, 667, 220 },
+	{ 0xA8D9D1535CE3B396ULL, 694, 228 },
+	{ 0xFB9B7CD9A4A7443CULL, 720, 236 },
+	{ 0xBB764C4CA7A44410ULL, 747, 244 },
+	{ 0x8BAB8EEFB6409C1AULL, 774, 252 },
+	{ 0xD01FEF10A657842CULL, 800, 260 },
+	{ 0x9B10A4E5E9913129ULL, 827, 268 },
+	{ 0xE7109BFBA19C0C9DULL, 853, 276 },
+	{ 0xAC2820D9623BF429ULL, 880, 284 },
+	{ 0x80444B5E7AA7CF85ULL, 907, 292 },
+	{ 0xBF21E44003ACDD2DULL, 933, 300 },
+	{ 0x8E679C2F5E44FF8FULL, 960, 308 },
+	{ 0xD433179D9C8CB841ULL, 986, 316 },
+	{ 0x9E19DB92B4E31BA9ULL, 1013, 324 },
+	{ 0xEB96BF6EBADF77D9ULL, 1039, 332 },
+	{ 0xAF87023B9BF0EE6BULL, 1066, 340 },
+};
+
+#define JSON_CACHED_POWERS_MIN_K (-300)
+#define JSON_CACHED_POWERS_STEP (8)
+
+// returns c = 10^k such that ALPHA <= e + c.e + 64 <= GAMMA
+static jsonCachedPower_t json_cached_power(int e) {
+	int f = GRISU_ALPHA - e - 1;
+	// ceil(f * log10(2))
+	int k = (f * 78913) / (1 << 18) + (f > 0);
+	int index = (-JSON_CACHED_POWERS_MIN_K + k + (JSON_CACHED_POWERS_STEP - 1)) / JSON_CACHED_POWERS_STEP;
+	return json_cached_powers[index];
+}
+
+static int json_largest_pow10(uint32_t n, uint32_t* pow10) {
+	static const uint32_t powers[] = {
+		1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000
+	};
+	
+	int digits = 10;
+	while (digits > 1 && n < powers[digits - 1])
+		digits--;
+	*pow10 = powers[digits - 1];
+	return digits;
+}
+
+static void grisu2_round(char* buffer, int length, uint64_t dist, uint64_t delta, uint64_t rest, uint64_t tenK) {
+	while (rest < dist && delta - rest >= tenK && (rest + tenK < dist || dist - rest > rest + tenK - dist)) {
+		buffer[length - 1]--;
+		rest += tenK;
+	}
+}
+
+static void grisu2_digit_gen(char* buffer, int* length, int* decimalExponent, diyfp_t minus, diyfp_t w, diyfp_t plus) {
+	uint64_t delta = diyfp_sub(plus, minus).f;
+	uint64_t dist = diyfp_sub(plus, w).f;
+	
+	diyfp_t one = { ((uint64_t) 1) << -plus.e, plus.e };
+	
+	uint32_t p1 = (uint32_t) (plus.f >> -one.e);
+	uint64_t p2 = plus.f & (one.f - 1);
+	
+	uint32_t pow10;
+	int n = json_largest_pow10(p1, &pow10);
+	
+	// integral digits
+	while (n > 0) {
+		uint32_t digit = p1 / pow10;
+		p1 %= pow10;
+		buffer[(*length)++] = '0' + digit;
+		n--;
+		
+		uint64_t rest = (((uint64_t) p1) << -one.e) + p2;
+		if (rest <= delta) {
+			*decimalExponent += n;
+			grisu2_round(buffer, *length, dist, delta, rest, ((uint64_t) pow10) << -one.e);
+			return;
+		}
+		
+		pow10 /= 10;
+	}
+	
+	// fractional digits
+	int m = 0;
+	while (true) {
+		p2 *= 10;
+		buffer[(*length)++] = '0' + (p2 >> -one.e);
+		p2 &= one.f - 1;
+		m++;
+		
+		delta *= 10;
+		dist *= 10;
+		if (p2 <= delta)
+			break;
+	}
+	
+	*decimalExponent -= m;
+	grisu2_round(buffer, *length, dist, delta, p2, one.f);
+}
+
+// writes the digits of a positive, finite value; value = digits * 10^decimalExponent
+static int grisu2(char* buffer, int* decimalExponent, jsonBoundaries_t boundaries) {
+	jsonCachedPower_t cached = json_cached_power(boundaries.plus.e);
+	diyfp_t c = { cached.f, cached.e };
+	
+	diyfp_t w = diyfp_mul(boundaries.w, c);
+	diyfp_t minus = diyfp_mul(boundaries.minus, c);
+	diyfp_t plus = diyfp_mul(boundaries.plus, c);
+	
+	// shrink the interval by one ulp on each side to account for the rounding of mul
+	minus.f++;
+	plus.f--;
+	
+	int length = 0;
+	*decimalExponent = -cached.k;
+	grisu2_digit_gen(buffer, &length, decimalExponent, minus, w, plus);
+	
+	return length;
+}
+
+static char* json_append_exponent(char* buffer, int e) {
+	if (e < 0) {
+		e = -e;
+		*buffer++ = '-';
+	} else {
+		*buffer++ = '+';
+	}
+	
+	return buffer + json_format_unsigned(buffer, e);
+}
+
+// turns the digits into decimal notation (up to 10^maxExponent) or scientific notation
+static size_t json_format_digits(char* buffer, int length, int decimalExponent, int minExponent, int maxExponent) {
+	int k = length;
+	int n = length + decimalExponent;
+	
+	if (k <= n && n <= maxExponent) {
+		// digits[000].0
+		memset(buffer + k, '0', n - k);
+		buffer[n] = '.';
+		buffer[n + 1] = '0';
+		buffer[n + 2] = '\0';
+		return n + 2;
+	}
+	
+	if (0 < n && n <= maxExponent) {
+		// dig.its
+		memmove(buffer + n + 1, buffer + n, k - n);
+		buffer[n] = '.';
+		buffer[k + 1] = '\0';
+		return k + 1;
+	}
+	
+	if (minExponent < n && n <= 0) {
+		// 0.[000]digits
+		memmove(buffer + 2 - n, buffer, k);
+		buffer[0] = '0';
+		buffer[1] = '.';
+		memset(buffer + 2, '0', -n);
+		buffer[2 - n + k] = '\0';
+		return 2 - n + k;
+	}
+	
+	char* end;
+	if (k == 1) {
+		// de+123
+		end = buffer + 1;
+	} else {
+		// d.igitse+123
+		memmove(buffer + 2, buffer + 1, k - 1);
+		buffer[1] = '.';
+		end = buffer + 1 + k;
+	}
+	
+	*end++ = 'e';
+	end = json_append_exponent(end, n - 1);
+	
+	return end - buffer;
+}
+
+static size_t json_format_special(char* buffer, double value) {
+	if (!isfinite(value)) {
+		// not representable in JSON
+		memcpy(buffer, "null", 5);
+		return 4;
+	}
+	
+	if (signbit(value)) {
+		memcpy(buffer, "-0.0", 5);
+		return 4;
+	}
+	
+	memcpy(buffer, "0.0", 4);
+	return 3;
+}
+
+size_t json_format_double(char* buffer, double value) {
+	if (!isfinite(value) || value == 0)
+		return json_format_special(buffer, value);
+	
+	size_t sign = 0;
+	if (value < 0) {
+		buffer[sign++] = '-';
+		value = -value;
+	}
+	
+	uint64_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	
+	int decimalExponent;
+	int length = grisu2(buffer + sign, &decimalExponent, json_compute_boundaries(bits, 53, 1024));
+	
+	return sign + json_format_digits(buffer + sign, length, decimalExponent, -4, 15);
+}
+
+size_t json_format_float(char* buffer, float value) {
+	if (!isfinite(value) || value == 0)
+		return json_format_special(buffer, value);
+	
+	size_t sign = 0;
+	if (value < 0) {
+		buffer[sign++] = '-';
+		value = -value;
+	}
+	
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	
+	int decimalExponent;
+	int length = grisu2(buffer + sign, &decimalExponent, json_compute_boundaries(bits, 24, 128));
+	
+	return sign + json_format_digits(buffer + sign, length, decimalExponent, -4, 6);
+}
@@ -0,0 +1,13 @@
+#ifndef JSON_FORMAT_H
+#define JSON_FORMAT_H
+
+#include <stdlib.h>
+
+// large enough for any output of the functions below (including '\0')
+#define JSON_FORMAT_BUFFER_SIZE (32)
+
+size_t json_format_long(char* buffer, long long value);
+size_t json_format_double(char* buffer, double value);
+size_t json_format_float(char* buffer, float value);
+
+#endif
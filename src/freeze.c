@@ -0,0 +1,158 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "json.h"
+#include "alloc.h"
+#include "container.h"
+
+/*
+ * Frozen documents. json_freeze() creates everything readers would
+ * otherwise create lazily - the container info, json_hash() values and the
+ * serialized form of json_cache()d containers - and adds a key index to
+ * large objects. Afterwards every container is marked as frozen and all
+ * functions that modify containers fail, so reading functions never write
+ * to the document and can run concurrently without locking. The frozen flag
+ * lives in the container info, which shared values (json_share()) have in
+ * common: they get a copy as soon as they are modified, only the last owner
+ * of frozen entries can't modify them.
+ */
+
+// objects with fewer entries are searched linearly
+#define JSON_FREEZE_INDEX_ENTRIES (16)
+
+extern uint64_t json_hash_string(const char* string);
+
+static int json_freeze_index(jsonValue_t* object, struct jsonContainerInfo* info) {
+	size_t size = object->value.object.size;
+	size_t slots = JSON_FREEZE_INDEX_ENTRIES * 2;
+	while (slots < size * 2)
+		slots *= 2;
+	
+	size_t* index = json_calloc(slots, sizeof(size_t));
+	if (index == NULL)
+		return -1;
+	
+	// duplicate keys share a probe sequence, so the first one is found first
+	for (size_t i = 0; i < size; i++) {
+		size_t slot = json_hash_string(object->value.object.entries[i].key) & (slots - 1);
+		while (index[slot] != 0)
+			slot = (slot + 1) & (slots - 1);
+		index[slot] = i + 1;
+	}
+	
+	info->index = index;
+	info->indexSlots = slots;
+	
+	return 0;
+}
+
+// position of the first entry with the key; the size of the object if there is none
+size_t json_container_key(jsonValue_t* object, const char* key) {
+	size_t size = object->value.object.size;
+	struct jsonContainerInfo* info = json_container_info_get(object);
+	
+	if (info == NULL || info->index == NULL) {
+		for (size_t i = 0; i < size; i++) {
+			if (strcmp(object->value.object.entries[i].key, key) == 0)
+				return i;
+		}
+		return size;
+	}
+	
+	size_t mask = info->indexSlots - 1;
+	for (size_t slot = json_hash_string(key) & mask; info->index[slot] != 0; slot = (slot + 1) & mask) {
+		size_t i = info->index[slot] - 1;
+		if (strcmp(object->value.object.entries[i].key, key) == 0)
+			return i;
+	}
+	
+	return size;
+}
+
+static int json_freeze_r(jsonValue_t* value) {
+	if (value->type != JSON_ARRAY && value->type != JSON_OBJECT)
+		return 0;
+	
+	if (json_container_readonly(value))
+		return 0;
+	
+	// entries shared with other values get copied, so the other owners stay modifiable
+	if (json_container_unshare(value) < 0)
+		return -1;
+	
+	struct jsonContainerInfo* info = json_container_info(value);
+	if (info == NULL)
+		return -1;
+	
+	// data from before a modification inside would be trusted forever once frozen
+	if (json_document_attach(value) < 0)
+		return -1;
+	bool cache = info->cache != NULL && !json_container_current(value, info, info->cache->generation);
+	bool spans = info->source != NULL && !json_container_current(value, info, info->spanGeneration);
+	bool hash = info->hashed && !json_container_current(value, info, info->hashGeneration);
+	if (cache || spans || hash) {
+		json_container_dirty(value);
+		json_container_entries_dirty(value);
+	}
+	
+	// fills the caches of this container and all cached containers inside
+	if (info->cached && info->cache == NULL)
+		json_dealloc(json_stringify(value));
+	
+	if (value->type == JSON_ARRAY) {
+		for (size_t i = 0; i < value->value.array.size; i++) {
+			if (json_freeze_r(&value->value.array.entries[i]) < 0)
+				return -1;
+		}
+	} else {
+		for (size_t i = 0; i < value->value.object.size; i++) {
+			if (json_freeze_r(&value->value.object.entries[i].value) < 0)
+				return -1;
+		}
+		
+		if (info->index == NULL && value->value.object.size >= JSON_FREEZE_INDEX_ENTRIES && json_freeze_index(value, info) < 0)
+			return -1;
+	}
+	
+	if (info->cached && info->cache == NULL)
+		return -1;
+	
+	// the entries are hashed already, so this only combines their hashes
+	json_hash(value);
+	
+	return 0;
+}
+
+static void json_freeze_mark_r(jsonValue_t* value) {
+	struct jsonContainerInfo* info = json_container_info_get(value);
+	if (info == NULL || info->frozen)
+		return;
+	
+	if (value->type == JSON_ARRAY) {
+		for (size_t i = 0; i < value->value.array.size; i++) {
+			json_freeze_mark_r(&value->value.array.entries[i]);
+		}
+	} else {
+		for (size_t i = 0; i < value->value.object.size; i++) {
+			json_freeze_mark_r(&value->value.object.entries[i].value);
+		}
+	}
+	
+	info->frozen = true;
+}
+
+int json_freeze(jsonValue_t* value) {
+	// nothing is marked before everything is prepared
+	if (json_freeze_r(value) < 0)
+		return -1;
+	
+	json_freeze_mark_r(value);
+	
+	return 0;
+}
+
+bool json_frozen(jsonValue_t* value) {
+	return json_container_frozen(value);
+}
@@ -0,0 +1,162 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "json.h"
+#include "alloc.h"
+#include "container.h"
+
+/*
+ * Hash-consing: json_intern_subtrees() walks the document bottom-up and
+ * replaces every array or object that is equal to one seen before by a
+ * shared clone of the first one (see json_share()), so the duplicate's
+ * entries, keys and strings are freed. Since the children are interned
+ * before their parents, comparing two candidates mostly finds shared
+ * entries and stops right away.
+ *
+ * Scalar strings outside of duplicated containers are not merged; every
+ * value owns its string.
+ */
+
+#define JSON_INTERN_INITIAL_SLOTS (256)
+
+extern uint64_t json_hash_string(const char* string);
+extern void json_free_r(jsonValue_t* value);
+
+struct jsonInternSlot {
+	uint64_t hash;
+	jsonValue_t* value;
+};
+
+struct jsonInternTable {
+	size_t size;
+	size_t slots;
+	struct jsonInternSlot* entries;
+	// set if the table couldn't grow; values are only looked up from then on
+	bool full;
+	bool failed;
+};
+
+static inline uint64_t json_intern_mix(uint64_t hash, uint64_t value) {
+	hash = (hash ^ value) * 0x9e3779b97f4a7c15ull;
+	return hash ^ (hash >> 29);
+}
+
+static bool json_intern_grow(struct jsonInternTable* table) {
+	size_t slots = table->slots == 0 ? JSON_INTERN_INITIAL_SLOTS : table->slots * 2;
+	struct jsonInternSlot* entries = json_calloc(slots, sizeof(struct jsonInternSlot));
+	if (entries == NULL)
+		return false;
+	
+	for (size_t i = 0; i < table->slots; i++) {
+		if (table->entries[i].value == NULL)
+			continue;
+		size_t slot = table->entries[i].hash & (slots - 1);
+		while (entries[slot].value != NULL)
+			slot = (slot + 1) & (slots - 1);
+		entries[slot] = table->entries[i];
+	}
+	
+	json_dealloc(table->entries);
+	table->entries = entries;
+	table->slots = slots;
+	
+	return true;
+}
+
+// replaces value by a shared clone of an equal container interned before, or remembers it
+static void json_intern_container(struct jsonInternTable* table, jsonValue_t* value, uint64_t hash) {
+	if (table->slots > 0) {
+		size_t mask = table->slots - 1;
+		for (size_t slot = hash & mask; table->entries[slot].value != NULL; slot = (slot + 1) & mask) {
+			jsonValue_t* interned = table->entries[slot].value;
+			if (table->entries[slot].hash != hash || !json_equal(interned, value))
+				continue;
+			
+			jsonValue_t* shared = json_share(interned);
+			if (shared == NULL) {
+				table->failed = true;
+				return;
+			}
+			json_free_r(value);
+			*value = *shared;
+			json_dealloc(shared);
+			return;
+		}
+	}
+	
+	if (table->full)
+		return;
+	
+	if ((table->size + 1) * 2 > table->slots && !json_intern_grow(table)) {
+		table->full = true;
+		table->failed = true;
+		return;
+	}
+	
+	size_t slot = hash & (table->slots - 1);
+	while (table->entries[slot].value != NULL)
+		slot = (slot + 1) & (table->slots - 1);
+	table->entries[slot].hash = hash;
+	table->entries[slot].value = value;
+	table->size++;
+}
+
+// returns the hash of the value; equal values have equal hashes. frozen is set if the value contains frozen containers
+static uint64_t json_intern_r(struct jsonInternTable* table, jsonValue_t* value, bool* frozen) {
+	uint64_t hash = json_intern_mix(0, value->type);
+	bool inside = false;
+	
+	switch(value->type) {
+		case JSON_ARRAY:
+			for (size_t i = 0; i < value->value.array.size; i++) {
+				hash = json_intern_mix(hash, json_intern_r(table, &value->value.array.entries[i], &inside));
+			}
+			break;
+		case JSON_OBJECT:
+			for (size_t i = 0; i < value->value.object.size; i++) {
+				jsonObjectEntry_t* entry = &value->value.object.entries[i];
+				hash = json_intern_mix(hash, json_hash_string(entry->key));
+				hash = json_intern_mix(hash, json_intern_r(table, &entry->value, &inside));
+			}
+			break;
+		default:
+			return json_hash(value);
+	}
+	
+	/*
+	 * Containers with frozen parts are left alone: a frozen document that is
+	 * shared can be modified (see json_container_unshare()), and an equal
+	 * copy that was interned instead could be freed when its parent is
+	 * replaced.
+	 */
+	inside = inside || json_container_frozen(value);
+	*frozen = *frozen || inside;
+	
+	bool empty = value->type == JSON_ARRAY ? value->value.array.size == 0 : value->value.object.size == 0;
+	if (!empty && !inside)
+		json_intern_container(table, value, hash);
+	
+	return hash;
+}
+
+int json_intern_subtrees(jsonValue_t* value) {
+	if (json_container_frozen(value))
+		return -1;
+	
+	struct jsonInternTable table = {
+		.size = 0,
+		.slots = 0,
+		.entries = NULL,
+		.full = false,
+		.failed = false,
+	};
+	
+	bool frozen = false;
+	json_intern_r(&table, value, &frozen);
+	
+	json_dealloc(table.entries);
+	
+	return table.failed ? -1 : 0;
+}
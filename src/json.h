@@ -2,7 +2,10 @@
 #define JSON_H
 
 #include <stdlib.h>
+#include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <sys/uio.h>
 
 typedef enum {
 	JSON_ARRAY,
@@ -14,6 +17,9 @@ typedef enum {
 	JSON_NULL,
 } jsonValueType_t;
 
+struct jsonContainerInfo;
+
+// entries are allocated by the library; internal bookkeeping (e.g. cached output) is stored in front of them
 typedef struct {
 	size_t size;
 	struct jsonObjectEntry* entries;
@@ -41,6 +47,104 @@ typedef struct jsonObjectEntry {
 	struct jsonValue value;
 } jsonObjectEntry_t;
 
+typedef struct {
+	size_t offset;
+	size_t length;
+} jsonSpan_t;
+
+typedef struct {
+	jsonValueType_t type;
+	size_t size;
+	// bit i is set if row i is null or missing
+	unsigned char* nulls;
+	union {
+		long long* integers;
+		double* reals;
+		bool* booleans;
+	} values;
+	// strings: row i starts at data + offsets[i]; offsets has size + 1 entries
+	size_t* offsets;
+	char* data;
+	size_t dataCapacity;
+} jsonColumn_t;
+
+#define JSON_REDUCE_SUM   (1 << 0)
+#define JSON_REDUCE_MIN   (1 << 1)
+#define JSON_REDUCE_MAX   (1 << 2)
+#define JSON_REDUCE_COUNT (1 << 3)
+#define JSON_REDUCE_MEAN  (1 << 4)
+#define JSON_REDUCE_ALL   (JSON_REDUCE_SUM | JSON_REDUCE_MIN | JSON_REDUCE_MAX | JSON_REDUCE_COUNT | JSON_REDUCE_MEAN)
+
+typedef struct {
+	size_t count;
+	struct jsonValue sum;
+	struct jsonValue min;
+	struct jsonValue max;
+	double mean;
+} jsonReduction_t;
+
+// compare objects regardless of the order of their keys; see json_equal_with()
+#define JSON_EQUAL_UNORDERED (1 << 0)
+
+// record the source text of parsed values; see json_parse_with()
+#define JSON_PARSE_SPANS (1 << 0)
+// merge equal arrays and objects after parsing; see json_intern_subtrees()
+#define JSON_PARSE_INTERN (1 << 1)
+
+typedef void* (*jsonMallocFunction_t)(void* context, size_t size);
+typedef void* (*jsonReallocFunction_t)(void* context, void* pointer, size_t size);
+typedef void (*jsonFreeFunction_t)(void* context, void* pointer);
+
+typedef struct jsonPool jsonPool_t;
+
+typedef struct {
+	// counters; updated atomically
+	size_t allocations;
+	size_t frees;
+	size_t bytes;
+	size_t peak;
+	// allocator the requests are passed to; malloc() if NULL
+	jsonMallocFunction_t malloc;
+	jsonReallocFunction_t realloc;
+	jsonFreeFunction_t free;
+	void* context;
+} jsonAllocatorStats_t;
+
+typedef struct {
+	// values including the entries of containers
+	size_t values;
+	size_t containers;
+	size_t entries;
+	// string values and keys
+	size_t strings;
+	size_t stringBytes;
+	// allocated but unused entries (see json_reserve())
+	size_t slack;
+	// container bookkeeping: cached output, source spans and text
+	size_t overhead;
+	size_t bytes;
+} jsonMemoryUsage_t;
+
+typedef int (*jsonWriteFunction_t)(void* context, const char* data, size_t length);
+
+typedef struct jsonQuery jsonQuery_t;
+typedef struct jsonQueryIterator jsonQueryIterator_t;
+typedef struct jsonWriter jsonWriter_t;
+typedef struct jsonPersistent jsonPersistent_t;
+
+void json_set_allocator(jsonMallocFunction_t malloc, jsonReallocFunction_t realloc, jsonFreeFunction_t free, void* context);
+void json_set_thread_allocator(jsonMallocFunction_t malloc, jsonReallocFunction_t realloc, jsonFreeFunction_t free, void* context);
+jsonPool_t* json_pool_new();
+void json_pool_destroy(jsonPool_t* pool);
+size_t json_pool_size(jsonPool_t* pool);
+void* json_pool_malloc(void* context, size_t size);
+void* json_pool_realloc(void* context, void* pointer, size_t size);
+void json_pool_free(void* context, void* pointer);
+void* json_stats_malloc(void* context, size_t size);
+void* json_stats_realloc(void* context, void* pointer, size_t size);
+void json_stats_free(void* context, void* pointer);
+size_t json_memory_usage(jsonValue_t* value, jsonMemoryUsage_t* usage);
+
 void json_free(jsonValue_t* value);
 jsonValue_t* json_value();
 
@@ -54,15 +158,94 @@ jsonValue_t* json_object(bool freeAfterwards, size_t size, ...);
 
 jsonValue_t* json_array_direct(bool freeAfterwards, size_t size, jsonValue_t* values[]);
 
+int json_array_push(jsonValue_t* array, jsonValue_t* value);
+int json_array_insert(jsonValue_t* array, size_t index, jsonValue_t* value);
+int json_array_remove(jsonValue_t* array, size_t index);
+int json_object_set(jsonValue_t* object, const char* key, jsonValue_t* value);
+jsonValue_t* json_object_take(jsonValue_t* object, const char* key);
+int json_object_remove(jsonValue_t* object, const char* key);
+int json_reserve(jsonValue_t* value, size_t capacity);
+
 void json_print(jsonValue_t* value);
 
+bool json_equal(jsonValue_t* a, jsonValue_t* b);
+bool json_equal_with(jsonValue_t* a, jsonValue_t* b, int flags);
+uint64_t json_hash(jsonValue_t* value);
+
+jsonValue_t* json_diff(jsonValue_t* a, jsonValue_t* b);
+int json_patch_apply(jsonValue_t* document, jsonValue_t* patch);
+int json_merge_patch_apply(jsonValue_t* document, jsonValue_t* patch);
+
 jsonValue_t* json_clone(jsonValue_t* value);
+jsonValue_t* json_share(jsonValue_t* value);
+void json_set_shared_clones(bool enabled);
+
+int json_freeze(jsonValue_t* value);
+bool json_frozen(jsonValue_t* value);
+int json_intern_subtrees(jsonValue_t* value);
 
 jsonValue_t* json_object_get(jsonValue_t* value, const char* key);
 jsonValue_t* json_array_get(jsonValue_t* value, size_t i);
 jsonValue_t* json_query(jsonValue_t* value, const char* query);
 
+int json_set(jsonValue_t* value, const char* query, jsonValue_t* replacement);
+int json_invalidate(jsonValue_t* value, const char* query);
+
+jsonPersistent_t* json_persistent_new(jsonValue_t* value);
+jsonValue_t* json_persistent_value(jsonPersistent_t* persistent);
+jsonPersistent_t* json_persistent_retain(jsonPersistent_t* persistent);
+void json_persistent_release(jsonPersistent_t* persistent);
+jsonValueType_t json_persistent_type(jsonPersistent_t* persistent);
+size_t json_persistent_size(jsonPersistent_t* persistent);
+jsonPersistent_t* json_persistent_get(jsonPersistent_t* persistent, const char* query);
+jsonPersistent_t* json_persistent_set(jsonPersistent_t* persistent, const char* query, jsonValue_t* value);
+jsonPersistent_t* json_persistent_remove(jsonPersistent_t* persistent, const char* query);
+
+jsonQuery_t* json_query_compile(const char* query);
+void json_query_free(jsonQuery_t* query);
+jsonValue_t* json_query_compiled(jsonValue_t* value, jsonQuery_t* query);
+int json_query_many(jsonValue_t* value, jsonQuery_t* queries[], size_t n, jsonValue_t* results[]);
+jsonQueryIterator_t* json_query_iterate(jsonValue_t* value, jsonQuery_t* query);
+jsonValue_t* json_query_next(jsonQueryIterator_t* iterator);
+void json_query_iterator_free(jsonQueryIterator_t* iterator);
+int json_query_text(const char* text, size_t length, jsonQuery_t* query, jsonSpan_t* span);
+jsonValue_t* json_query_text_value(const char* text, size_t length, jsonQuery_t* query);
+
+int json_array_to_columns(jsonValue_t* array, const char* fields[], size_t n, jsonColumn_t** columns);
+bool json_column_is_null(jsonColumn_t* column, size_t row);
+void json_columns_free(jsonColumn_t* columns, size_t n);
+int json_array_reduce(jsonValue_t* value, int operations, jsonReduction_t* out);
+
 char* json_stringify(jsonValue_t* value);
+size_t json_stringify_length(jsonValue_t* value);
+int json_stringify_buf(jsonValue_t* value, char* string, size_t capacity, size_t* needed);
+int json_cache(jsonValue_t* value);
+void json_uncache(jsonValue_t* value);
+int json_stringify_to(jsonValue_t* value, jsonWriteFunction_t write, void* context);
+int json_stringify_to_file(jsonValue_t* value, FILE* file);
+int json_stringify_to_fd(jsonValue_t* value, int fd);
+int json_stringify_iov(jsonValue_t* value, struct iovec** iov, int* count);
+char* json_stringify_parallel(jsonValue_t* value, int nthreads);
+int json_stringify_parallel_to(jsonValue_t* value, int nthreads, jsonWriteFunction_t write, void* context);
+jsonWriter_t* json_writer_new();
+jsonWriter_t* json_writer_new_sink(jsonWriteFunction_t write, void* context);
+int json_writer_begin_object(jsonWriter_t* writer);
+int json_writer_end_object(jsonWriter_t* writer);
+int json_writer_begin_array(jsonWriter_t* writer);
+int json_writer_end_array(jsonWriter_t* writer);
+int json_writer_key(jsonWriter_t* writer, const char* key);
+int json_writer_string(jsonWriter_t* writer, const char* string);
+int json_writer_long(jsonWriter_t* writer, long long value);
+int json_writer_double(jsonWriter_t* writer, double value);
+int json_writer_bool(jsonWriter_t* writer, bool value);
+int json_writer_null(jsonWriter_t* writer);
+int json_writer_value(jsonWriter_t* writer, jsonValue_t* value);
+char* json_writer_finish(jsonWriter_t* writer);
+int json_writer_close(jsonWriter_t* writer);
+int json_write_file(void* context, const char* data, size_t length);
+int json_write_fd(void* context, const char* data, size_t length);
 jsonValue_t* json_parse(const char* string);
+jsonValue_t* json_parse_n(const char* string, size_t length);
+jsonValue_t* json_parse_with(const char* string, size_t length, int flags);
 
 #endif
@@ -3,9 +3,11 @@
 #include <string.h>
 #include <errno.h>
 #include <alloca.h>
+#include <math.h>
 
 #include "json.h"
 #include "marshaller.h"
+#include "format.h"
 
 void _marshallPanic(const char* name, const char* reason) {
 	if (reason == NULL) {
@@ -77,7 +79,14 @@ static jsonValue_t* json_marshall_long_long(void* value) {
 }
 
 static jsonValue_t* json_marshall_float(void* value) {
-	return json_double(*((float*) value));
+	float f = *((float*) value);
+	if (!isfinite(f))
+		return json_double(f);
+	
+	// use the double that is closest to the shortest representation of the float
+	char buffer[JSON_FORMAT_BUFFER_SIZE];
+	json_format_float(buffer, f);
+	return json_double(strtod(buffer, NULL));
 }
 
 static jsonValue_t* json_marshall_double(void* value) {
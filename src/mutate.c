@@ -0,0 +1,259 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "json.h"
+#include "alloc.h"
+#include "container.h"
+
+extern void json_free_r(jsonValue_t* value);
+
+/*
+ * In-place modification of arrays and objects. Values that are added are
+ * taken over (the struct is copied into the container and the pointer is
+ * freed); on failure they stay with the caller. The entries grow
+ * geometrically; the capacity is kept in the container info.
+ *
+ * Added values join the document of the container (see container.h). The
+ * _entry variants only mark the modified container. They are used by
+ * json_set() and the patch functions, which mark the containers on the path
+ * themselves; the public functions don't know the containers above and call
+ * json_container_changed().
+ */
+
+#define JSON_MUTATE_MIN_CAPACITY (4)
+
+static size_t json_container_size(jsonValue_t* value) {
+	return value->type == JSON_ARRAY ? value->value.array.size : value->value.object.size;
+}
+
+static size_t json_container_capacity(jsonValue_t* value) {
+	struct jsonContainerInfo* info = json_container_info_get(value);
+	size_t size = json_container_size(value);
+	
+	if (info == NULL || info->capacity < size)
+		return size;
+	return info->capacity;
+}
+
+static int json_container_resize(jsonValue_t* value, size_t capacity) {
+	struct jsonContainerInfo* info = json_container_info(value);
+	if (info == NULL)
+		return -1;
+	
+	if (value->type == JSON_ARRAY) {
+		jsonValue_t* entries = json_entries_realloc(value->value.array.entries, capacity, sizeof(jsonValue_t));
+		if (entries == NULL)
+			return -1;
+		value->value.array.entries = entries;
+	} else {
+		jsonObjectEntry_t* entries = json_entries_realloc(value->value.object.entries, capacity, sizeof(jsonObjectEntry_t));
+		if (entries == NULL)
+			return -1;
+		value->value.object.entries = entries;
+	}
+	
+	info->capacity = capacity;
+	
+	return 0;
+}
+
+// makes room for at least one more entry
+static int json_container_grow(jsonValue_t* value) {
+	size_t capacity = json_container_capacity(value);
+	if (json_container_size(value) < capacity)
+		return 0;
+	
+	capacity *= 2;
+	if (capacity < JSON_MUTATE_MIN_CAPACITY)
+		capacity = JSON_MUTATE_MIN_CAPACITY;
+	
+	return json_container_resize(value, capacity);
+}
+
+int json_reserve(jsonValue_t* value, size_t capacity) {
+	if (value->type != JSON_ARRAY && value->type != JSON_OBJECT)
+		return -1;
+	
+	if (json_container_unshare(value) < 0)
+		return -1;
+	
+	if (capacity <= json_container_capacity(value))
+		return 0;
+	
+	return json_container_resize(value, capacity);
+}
+
+int json_array_insert_entry(jsonValue_t* array, size_t index, jsonValue_t* value) {
+	if (array->type != JSON_ARRAY || index > array->value.array.size)
+		return -1;
+	
+	if (json_container_unshare(array) < 0 || json_container_grow(array) < 0)
+		return -1;
+	
+	jsonValue_t* entries = array->value.array.entries;
+	size_t size = array->value.array.size;
+	
+	memmove(&entries[index + 1], &entries[index], sizeof(jsonValue_t) * (size - index));
+	entries[index] = *value;
+	array->value.array.size++;
+	json_dealloc(value);
+	json_document_adopt(array, &entries[index]);
+	
+	json_container_dirty(array);
+	if (index < size)
+		json_container_entries_dirty(array);
+	
+	return 0;
+}
+
+int json_array_insert(jsonValue_t* array, size_t index, jsonValue_t* value) {
+	if (json_array_insert_entry(array, index, value) < 0)
+		return -1;
+	
+	json_container_changed(array);
+	
+	return 0;
+}
+
+int json_array_push(jsonValue_t* array, jsonValue_t* value) {
+	if (array->type != JSON_ARRAY)
+		return -1;
+	
+	return json_array_insert(array, array->value.array.size, value);
+}
+
+int json_array_remove_entry(jsonValue_t* array, size_t index) {
+	if (array->type != JSON_ARRAY || index >= array->value.array.size)
+		return -1;
+	
+	if (json_container_unshare(array) < 0)
+		return -1;
+	
+	jsonValue_t* entries = array->value.array.entries;
+	
+	json_free_r(&entries[index]);
+	memmove(&entries[index], &entries[index + 1], sizeof(jsonValue_t) * (array->value.array.size - index - 1));
+	array->value.array.size--;
+	
+	json_container_dirty(array);
+	json_container_entries_dirty(array);
+	
+	return 0;
+}
+
+int json_array_remove(jsonValue_t* array, size_t index) {
+	if (json_array_remove_entry(array, index) < 0)
+		return -1;
+	
+	json_container_changed(array);
+	
+	return 0;
+}
+
+static size_t json_object_find(jsonValue_t* object, const char* key) {
+	for (size_t i = 0; i < object->value.object.size; i++) {
+		if (strcmp(object->value.object.entries[i].key, key) == 0)
+			return i;
+	}
+	
+	return object->value.object.size;
+}
+
+int json_object_set_entry(jsonValue_t* object, const char* key, jsonValue_t* value) {
+	if (object->type != JSON_OBJECT)
+		return -1;
+	
+	if (json_container_unshare(object) < 0)
+		return -1;
+	
+	size_t i = json_object_find(object, key);
+	
+	if (i < object->value.object.size) {
+		json_free_r(&object->value.object.entries[i].value);
+		object->value.object.entries[i].value = *value;
+		json_dealloc(value);
+		json_document_adopt(object, &object->value.object.entries[i].value);
+		
+		json_container_dirty(object);
+		json_container_entry_dirty(object, i);
+		
+		return 0;
+	}
+	
+	char* copy = json_strdup(key);
+	if (copy == NULL)
+		return -1;
+	
+	if (json_container_grow(object) < 0) {
+		json_dealloc(copy);
+		return -1;
+	}
+	
+	object->value.object.entries[i].key = copy;
+	object->value.object.entries[i].value = *value;
+	object->value.object.size++;
+	json_dealloc(value);
+	json_document_adopt(object, &object->value.object.entries[i].value);
+	
+	json_container_dirty(object);
+	
+	return 0;
+}
+
+int json_object_set(jsonValue_t* object, const char* key, jsonValue_t* value) {
+	if (json_object_set_entry(object, key, value) < 0)
+		return -1;
+	
+	json_container_changed(object);
+	
+	return 0;
+}
+
+jsonValue_t* json_object_take_entry(jsonValue_t* object, const char* key) {
+	if (object->type != JSON_OBJECT)
+		return NULL;
+	
+	if (json_container_unshare(object) < 0)
+		return NULL;
+	
+	size_t i = json_object_find(object, key);
+	if (i == object->value.object.size)
+		return NULL;
+	
+	jsonValue_t* value = json_alloc(sizeof(jsonValue_t));
+	if (value == NULL)
+		return NULL;
+	
+	jsonObjectEntry_t* entries = object->value.object.entries;
+	
+	*value = entries[i].value;
+	json_dealloc(entries[i].key);
+	memmove(&entries[i], &entries[i + 1], sizeof(jsonObjectEntry_t) * (object->value.object.size - i - 1));
+	object->value.object.size--;
+	
+	json_container_dirty(object);
+	json_container_entries_dirty(object);
+	
+	return value;
+}
+
+jsonValue_t* json_object_take(jsonValue_t* object, const char* key) {
+	jsonValue_t* value = json_object_take_entry(object, key);
+	if (value == NULL)
+		return NULL;
+	
+	json_container_changed(object);
+	
+	return value;
+}
+
+int json_object_remove(jsonValue_t* object, const char* key) {
+	jsonValue_t* value = json_object_take(object, key);
+	if (value == NULL)
+		return -1;
+	
+	json_free(value);
+	
+	return 0;
+}
@@ -0,0 +1,289 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "json.h"
+#include "alloc.h"
+#include "buffer.h"
+#include "container.h"
+
+extern void json_stringify_r(jsonBuffer_t* buffer, jsonValue_t* value);
+extern void json_write_string(jsonBuffer_t* buffer, const char* source);
+
+/*
+ * Parallel stringify: The document is split into a sequence of segments.
+ * Literal segments are written by the calling thread while planning; they
+ * contain everything outside of large containers. Job segments contain a
+ * range of entries of a large container and are serialized by the workers.
+ * Concatenating all segments yields exactly the output of json_stringify().
+ */
+
+// containers with fewer entries are serialized serially
+#define JSON_PARALLEL_MIN_ENTRIES (1024)
+// ranges per thread and container; more ranges balance uneven entries better
+#define JSON_PARALLEL_RANGES_PER_THREAD (4)
+
+struct jsonParallelSegment {
+	jsonBuffer_t buffer;
+	// NULL for literal segments
+	jsonValue_t* container;
+	size_t from;
+	size_t to;
+};
+
+struct jsonParallelPlan {
+	size_t size;
+	size_t capacity;
+	struct jsonParallelSegment* segments;
+	size_t ranges;
+	bool failed;
+	// next job for the workers
+	size_t next;
+};
+
+static jsonBuffer_t* json_parallel_add(struct jsonParallelPlan* plan, jsonValue_t* container, size_t from, size_t to) {
+	if (plan->size == plan->capacity) {
+		size_t capacity = plan->capacity > 0 ? plan->capacity * 2 : 16;
+		struct jsonParallelSegment* segments = json_realloc(plan->segments, sizeof(struct jsonParallelSegment) * capacity);
+		if (segments == NULL) {
+			plan->failed = true;
+			return NULL;
+		}
+		plan->segments = segments;
+		plan->capacity = capacity;
+	}
+	
+	struct jsonParallelSegment* segment = &plan->segments[plan->size];
+	if (json_buffer_init(&segment->buffer, JSON_BUFFER_INITIAL_CAPACITY) < 0) {
+		plan->failed = true;
+		return NULL;
+	}
+	segment->container = container;
+	segment->from = from;
+	segment->to = to;
+	plan->size++;
+	
+	return &segment->buffer;
+}
+
+// the literal segment that is currently written to
+static jsonBuffer_t* json_parallel_literal(struct jsonParallelPlan* plan) {
+	if (plan->size > 0 && plan->segments[plan->size - 1].container == NULL)
+		return &plan->segments[plan->size - 1].buffer;
+	return json_parallel_add(plan, NULL, 0, 0);
+}
+
+static void json_parallel_put(struct jsonParallelPlan* plan, char c) {
+	jsonBuffer_t* buffer = json_parallel_literal(plan);
+	if (buffer != NULL)
+		json_buffer_put(buffer, c);
+}
+
+static void json_parallel_plan(struct jsonParallelPlan* plan, jsonValue_t* value) {
+	bool isArray = value->type == JSON_ARRAY;
+	size_t length;
+	
+	// scalars, cached containers and unmodified parsed containers are copied into the literal
+	if ((!isArray && value->type != JSON_OBJECT) || json_container_cache(value, &length) != NULL || json_container_source(value, &length) != NULL) {
+		jsonBuffer_t* buffer = json_parallel_literal(plan);
+		if (buffer != NULL)
+			json_stringify_r(buffer, value);
+		return;
+	}
+	
+	size_t size = isArray ? value->value.array.size : value->value.object.size;
+	
+	json_parallel_put(plan, isArray ? '[' : '{');
+	
+	if (size >= JSON_PARALLEL_MIN_ENTRIES) {
+		size_t ranges = plan->ranges;
+		size_t step = (size + ranges - 1) / ranges;
+		for (size_t from = 0; from < size; from += step) {
+			size_t to = from + step < size ? from + step : size;
+			if (from > 0)
+				json_parallel_put(plan, ',');
+			json_parallel_add(plan, value, from, to);
+		}
+	} else {
+		for (size_t i = 0; i < size; i++) {
+			if (i > 0)
+				json_parallel_put(plan, ',');
+			
+			jsonValue_t* entry;
+			if (isArray) {
+				entry = &value->value.array.entries[i];
+			} else {
+				jsonBuffer_t* buffer = json_parallel_literal(plan);
+				if (buffer != NULL) {
+					json_write_string(buffer, value->value.object.entries[i].key);
+					json_buffer_put(buffer, ':');
+				}
+				entry = &value->value.object.entries[i].value;
+			}
+			
+			const char* source = json_container_entry_source(value, i, entry, &length);
+			if (source != NULL) {
+				jsonBuffer_t* buffer = json_parallel_literal(plan);
+				if (buffer != NULL)
+					json_buffer_write(buffer, source, length);
+			} else {
+				json_parallel_plan(plan, entry);
+			}
+		}
+	}
+	
+	json_parallel_put(plan, isArray ? ']' : '}');
+}
+
+static void json_parallel_job(struct jsonParallelSegment* segment) {
+	jsonValue_t* container = segment->container;
+	jsonBuffer_t* buffer = &segment->buffer;
+	
+	for (size_t i = segment->from; i < segment->to; i++) {
+		if (i > segment->from)
+			json_buffer_put(buffer, ',');
+		
+		jsonValue_t* entry;
+		if (container->type == JSON_ARRAY) {
+			entry = &container->value.array.entries[i];
+		} else {
+			json_write_string(buffer, container->value.object.entries[i].key);
+			json_buffer_put(buffer, ':');
+			entry = &container->value.object.entries[i].value;
+		}
+		
+		size_t length;
+		const char* source = json_container_entry_source(container, i, entry, &length);
+		if (source != NULL) {
+			json_buffer_write(buffer, source, length);
+		} else {
+			json_stringify_r(buffer, entry);
+		}
+	}
+}
+
+static void* json_parallel_worker(void* argument) {
+	struct jsonParallelPlan* plan = argument;
+	
+	while (true) {
+		size_t i = __atomic_fetch_add(&plan->next, 1, __ATOMIC_RELAXED);
+		if (i >= plan->size)
+			break;
+		if (plan->segments[i].container != NULL)
+			json_parallel_job(&plan->segments[i]);
+	}
+	
+	return NULL;
+}
+
+static void json_parallel_free(struct jsonParallelPlan* plan) {
+	for (size_t i = 0; i < plan->size; i++) {
+		json_buffer_destroy(&plan->segments[i].buffer);
+	}
+	json_dealloc(plan->segments);
+}
+
+static int json_parallel_run(struct jsonParallelPlan* plan, jsonValue_t* value, int nthreads) {
+	if (nthreads < 1)
+		nthreads = 1;
+	
+	// buffers grow on the workers; an allocator of the calling thread can't be used there
+	if (json_allocator() == &json_allocator_thread)
+		nthreads = 1;
+	
+	*plan = (struct jsonParallelPlan) {
+		.size = 0,
+		.capacity = 0,
+		.segments = NULL,
+		.ranges = nthreads * JSON_PARALLEL_RANGES_PER_THREAD,
+		.failed = false,
+		.next = 0,
+	};
+	
+	json_parallel_plan(plan, value);
+	if (plan->failed) {
+		json_parallel_free(plan);
+		return -1;
+	}
+	
+	size_t jobs = 0;
+	for (size_t i = 0; i < plan->size; i++) {
+		jobs += plan->segments[i].container != NULL;
+	}
+	
+	size_t workers = nthreads - 1;
+	if (workers > jobs)
+		workers = jobs > 0 ? jobs - 1 : 0;
+	
+	pthread_t* threads = NULL;
+	if (workers > 0) {
+		threads = json_alloc(sizeof(pthread_t) * workers);
+		if (threads == NULL)
+			workers = 0;
+	}
+	
+	size_t started;
+	for (started = 0; started < workers; started++) {
+		if (pthread_create(&threads[started], NULL, &json_parallel_worker, plan) != 0)
+			break;
+	}
+	
+	// the calling thread works as well
+	json_parallel_worker(plan);
+	
+	for (size_t i = 0; i < started; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	json_dealloc(threads);
+	
+	for (size_t i = 0; i < plan->size; i++) {
+		if (plan->segments[i].buffer.failed) {
+			json_parallel_free(plan);
+			return -1;
+		}
+	}
+	
+	return 0;
+}
+
+char* json_stringify_parallel(jsonValue_t* value, int nthreads) {
+	struct jsonParallelPlan plan;
+	if (json_parallel_run(&plan, value, nthreads) < 0)
+		return NULL;
+	
+	size_t length = 0;
+	for (size_t i = 0; i < plan.size; i++) {
+		length += plan.segments[i].buffer.length;
+	}
+	
+	char* string = json_alloc(length + 1);
+	if (string != NULL) {
+		size_t offset = 0;
+		for (size_t i = 0; i < plan.size; i++) {
+			memcpy(string + offset, plan.segments[i].buffer.data, plan.segments[i].buffer.length);
+			offset += plan.segments[i].buffer.length;
+		}
+		string[length] = '\0';
+	}
+	
+	json_parallel_free(&plan);
+	
+	return string;
+}
+
+int json_stringify_parallel_to(jsonValue_t* value, int nthreads, jsonWriteFunction_t write, void* context) {
+	struct jsonParallelPlan plan;
+	if (json_parallel_run(&plan, value, nthreads) < 0)
+		return -1;
+	
+	int result = 0;
+	for (size_t i = 0; i < plan.size && result == 0; i++) {
+		if (plan.segments[i].buffer.length > 0)
+			result = write(context, plan.segments[i].buffer.data, plan.segments[i].buffer.length);
+	}
+	
+	json_parallel_free(&plan);
+	
+	return result < 0 ? -1 : 0;
+}
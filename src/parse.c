@@ -4,6 +4,8 @@
 #include <stdio.h>
 
 #include "json.h"
+#include "alloc.h"
+#include "container.h"
 
 extern void json_free_r(jsonValue_t* value);
 
@@ -18,9 +20,9 @@ struct parserToken {
 
 int addToParserToken(struct parserToken* token, char c) {
 	if (token->length % PARSER_TOKEN_CHUNK_SIZE == 0) {
-		char* tmp = realloc(token->token, sizeof(char) * (token->length / PARSER_TOKEN_CHUNK_SIZE + 1) * PARSER_TOKEN_CHUNK_SIZE);
+		char* tmp = json_realloc(token->token, sizeof(char) * (token->length / PARSER_TOKEN_CHUNK_SIZE + 1) * PARSER_TOKEN_CHUNK_SIZE);
 		if (tmp == NULL) {
-			free(token->token);
+			json_dealloc(token->token);
 			token->token = NULL;
 			return -1;
 		}
@@ -34,10 +36,17 @@ int addToParserToken(struct parserToken* token, char c) {
 
 void freeParserToken(struct parserToken* token) {
 	if (token->token != NULL) {
-		free(token->token);
+		json_dealloc(token->token);
 	}
 }
 
+typedef struct {
+	int flags;
+	// copy of the input and the document of all containers if spans are recorded
+	struct jsonSource* source;
+	struct jsonDocument* document;
+} jsonParserContext_t;
+
 typedef struct {
 	bool okay;
 	const char* errorFormat;
@@ -98,12 +107,79 @@ jsonParsedValue_t json_parse_double(jsonParsedValue_t value, struct parserToken
 	return value;
 }
 
-jsonParsedValue_t json_parse_r(const char* string, size_t index, size_t line, size_t length) {
+// the span array grows geometrically while parsing; its capacity is the next power of two of the count
+#define JSON_PARSE_SPANS_MIN (4)
+
+static inline bool json_parse_is_space(char c) {
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+// records the source span of entry i of a container; entries are recorded in order
+static int json_parse_entry_span(jsonParserContext_t* context, jsonValue_t* container, size_t i, size_t start, size_t end) {
+	if (context->source == NULL)
+		return 0;
+	
+	// numbers end at the next structural character
+	while (end > start && json_parse_is_space(context->source->data[end - 1]))
+		end--;
+	
+	struct jsonContainerInfo* info = json_container_info(container);
+	if (info == NULL)
+		return -1;
+	
+	if (i == 0 || (i >= JSON_PARSE_SPANS_MIN && (i & (i - 1)) == 0)) {
+		size_t capacity = i == 0 ? JSON_PARSE_SPANS_MIN : i * 2;
+		jsonSpan_t* spans = json_realloc(info->spans, sizeof(jsonSpan_t) * capacity);
+		if (spans == NULL)
+			return -1;
+		info->spans = spans;
+	}
+	
+	info->spans[i] = (jsonSpan_t) {
+		.offset = start,
+		.length = end - start,
+	};
+	info->spanCount = i + 1;
+	
+	return 0;
+}
+
+static int json_parse_container_span(jsonParserContext_t* context, jsonValue_t* container, size_t start, size_t end) {
+	if (context->source == NULL)
+		return 0;
+	
+	struct jsonContainerInfo* info = json_container_info(container);
+	if (info == NULL)
+		return -1;
+	
+	info->span = (jsonSpan_t) {
+		.offset = start,
+		.length = end - start,
+	};
+	info->source = context->source;
+	__atomic_add_fetch(&context->source->references, 1, __ATOMIC_RELAXED);
+	
+	info->spanGeneration = context->document->generation;
+	json_container_header(container)->document = context->document;
+	__atomic_add_fetch(&context->document->references, 1, __ATOMIC_RELAXED);
+	
+	// the container is complete; give back the unused span capacity (keeping it if that fails)
+	if (info->spanCount > 0) {
+		jsonSpan_t* spans = json_realloc(info->spans, sizeof(jsonSpan_t) * info->spanCount);
+		if (spans != NULL)
+			info->spans = spans;
+	}
+	
+	return 0;
+}
+
+jsonParsedValue_t json_parse_r(jsonParserContext_t* context, const char* string, size_t index, size_t line, size_t length) {
 	jsonParsedValue_t value;
 	value.okay = false;
 	value.line = line;
 	
 	int state = JSON_PARSER_STATE_IDLE;
+	size_t start = index;
 	
 	struct parserToken token = EMPTY_PARSER_TOKEN;
 	
@@ -129,16 +205,32 @@ jsonParsedValue_t json_parse_r(const char* string, size_t index, size_t line, si
 						value.value.type = JSON_STRING;
 						break;
 					case '[':
+						start = index;
 						state = JSON_PARSER_STATE_ARRAY;
 						value.value.type = JSON_ARRAY;
 						value.value.value.array.size = 0;
-						value.value.value.array.entries = NULL;
+						value.value.value.array.entries = json_entries_alloc(0, sizeof(jsonValue_t));
+						if (value.value.value.array.entries == NULL) {
+							value.value.type = JSON_NULL;
+							value.errorFormat = "allocation for array failed";
+							
+							freeParserToken(&token);
+							return value;
+						}
 						break;
 					case '{':
+						start = index;
 						state = JSON_PARSER_STATE_OBJECT;
 						value.value.type = JSON_OBJECT;
 						value.value.value.object.size = 0;
-						value.value.value.object.entries = NULL;
+						value.value.value.object.entries = json_entries_alloc(0, sizeof(jsonObjectEntry_t));
+						if (value.value.value.object.entries == NULL) {
+							value.value.type = JSON_NULL;
+							value.errorFormat = "allocation for object failed";
+							
+							freeParserToken(&token);
+							return value;
+						}
 						break;
 					
 					case '0':
@@ -190,7 +282,7 @@ jsonParsedValue_t json_parse_r(const char* string, size_t index, size_t line, si
 						return value;
 					}
 					value.index = index + 1;
-					value.value.value.string = strdup(token.token);
+					value.value.value.string = json_strdup(token.token);
 					if (value.value.value.string == NULL) {
 						value.errorFormat = "couldn't strdup while parsing string";
 						
@@ -317,6 +409,11 @@ jsonParsedValue_t json_parse_r(const char* string, size_t index, size_t line, si
 			case JSON_PARSER_STATE_ARRAY:
 				{
 					if (c == ']') {
+						if (json_parse_container_span(context, &value.value, start, index + 1) < 0) {
+							json_free_r(&value.value);
+							value.errorFormat = "allocation for array failed";
+							return value;
+						}
 						value.index = index + 1;
 						value.okay = true;
 						return value;	
@@ -345,7 +442,7 @@ jsonParsedValue_t json_parse_r(const char* string, size_t index, size_t line, si
 						return value;
 					}
 					
-					jsonParsedValue_t entry = json_parse_r(string, index, value.line, length);
+					jsonParsedValue_t entry = json_parse_r(context, string, index, value.line, length);
 					
 					if (!entry.okay) {
 						json_free_r(&value.value);
@@ -354,7 +451,7 @@ jsonParsedValue_t json_parse_r(const char* string, size_t index, size_t line, si
 						return entry;
 					}
 					
-					jsonValue_t* entries = realloc(value.value.value.array.entries, sizeof(jsonValue_t) * (value.value.value.array.size + 1));
+					jsonValue_t* entries = json_entries_realloc(value.value.value.array.entries, value.value.value.array.size + 1, sizeof(jsonValue_t));
 					
 					if (entries == NULL) {
 						json_free_r(&value.value);
@@ -369,6 +466,15 @@ jsonParsedValue_t json_parse_r(const char* string, size_t index, size_t line, si
 					
 					value.value.value.array.entries = entries;
 					
+					if (json_parse_entry_span(context, &value.value, value.value.value.array.size - 1, index, entry.index) < 0) {
+						json_free_r(&value.value);
+						
+						value.errorFormat = "allocation for array failed";
+						
+						freeParserToken(&token);
+						return value;
+					}
+					
 					index = entry.index - 1;
 					
 					readyForNext = false;
@@ -377,6 +483,11 @@ jsonParsedValue_t json_parse_r(const char* string, size_t index, size_t line, si
 			case JSON_PARSER_STATE_OBJECT:
 				{
 					if (c == '}') {
+						if (json_parse_container_span(context, &value.value, start, index + 1) < 0) {
+							json_free_r(&value.value);
+							value.errorFormat = "allocation for object failed";
+							return value;
+						}
 						value.index = index + 1;
 						value.okay = true;
 						return value;	
@@ -441,7 +552,7 @@ jsonParsedValue_t json_parse_r(const char* string, size_t index, size_t line, si
 						return value;
 					}
 					
-					jsonParsedValue_t entry = json_parse_r(string, index, value.line, length);
+					jsonParsedValue_t entry = json_parse_r(context, string, index, value.line, length);
 					
 					if (!entry.okay) {
 						json_free_r(&value.value);
@@ -465,7 +576,7 @@ jsonParsedValue_t json_parse_r(const char* string, size_t index, size_t line, si
 						key = entry.value.value.string;
 					} else {
 					
-						jsonObjectEntry_t* entries = realloc(value.value.value.array.entries, sizeof(jsonObjectEntry_t) * (value.value.value.object.size + 1));
+						jsonObjectEntry_t* entries = json_entries_realloc(value.value.value.object.entries, value.value.value.object.size + 1, sizeof(jsonObjectEntry_t));
 						
 						if (entries == NULL) {
 							json_free_r(&value.value);
@@ -483,6 +594,15 @@ jsonParsedValue_t json_parse_r(const char* string, size_t index, size_t line, si
 						
 						key = NULL;
 						
+						if (json_parse_entry_span(context, &value.value, value.value.value.object.size - 1, index, entry.index) < 0) {
+							json_free_r(&value.value);
+							
+							value.errorFormat = "allocation for object failed";
+							
+							freeParserToken(&token);
+							return value;
+						}
+						
 					}
 					
 					index = entry.index - 1;
@@ -514,6 +634,11 @@ jsonParsedValue_t json_parse_r(const char* string, size_t index, size_t line, si
 		return value;
 	}
 	
+	if (state == JSON_PARSER_STATE_ARRAY || state == JSON_PARSER_STATE_OBJECT) {
+		json_free_r(&value.value);
+		json_dealloc(key);
+	}
+	
 	value.index = index - 1;
 	value.errorFormat = "unexpected end of input on line %ld";
 	
@@ -521,10 +646,33 @@ jsonParsedValue_t json_parse_r(const char* string, size_t index, size_t line, si
 	return value;
 }
 
-jsonValue_t* json_parse(const char* string) {
-	size_t length = strlen(string);
-
-	jsonParsedValue_t parsedValue = json_parse_r(string, 0, 1, length);
+jsonValue_t* json_parse_with(const char* string, size_t length, int flags) {
+	jsonParserContext_t context = {
+		.flags = flags,
+		.source = NULL,
+		.document = NULL,
+	};
+	
+	if (flags & JSON_PARSE_SPANS) {
+		context.source = json_alloc(sizeof(struct jsonSource) + length);
+		context.document = json_alloc(sizeof(struct jsonDocument));
+		if (context.source == NULL || context.document == NULL) {
+			json_dealloc(context.source);
+			json_dealloc(context.document);
+			return NULL;
+		}
+		context.source->references = 1;
+		context.source->length = length;
+		memcpy(context.source->data, string, length);
+		context.document->references = 1;
+		context.document->generation = 0;
+	}
+	
+	jsonParsedValue_t parsedValue = json_parse_r(&context, string, 0, 1, length);
+	
+	// the containers hold their own references
+	json_source_release(context.source);
+	json_document_release(context.document);
 	
 	if (!parsedValue.okay) {
 		// TODO put in extern global instead
@@ -536,10 +684,11 @@ jsonValue_t* json_parse(const char* string) {
 	
 	if (length != parsedValue.index) {
 		printf("unexptected character '%c' in line %ld\n", string[parsedValue.index], parsedValue.line);
+		json_free_r(&(parsedValue.value));
 		return NULL;
 	}
 	
-	jsonValue_t* value = malloc(sizeof(jsonValue_t));
+	jsonValue_t* value = json_alloc(sizeof(jsonValue_t));
 	if (value == NULL) {
 		json_free_r(&(parsedValue.value));
 		return NULL;
@@ -547,5 +696,17 @@ jsonValue_t* json_parse(const char* string) {
 	
 	*value = parsedValue.value;
 	
+	// a partly interned document is still complete
+	if (flags & JSON_PARSE_INTERN)
+		json_intern_subtrees(value);
+	
 	return value;
 }
+
+jsonValue_t* json_parse_n(const char* string, size_t length) {
+	return json_parse_with(string, length, 0);
+}
+
+jsonValue_t* json_parse(const char* string) {
+	return json_parse_n(string, strlen(string));
+}
@@ -0,0 +1,628 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "json.h"
+#include "alloc.h"
+#include "buffer.h"
+#include "container.h"
+
+extern void json_free_r(jsonValue_t* value);
+extern uint64_t json_hash_string(const char* string);
+extern bool json_hash_cached(jsonValue_t* value, uint64_t* hash);
+extern int json_array_insert_entry(jsonValue_t* array, size_t index, jsonValue_t* value);
+extern int json_array_remove_entry(jsonValue_t* array, size_t index);
+extern int json_object_set_entry(jsonValue_t* object, const char* key, jsonValue_t* value);
+extern jsonValue_t* json_object_take_entry(jsonValue_t* object, const char* key);
+
+/*
+ * JSON Patch (RFC 6902) and JSON Merge Patch (RFC 7396); paths are JSON
+ * Pointers (RFC 6901).
+ *
+ * Patches are applied to a shared clone of the document (json_share()), so
+ * only the containers on modified paths are copied. The document is
+ * replaced once every operation succeeded; a failing patch leaves it
+ * unchanged.
+ */
+
+// objects with fewer entries are matched by searching instead of a key index
+#define JSON_DIFF_INDEX_ENTRIES (16)
+
+struct jsonPointer {
+	size_t size;
+	char** tokens;
+};
+
+static void json_pointer_free(struct jsonPointer* pointer) {
+	for (size_t i = 0; i < pointer->size; i++) {
+		json_dealloc(pointer->tokens[i]);
+	}
+	json_dealloc(pointer->tokens);
+}
+
+static int json_pointer_parse(const char* string, struct jsonPointer* pointer) {
+	pointer->size = 0;
+	pointer->tokens = NULL;
+	
+	if (string[0] == '\0')
+		return 0;
+	if (string[0] != '/')
+		return -1;
+	
+	size_t tokens = 0;
+	for (const char* c = string; *c != '\0'; c++) {
+		if (*c == '/')
+			tokens++;
+	}
+	
+	pointer->tokens = json_alloc(sizeof(char*) * tokens);
+	if (pointer->tokens == NULL)
+		return -1;
+	
+	while (*string == '/') {
+		string++;
+		size_t length = strcspn(string, "/");
+		
+		char* token = json_alloc(length + 1);
+		if (token == NULL) {
+			json_pointer_free(pointer);
+			return -1;
+		}
+		pointer->tokens[pointer->size++] = token;
+		
+		for (size_t i = 0; i < length; i++) {
+			if (string[i] != '~') {
+				*(token++) = string[i];
+			} else if (i + 1 < length && (string[i + 1] == '0' || string[i + 1] == '1')) {
+				*(token++) = string[++i] == '0' ? '~' : '/';
+			} else {
+				json_pointer_free(pointer);
+				return -1;
+			}
+		}
+		*token = '\0';
+		
+		string += length;
+	}
+	
+	return 0;
+}
+
+// array index of a token; "-" (the end of the array) only if append is set
+static bool json_pointer_index(const char* token, size_t size, bool append, size_t* index) {
+	if (append && strcmp(token, "-") == 0) {
+		*index = size;
+		return true;
+	}
+	
+	if (token[0] < '0' || token[0] > '9' || (token[0] == '0' && token[1] != '\0'))
+		return false;
+	
+	char* end;
+	unsigned long long parsed = strtoull(token, &end, 10);
+	if (*end != '\0' || parsed > size || (parsed == size && !append))
+		return false;
+	
+	*index = parsed;
+	return true;
+}
+
+static jsonValue_t* json_pointer_child(jsonValue_t* value, const char* token) {
+	size_t index;
+	
+	switch(value->type) {
+		case JSON_OBJECT:
+			for (size_t i = 0; i < value->value.object.size; i++) {
+				if (strcmp(value->value.object.entries[i].key, token) == 0)
+					return &value->value.object.entries[i].value;
+			}
+			return NULL;
+		case JSON_ARRAY:
+			if (!json_pointer_index(token, value->value.array.size, false, &index))
+				return NULL;
+			return &value->value.array.entries[index];
+		default:
+			return NULL;
+	}
+}
+
+static jsonValue_t* json_pointer_get(jsonValue_t* value, struct jsonPointer* pointer) {
+	for (size_t i = 0; value != NULL && i < pointer->size; i++) {
+		value = json_pointer_child(value, pointer->tokens[i]);
+	}
+	return value;
+}
+
+// container holding the last token; every container on the way is unshared and marked as dirty
+static jsonValue_t* json_pointer_parent(jsonValue_t* value, struct jsonPointer* pointer) {
+	for (size_t i = 0; value != NULL && i < pointer->size; i++) {
+		if (value->type != JSON_ARRAY && value->type != JSON_OBJECT)
+			return NULL;
+		if (json_container_unshare(value) < 0)
+			return NULL;
+		json_container_dirty(value);
+		
+		if (i + 1 < pointer->size)
+			value = json_pointer_child(value, pointer->tokens[i]);
+	}
+	return value;
+}
+
+// replaces the content of target; takes over value
+static void json_patch_replace_value(jsonValue_t* target, jsonValue_t* value) {
+	json_free_r(target);
+	*target = *value;
+	json_dealloc(value);
+}
+
+// takes over value on success
+static int json_patch_add(jsonValue_t* root, struct jsonPointer* pointer, jsonValue_t* value, bool replace) {
+	if (pointer->size == 0) {
+		json_patch_replace_value(root, value);
+		return 0;
+	}
+	
+	jsonValue_t* parent = json_pointer_parent(root, pointer);
+	if (parent == NULL)
+		return -1;
+	
+	const char* token = pointer->tokens[pointer->size - 1];
+	size_t index;
+	
+	if (parent->type == JSON_OBJECT) {
+		if (replace && json_pointer_child(parent, token) == NULL)
+			return -1;
+		return json_object_set_entry(parent, token, value);
+	}
+	
+	if (!json_pointer_index(token, parent->value.array.size, !replace, &index))
+		return -1;
+	
+	if (!replace)
+		return json_array_insert_entry(parent, index, value);
+	
+	json_patch_replace_value(&parent->value.array.entries[index], value);
+	json_container_entry_dirty(parent, index);
+	json_document_adopt(parent, &parent->value.array.entries[index]);
+	return 0;
+}
+
+static int json_patch_remove(jsonValue_t* root, struct jsonPointer* pointer) {
+	if (pointer->size == 0)
+		return -1;
+	
+	jsonValue_t* parent = json_pointer_parent(root, pointer);
+	if (parent == NULL)
+		return -1;
+	
+	const char* token = pointer->tokens[pointer->size - 1];
+	size_t index;
+	
+	if (parent->type == JSON_OBJECT) {
+		jsonValue_t* value = json_object_take_entry(parent, token);
+		if (value == NULL)
+			return -1;
+		json_free(value);
+		return 0;
+	}
+	
+	if (!json_pointer_index(token, parent->value.array.size, false, &index))
+		return -1;
+	return json_array_remove_entry(parent, index);
+}
+
+static jsonValue_t* json_patch_string(jsonValue_t* operation, const char* key) {
+	jsonValue_t* member = json_pointer_child(operation, key);
+	if (member == NULL || member->type != JSON_STRING)
+		return NULL;
+	return member;
+}
+
+static int json_patch_operation(jsonValue_t* root, jsonValue_t* operation) {
+	if (operation->type != JSON_OBJECT)
+		return -1;
+	
+	jsonValue_t* op = json_patch_string(operation, "op");
+	jsonValue_t* path = json_patch_string(operation, "path");
+	if (op == NULL || path == NULL)
+		return -1;
+	
+	const char* name = op->value.string;
+	bool add = strcmp(name, "add") == 0;
+	bool replace = strcmp(name, "replace") == 0;
+	bool test = strcmp(name, "test") == 0;
+	bool move = strcmp(name, "move") == 0;
+	bool copy = strcmp(name, "copy") == 0;
+	
+	if (!add && !replace && !test && !move && !copy && strcmp(name, "remove") != 0)
+		return -1;
+	
+	struct jsonPointer pointer;
+	if (json_pointer_parse(path->value.string, &pointer) < 0)
+		return -1;
+	
+	int result = -1;
+	jsonValue_t* value = NULL;
+	
+	if (add || replace || test) {
+		jsonValue_t* member = json_pointer_child(operation, "value");
+		if (member == NULL) {
+			// missing value
+		} else if (test) {
+			jsonValue_t* target = json_pointer_get(root, &pointer);
+			result = target != NULL && json_equal(target, member) ? 0 : -1;
+		} else {
+			value = json_share(member);
+		}
+	} else if (move || copy) {
+		jsonValue_t* from = json_patch_string(operation, "from");
+		struct jsonPointer fromPointer;
+		
+		if (from != NULL && json_pointer_parse(from->value.string, &fromPointer) == 0) {
+			jsonValue_t* source = json_pointer_get(root, &fromPointer);
+			size_t fromLength = strlen(from->value.string);
+			
+			if (source == NULL) {
+				// nothing to move or copy
+			} else if (move && strcmp(from->value.string, path->value.string) == 0) {
+				result = 0;
+			} else if (move && strncmp(from->value.string, path->value.string, fromLength) == 0 && path->value.string[fromLength] == '/') {
+				// a value can't be moved into one of its children
+			} else {
+				value = json_share(source);
+				if (value != NULL && move && json_patch_remove(root, &fromPointer) < 0) {
+					json_free(value);
+					value = NULL;
+				}
+			}
+			json_pointer_free(&fromPointer);
+		}
+	} else {
+		result = json_patch_remove(root, &pointer);
+	}
+	
+	if (value != NULL) {
+		result = json_patch_add(root, &pointer, value, replace);
+		if (result < 0)
+			json_free(value);
+	}
+	
+	json_pointer_free(&pointer);
+	
+	return result;
+}
+
+// replaces the document with the patched version
+static int json_patch_commit(jsonValue_t* document, jsonValue_t* patched, int result) {
+	if (result < 0) {
+		json_free(patched);
+		return -1;
+	}
+	
+	json_patch_replace_value(document, patched);
+	return 0;
+}
+
+int json_patch_apply(jsonValue_t* document, jsonValue_t* patch) {
+	// the patch is applied to a share that replaces the document, even for operations on the root
+	if (patch->type != JSON_ARRAY || json_container_readonly(document))
+		return -1;
+	
+	jsonValue_t* patched = json_share(document);
+	if (patched == NULL)
+		return -1;
+	
+	int result = 0;
+	for (size_t i = 0; result == 0 && i < patch->value.array.size; i++) {
+		result = json_patch_operation(patched, &patch->value.array.entries[i]);
+	}
+	
+	return json_patch_commit(document, patched, result);
+}
+
+static int json_merge_patch_r(jsonValue_t* target, jsonValue_t* patch) {
+	if (patch->type != JSON_OBJECT) {
+		jsonValue_t* value = json_share(patch);
+		if (value == NULL)
+			return -1;
+		json_patch_replace_value(target, value);
+		return 0;
+	}
+	
+	if (target->type != JSON_OBJECT) {
+		jsonValue_t* object = json_object(true, 0);
+		if (object == NULL)
+			return -1;
+		json_patch_replace_value(target, object);
+	} else {
+		if (json_container_unshare(target) < 0)
+			return -1;
+		json_container_dirty(target);
+	}
+	
+	for (size_t i = 0; i < patch->value.object.size; i++) {
+		const char* key = patch->value.object.entries[i].key;
+		jsonValue_t* value = &patch->value.object.entries[i].value;
+		
+		if (value->type == JSON_NULL) {
+			json_free(json_object_take_entry(target, key));
+			continue;
+		}
+		
+		size_t j;
+		for (j = 0; j < target->value.object.size && strcmp(target->value.object.entries[j].key, key) != 0; j++);
+		
+		if (j < target->value.object.size) {
+			if (json_merge_patch_r(&target->value.object.entries[j].value, value) < 0)
+				return -1;
+			json_container_entry_dirty(target, j);
+			json_document_adopt(target, &target->value.object.entries[j].value);
+			continue;
+		}
+		
+		// merging into a missing value drops the nulls of the patch
+		jsonValue_t* child = json_null();
+		if (child == NULL)
+			return -1;
+		if (json_merge_patch_r(child, value) < 0 || json_object_set_entry(target, key, child) < 0) {
+			json_free(child);
+			return -1;
+		}
+	}
+	
+	return 0;
+}
+
+int json_merge_patch_apply(jsonValue_t* document, jsonValue_t* patch) {
+	if (json_container_readonly(document))
+		return -1;
+	
+	jsonValue_t* patched = json_share(document);
+	if (patched == NULL)
+		return -1;
+	
+	return json_patch_commit(document, patched, json_merge_patch_r(patched, patch));
+}
+
+/*
+ * Diff
+ */
+
+struct jsonDiff {
+	jsonValue_t* operations;
+	// JSON Pointer of the values that are compared
+	jsonBuffer_t path;
+	bool failed;
+};
+
+static void json_diff_operation(struct jsonDiff* diff, const char* op, jsonValue_t* value) {
+	if (diff->failed)
+		return;
+	
+	json_buffer_put(&diff->path, '\0');
+	if (diff->path.failed) {
+		diff->failed = true;
+		return;
+	}
+	diff->path.length--;
+	
+	jsonValue_t* operation = json_object(true, 0);
+	if (operation != NULL) {
+		jsonValue_t* members[] = {
+			json_string(op),
+			json_string(diff->path.data),
+			value == NULL ? NULL : json_clone(value),
+		};
+		const char* keys[] = { "op", "path", "value" };
+		
+		for (size_t i = 0; i < 3; i++) {
+			if (i == 2 && value == NULL)
+				break;
+			if (operation != NULL && (members[i] == NULL || json_object_set_entry(operation, keys[i], members[i]) < 0)) {
+				json_free(operation);
+				operation = NULL;
+			}
+			if (operation == NULL)
+				json_free(members[i]);
+		}
+	}
+	
+	if (operation == NULL || json_array_insert_entry(diff->operations, diff->operations->value.array.size, operation) < 0) {
+		json_free(operation);
+		diff->failed = true;
+	}
+}
+
+static void json_diff_push_key(struct jsonDiff* diff, const char* key) {
+	json_buffer_put(&diff->path, '/');
+	for (; *key != '\0'; key++) {
+		if (*key == '~')
+			json_buffer_write(&diff->path, "~0", 2);
+		else if (*key == '/')
+			json_buffer_write(&diff->path, "~1", 2);
+		else
+			json_buffer_put(&diff->path, *key);
+	}
+}
+
+static void json_diff_push_index(struct jsonDiff* diff, size_t index) {
+	char token[32];
+	json_buffer_write(&diff->path, token, snprintf(token, sizeof(token), "/%zu", index));
+}
+
+// stored hashes (see json_hash()) rule out differences without looking at the entries
+static bool json_diff_same(jsonValue_t* a, jsonValue_t* b) {
+	uint64_t hashA, hashB;
+	if (json_hash_cached(a, &hashA) && json_hash_cached(b, &hashB) && hashA != hashB)
+		return false;
+	
+	return json_equal(a, b);
+}
+
+// containers are only compared as a whole if both have a stored hash; otherwise their entries are
+static bool json_diff_skip(jsonValue_t* a, jsonValue_t* b) {
+	uint64_t hashA, hashB;
+	return json_hash_cached(a, &hashA) && json_hash_cached(b, &hashB) && hashA == hashB && json_equal(a, b);
+}
+
+static void json_diff_r(struct jsonDiff* diff, jsonValue_t* a, jsonValue_t* b);
+
+static void json_diff_array(struct jsonDiff* diff, jsonValue_t* a, jsonValue_t* b) {
+	jsonValue_t* entriesA = a->value.array.entries;
+	jsonValue_t* entriesB = b->value.array.entries;
+	size_t sizeA = a->value.array.size;
+	size_t sizeB = b->value.array.size;
+	size_t length = diff->path.length;
+	
+	size_t prefix = 0;
+	while (prefix < sizeA && prefix < sizeB && json_diff_same(&entriesA[prefix], &entriesB[prefix]))
+		prefix++;
+	
+	size_t suffix = 0;
+	while (suffix < sizeA - prefix && suffix < sizeB - prefix && json_diff_same(&entriesA[sizeA - suffix - 1], &entriesB[sizeB - suffix - 1]))
+		suffix++;
+	
+	size_t middleA = sizeA - prefix - suffix;
+	size_t middleB = sizeB - prefix - suffix;
+	
+	for (size_t i = 0; i < middleA && i < middleB; i++) {
+		json_diff_push_index(diff, prefix + i);
+		json_diff_r(diff, &entriesA[prefix + i], &entriesB[prefix + i]);
+		diff->path.length = length;
+	}
+	
+	// surplus entries are removed at the same index, missing ones are added in order
+	for (size_t i = middleB; i < middleA; i++) {
+		json_diff_push_index(diff, prefix + middleB);
+		json_diff_operation(diff, "remove", NULL);
+		diff->path.length = length;
+	}
+	for (size_t i = middleA; i < middleB; i++) {
+		json_diff_push_index(diff, prefix + i);
+		json_diff_operation(diff, "add", &entriesB[prefix + i]);
+		diff->path.length = length;
+	}
+}
+
+static void json_diff_object(struct jsonDiff* diff, jsonValue_t* a, jsonValue_t* b) {
+	jsonObjectEntry_t* entriesA = a->value.object.entries;
+	jsonObjectEntry_t* entriesB = b->value.object.entries;
+	size_t sizeA = a->value.object.size;
+	size_t sizeB = b->value.object.size;
+	size_t length = diff->path.length;
+	
+	bool* matched = json_calloc(sizeB > 0 ? sizeB : 1, sizeof(bool));
+	if (matched == NULL) {
+		diff->failed = true;
+		return;
+	}
+	
+	// open addressing over the keys of b; slots hold index + 1
+	size_t slots = 0;
+	size_t* index = NULL;
+	if (sizeB >= JSON_DIFF_INDEX_ENTRIES) {
+		for (slots = 1; slots < sizeB * 2; slots *= 2);
+		index = json_calloc(slots, sizeof(size_t));
+		if (index != NULL) {
+			for (size_t i = 0; i < sizeB; i++) {
+				size_t slot = json_hash_string(entriesB[i].key) & (slots - 1);
+				while (index[slot] != 0)
+					slot = (slot + 1) & (slots - 1);
+				index[slot] = i + 1;
+			}
+		}
+	}
+	
+	for (size_t i = 0; i < sizeA && !diff->failed; i++) {
+		const char* key = entriesA[i].key;
+		size_t j = sizeB;
+		
+		if (i < sizeB && !matched[i] && strcmp(entriesB[i].key, key) == 0) {
+			// same position
+			j = i;
+		} else if (index != NULL) {
+			for (size_t slot = json_hash_string(key) & (slots - 1); index[slot] != 0; slot = (slot + 1) & (slots - 1)) {
+				if (!matched[index[slot] - 1] && strcmp(entriesB[index[slot] - 1].key, key) == 0) {
+					j = index[slot] - 1;
+					break;
+				}
+			}
+		} else {
+			for (j = 0; j < sizeB && (matched[j] || strcmp(entriesB[j].key, key) != 0); j++);
+		}
+		
+		json_diff_push_key(diff, key);
+		if (j == sizeB) {
+			json_diff_operation(diff, "remove", NULL);
+		} else {
+			matched[j] = true;
+			json_diff_r(diff, &entriesA[i].value, &entriesB[j].value);
+		}
+		diff->path.length = length;
+	}
+	
+	for (size_t j = 0; j < sizeB && !diff->failed; j++) {
+		if (matched[j])
+			continue;
+		json_diff_push_key(diff, entriesB[j].key);
+		json_diff_operation(diff, "add", &entriesB[j].value);
+		diff->path.length = length;
+	}
+	
+	json_dealloc(index);
+	json_dealloc(matched);
+}
+
+static void json_diff_r(struct jsonDiff* diff, jsonValue_t* a, jsonValue_t* b) {
+	if (diff->failed)
+		return;
+	
+	if (a->type != b->type) {
+		json_diff_operation(diff, "replace", b);
+		return;
+	}
+	
+	switch(a->type) {
+		case JSON_ARRAY:
+			if (!json_diff_skip(a, b))
+				json_diff_array(diff, a, b);
+			break;
+		case JSON_OBJECT:
+			if (!json_diff_skip(a, b))
+				json_diff_object(diff, a, b);
+			break;
+		default:
+			if (!json_equal(a, b))
+				json_diff_operation(diff, "replace", b);
+			break;
+	}
+}
+
+jsonValue_t* json_diff(jsonValue_t* a, jsonValue_t* b) {
+	struct jsonDiff diff = {
+		.operations = json_array(true, 0),
+		.failed = false,
+	};
+	
+	if (diff.operations == NULL)
+		return NULL;
+	if (json_buffer_init(&diff.path, JSON_BUFFER_INITIAL_CAPACITY) < 0) {
+		json_free(diff.operations);
+		return NULL;
+	}
+	
+	// stores the hashes of large containers, so unchanged subtrees are skipped quickly
+	json_hash(a);
+	json_hash(b);
+	
+	json_diff_r(&diff, a, b);
+	json_buffer_destroy(&diff.path);
+	
+	if (diff.failed) {
+		json_free(diff.operations);
+		return NULL;
+	}
+	
+	return diff.operations;
+}
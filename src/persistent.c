@@ -0,0 +1,1103 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "json.h"
+#include "alloc.h"
+#include "container.h"
+#include "query.h"
+
+/*
+ * Persistent documents are immutable trees; an update copies only the nodes
+ * on the path to the change and shares everything else with the previous
+ * version. Objects are hash array mapped tries (HAMT), arrays are radix
+ * balanced vectors. Both branch 32 ways, so a change costs O(log32 n) new
+ * nodes per level of the document.
+ *
+ * Every node is reference counted (atomically). A version can be read from
+ * any number of threads while other versions are derived from it.
+ */
+
+#define JSON_PERSISTENT_BITS (5)
+#define JSON_PERSISTENT_WIDTH (1 << JSON_PERSISTENT_BITS)
+#define JSON_PERSISTENT_MASK (JSON_PERSISTENT_WIDTH - 1)
+
+typedef enum {
+	JSON_HAMT_ENTRY,
+	JSON_HAMT_BRANCH,
+	// entries with identical hashes; only below the last branch level
+	JSON_HAMT_COLLISION,
+} jsonHamtKind_t;
+
+struct jsonHamt {
+	size_t references;
+	jsonHamtKind_t kind;
+	
+	// entries
+	uint32_t hash;
+	// insertion order of the key; objects are converted back in this order
+	size_t order;
+	char* key;
+	jsonPersistent_t* value;
+	
+	// branches: bit i is set if there is a child for the hash bits i (ordered by i)
+	uint32_t bitmap;
+	size_t count;
+	struct jsonHamt* children[];
+};
+
+struct jsonVector {
+	size_t references;
+	size_t count;
+	// values on the lowest level, vector nodes otherwise
+	union {
+		jsonPersistent_t* values[JSON_PERSISTENT_WIDTH];
+		struct jsonVector* nodes[JSON_PERSISTENT_WIDTH];
+	} children;
+};
+
+struct jsonPersistent {
+	size_t references;
+	jsonValueType_t type;
+	// entries of arrays and objects
+	size_t size;
+	union {
+		bool boolean;
+		double real;
+		long long integer;
+		char* string;
+		struct {
+			struct jsonHamt* root;
+			size_t nextOrder;
+		} object;
+		struct {
+			struct jsonVector* root;
+			// bit offset of the index on the root level
+			unsigned shift;
+		} array;
+	} value;
+};
+
+static uint32_t json_persistent_hash(const char* key) {
+	uint32_t hash = 2166136261u;
+	for (; *key != '\0'; key++) {
+		hash ^= (unsigned char) *key;
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+jsonPersistent_t* json_persistent_retain(jsonPersistent_t* persistent) {
+	if (persistent != NULL)
+		__atomic_add_fetch(&persistent->references, 1, __ATOMIC_RELAXED);
+	return persistent;
+}
+
+static struct jsonHamt* json_hamt_retain(struct jsonHamt* node) {
+	if (node != NULL)
+		__atomic_add_fetch(&node->references, 1, __ATOMIC_RELAXED);
+	return node;
+}
+
+static struct jsonVector* json_vector_retain(struct jsonVector* node) {
+	if (node != NULL)
+		__atomic_add_fetch(&node->references, 1, __ATOMIC_RELAXED);
+	return node;
+}
+
+static void json_hamt_release(struct jsonHamt* node) {
+	if (node == NULL || __atomic_sub_fetch(&node->references, 1, __ATOMIC_ACQ_REL) > 0)
+		return;
+	
+	if (node->kind == JSON_HAMT_ENTRY) {
+		json_dealloc(node->key);
+		json_persistent_release(node->value);
+	} else {
+		for (size_t i = 0; i < node->count; i++) {
+			json_hamt_release(node->children[i]);
+		}
+	}
+	json_dealloc(node);
+}
+
+static void json_vector_release(struct jsonVector* node, unsigned shift) {
+	if (node == NULL || __atomic_sub_fetch(&node->references, 1, __ATOMIC_ACQ_REL) > 0)
+		return;
+	
+	for (size_t i = 0; i < node->count; i++) {
+		if (shift == 0)
+			json_persistent_release(node->children.values[i]);
+		else
+			json_vector_release(node->children.nodes[i], shift - JSON_PERSISTENT_BITS);
+	}
+	json_dealloc(node);
+}
+
+void json_persistent_release(jsonPersistent_t* persistent) {
+	if (persistent == NULL || __atomic_sub_fetch(&persistent->references, 1, __ATOMIC_ACQ_REL) > 0)
+		return;
+	
+	switch(persistent->type) {
+		case JSON_STRING:
+			json_dealloc(persistent->value.string);
+			break;
+		case JSON_ARRAY:
+			json_vector_release(persistent->value.array.root, persistent->value.array.shift);
+			break;
+		case JSON_OBJECT:
+			json_hamt_release(persistent->value.object.root);
+			break;
+		default:
+			break;
+	}
+	json_dealloc(persistent);
+}
+
+static jsonPersistent_t* json_persistent_alloc(jsonValueType_t type) {
+	jsonPersistent_t* persistent = json_alloc(sizeof(jsonPersistent_t));
+	if (persistent == NULL)
+		return NULL;
+	
+	persistent->references = 1;
+	persistent->type = type;
+	persistent->size = 0;
+	
+	return persistent;
+}
+
+/*
+ * HAMT
+ */
+
+static struct jsonHamt* json_hamt_alloc(jsonHamtKind_t kind, size_t count) {
+	struct jsonHamt* node = json_alloc(sizeof(struct jsonHamt) + sizeof(struct jsonHamt*) * count);
+	if (node == NULL)
+		return NULL;
+	
+	node->references = 1;
+	node->kind = kind;
+	node->key = NULL;
+	node->value = NULL;
+	node->bitmap = 0;
+	node->count = count;
+	
+	return node;
+}
+
+// takes the reference of value
+static struct jsonHamt* json_hamt_entry(const char* key, uint32_t hash, size_t order, jsonPersistent_t* value) {
+	struct jsonHamt* entry = json_hamt_alloc(JSON_HAMT_ENTRY, 0);
+	if (entry == NULL) {
+		json_persistent_release(value);
+		return NULL;
+	}
+	
+	entry->key = json_strdup(key);
+	if (entry->key == NULL) {
+		entry->value = value;
+		json_hamt_release(entry);
+		return NULL;
+	}
+	
+	entry->hash = hash;
+	entry->order = order;
+	entry->value = value;
+	
+	return entry;
+}
+
+static inline size_t json_hamt_position(uint32_t bitmap, uint32_t bit) {
+	return __builtin_popcount(bitmap & (bit - 1));
+}
+
+static struct jsonHamt* json_hamt_find(struct jsonHamt* node, uint32_t hash, const char* key) {
+	unsigned shift = 0;
+	
+	while (node != NULL) {
+		switch(node->kind) {
+			case JSON_HAMT_ENTRY:
+				return node->hash == hash && strcmp(node->key, key) == 0 ? node : NULL;
+			case JSON_HAMT_BRANCH: {
+				uint32_t bit = 1u << ((hash >> shift) & JSON_PERSISTENT_MASK);
+				if ((node->bitmap & bit) == 0)
+					return NULL;
+				node = node->children[json_hamt_position(node->bitmap, bit)];
+				shift += JSON_PERSISTENT_BITS;
+				break;
+			}
+			case JSON_HAMT_COLLISION:
+				for (size_t i = 0; i < node->count; i++) {
+					if (strcmp(node->children[i]->key, key) == 0)
+						return node->children[i];
+				}
+				return NULL;
+		}
+	}
+	
+	return NULL;
+}
+
+// copy of a branch or collision node with room for count children; the first n children are shared
+static struct jsonHamt* json_hamt_copy(struct jsonHamt* node, size_t count, size_t n) {
+	struct jsonHamt* copy = json_hamt_alloc(node->kind, count);
+	if (copy == NULL)
+		return NULL;
+	
+	copy->bitmap = node->bitmap;
+	for (size_t i = 0; i < n; i++) {
+		copy->children[i] = json_hamt_retain(node->children[i]);
+	}
+	
+	return copy;
+}
+
+// node holding two entries with different keys; takes both references
+static struct jsonHamt* json_hamt_merge(struct jsonHamt* a, struct jsonHamt* b, unsigned shift) {
+	struct jsonHamt* node;
+	
+	if (shift >= 32) {
+		node = json_hamt_alloc(JSON_HAMT_COLLISION, 2);
+		if (node != NULL) {
+			node->children[0] = a;
+			node->children[1] = b;
+			return node;
+		}
+	} else {
+		uint32_t indexA = (a->hash >> shift) & JSON_PERSISTENT_MASK;
+		uint32_t indexB = (b->hash >> shift) & JSON_PERSISTENT_MASK;
+		
+		if (indexA == indexB) {
+			struct jsonHamt* child = json_hamt_merge(a, b, shift + JSON_PERSISTENT_BITS);
+			if (child == NULL)
+				return NULL;
+			
+			node = json_hamt_alloc(JSON_HAMT_BRANCH, 1);
+			if (node == NULL) {
+				json_hamt_release(child);
+				return NULL;
+			}
+			node->bitmap = 1u << indexA;
+			node->children[0] = child;
+			return node;
+		}
+		
+		node = json_hamt_alloc(JSON_HAMT_BRANCH, 2);
+		if (node != NULL) {
+			node->bitmap = (1u << indexA) | (1u << indexB);
+			node->children[indexA < indexB ? 0 : 1] = a;
+			node->children[indexA < indexB ? 1 : 0] = b;
+			return node;
+		}
+	}
+	
+	json_hamt_release(a);
+	json_hamt_release(b);
+	return NULL;
+}
+
+// returns the new version of node with entry added or replaced; takes the reference of entry
+static struct jsonHamt* json_hamt_insert(struct jsonHamt* node, struct jsonHamt* entry, unsigned shift) {
+	if (node == NULL)
+		return entry;
+	
+	struct jsonHamt* copy;
+	
+	switch(node->kind) {
+		case JSON_HAMT_ENTRY:
+			if (node->hash == entry->hash && strcmp(node->key, entry->key) == 0)
+				return entry;
+			return json_hamt_merge(json_hamt_retain(node), entry, shift);
+		
+		case JSON_HAMT_BRANCH: {
+			uint32_t bit = 1u << ((entry->hash >> shift) & JSON_PERSISTENT_MASK);
+			size_t position = json_hamt_position(node->bitmap, bit);
+			
+			if (node->bitmap & bit) {
+				struct jsonHamt* child = json_hamt_insert(node->children[position], entry, shift + JSON_PERSISTENT_BITS);
+				if (child == NULL)
+					return NULL;
+				
+				copy = json_hamt_copy(node, node->count, 0);
+				if (copy == NULL) {
+					json_hamt_release(child);
+					return NULL;
+				}
+				for (size_t i = 0; i < node->count; i++) {
+					copy->children[i] = i == position ? child : json_hamt_retain(node->children[i]);
+				}
+				return copy;
+			}
+			
+			copy = json_hamt_copy(node, node->count + 1, 0);
+			if (copy == NULL) {
+				json_hamt_release(entry);
+				return NULL;
+			}
+			copy->bitmap |= bit;
+			for (size_t i = 0; i < node->count; i++) {
+				copy->children[i < position ? i : i + 1] = json_hamt_retain(node->children[i]);
+			}
+			copy->children[position] = entry;
+			return copy;
+		}
+		
+		case JSON_HAMT_COLLISION:
+			for (size_t i = 0; i < node->count; i++) {
+				if (strcmp(node->children[i]->key, entry->key) == 0) {
+					copy = json_hamt_copy(node, node->count, 0);
+					if (copy == NULL) {
+						json_hamt_release(entry);
+						return NULL;
+					}
+					for (size_t j = 0; j < node->count; j++) {
+						copy->children[j] = j == i ? entry : json_hamt_retain(node->children[j]);
+					}
+					return copy;
+				}
+			}
+			
+			copy = json_hamt_copy(node, node->count + 1, node->count);
+			if (copy == NULL) {
+				json_hamt_release(entry);
+				return NULL;
+			}
+			copy->children[node->count] = entry;
+			return copy;
+	}
+	
+	return NULL;
+}
+
+// new version of node without the key (which has to exist); NULL if nothing is left
+static int json_hamt_remove(struct jsonHamt* node, uint32_t hash, const char* key, unsigned shift, struct jsonHamt** result) {
+	struct jsonHamt* copy;
+	size_t position;
+	
+	switch(node->kind) {
+		case JSON_HAMT_ENTRY:
+			*result = NULL;
+			return 0;
+		
+		case JSON_HAMT_BRANCH: {
+			uint32_t bit = 1u << ((hash >> shift) & JSON_PERSISTENT_MASK);
+			position = json_hamt_position(node->bitmap, bit);
+			
+			struct jsonHamt* child;
+			if (json_hamt_remove(node->children[position], hash, key, shift + JSON_PERSISTENT_BITS, &child) < 0)
+				return -1;
+			
+			if (child == NULL) {
+				if (node->count == 1) {
+					*result = NULL;
+					return 0;
+				}
+				// a single entry moves up, it is found by its full hash on any level
+				if (node->count == 2 && node->children[1 - position]->kind == JSON_HAMT_ENTRY) {
+					*result = json_hamt_retain(node->children[1 - position]);
+					return 0;
+				}
+				
+				copy = json_hamt_copy(node, node->count - 1, 0);
+				if (copy == NULL)
+					return -1;
+				copy->bitmap &= ~bit;
+				for (size_t i = 0; i < node->count; i++) {
+					if (i != position)
+						copy->children[i < position ? i : i - 1] = json_hamt_retain(node->children[i]);
+				}
+				*result = copy;
+				return 0;
+			}
+			
+			if (node->count == 1 && child->kind == JSON_HAMT_ENTRY) {
+				*result = child;
+				return 0;
+			}
+			
+			copy = json_hamt_copy(node, node->count, 0);
+			if (copy == NULL) {
+				json_hamt_release(child);
+				return -1;
+			}
+			for (size_t i = 0; i < node->count; i++) {
+				copy->children[i] = i == position ? child : json_hamt_retain(node->children[i]);
+			}
+			*result = copy;
+			return 0;
+		}
+		
+		case JSON_HAMT_COLLISION:
+			for (position = 0; strcmp(node->children[position]->key, key) != 0; position++);
+			
+			if (node->count == 2) {
+				*result = json_hamt_retain(node->children[1 - position]);
+				return 0;
+			}
+			
+			copy = json_hamt_copy(node, node->count - 1, 0);
+			if (copy == NULL)
+				return -1;
+			for (size_t i = 0; i < node->count; i++) {
+				if (i != position)
+					copy->children[i < position ? i : i - 1] = json_hamt_retain(node->children[i]);
+			}
+			*result = copy;
+			return 0;
+	}
+	
+	return -1;
+}
+
+static void json_hamt_collect(struct jsonHamt* node, struct jsonHamt** entries, size_t* n) {
+	if (node == NULL)
+		return;
+	
+	if (node->kind == JSON_HAMT_ENTRY) {
+		entries[(*n)++] = node;
+		return;
+	}
+	
+	for (size_t i = 0; i < node->count; i++) {
+		json_hamt_collect(node->children[i], entries, n);
+	}
+}
+
+static int json_hamt_compare_order(const void* a, const void* b) {
+	size_t orderA = (*(struct jsonHamt**) a)->order;
+	size_t orderB = (*(struct jsonHamt**) b)->order;
+	return (orderA > orderB) - (orderA < orderB);
+}
+
+// new object with key set to value; takes the reference of value
+static jsonPersistent_t* json_persistent_object_set(jsonPersistent_t* object, const char* key, jsonPersistent_t* value) {
+	uint32_t hash = json_persistent_hash(key);
+	struct jsonHamt* existing = json_hamt_find(object->value.object.root, hash, key);
+	size_t order = existing != NULL ? existing->order : object->value.object.nextOrder;
+	
+	struct jsonHamt* entry = json_hamt_entry(key, hash, order, value);
+	if (entry == NULL)
+		return NULL;
+	
+	jsonPersistent_t* result = json_persistent_alloc(JSON_OBJECT);
+	if (result == NULL) {
+		json_hamt_release(entry);
+		return NULL;
+	}
+	
+	result->value.object.root = json_hamt_insert(object->value.object.root, entry, 0);
+	if (result->value.object.root == NULL) {
+		json_dealloc(result);
+		return NULL;
+	}
+	result->size = object->size + (existing == NULL ? 1 : 0);
+	result->value.object.nextOrder = object->value.object.nextOrder + (existing == NULL ? 1 : 0);
+	
+	return result;
+}
+
+static jsonPersistent_t* json_persistent_object_remove(jsonPersistent_t* object, const char* key) {
+	uint32_t hash = json_persistent_hash(key);
+	if (json_hamt_find(object->value.object.root, hash, key) == NULL)
+		return NULL;
+	
+	jsonPersistent_t* result = json_persistent_alloc(JSON_OBJECT);
+	if (result == NULL)
+		return NULL;
+	
+	if (json_hamt_remove(object->value.object.root, hash, key, 0, &result->value.object.root) < 0) {
+		json_dealloc(result);
+		return NULL;
+	}
+	result->size = object->size - 1;
+	result->value.object.nextOrder = object->value.object.nextOrder;
+	
+	return result;
+}
+
+/*
+ * Vectors
+ */
+
+static struct jsonVector* json_vector_alloc() {
+	struct jsonVector* node = json_alloc(sizeof(struct jsonVector));
+	if (node == NULL)
+		return NULL;
+	
+	node->references = 1;
+	node->count = 0;
+	
+	return node;
+}
+
+// copy sharing the first n children
+static struct jsonVector* json_vector_copy(struct jsonVector* node, unsigned shift, size_t n) {
+	struct jsonVector* copy = json_vector_alloc();
+	if (copy == NULL)
+		return NULL;
+	
+	for (size_t i = 0; i < n; i++) {
+		if (shift == 0)
+			copy->children.values[i] = json_persistent_retain(node->children.values[i]);
+		else
+			copy->children.nodes[i] = json_vector_retain(node->children.nodes[i]);
+	}
+	copy->count = n;
+	
+	return copy;
+}
+
+static jsonPersistent_t* json_vector_get(jsonPersistent_t* array, size_t index) {
+	struct jsonVector* node = array->value.array.root;
+	for (unsigned shift = array->value.array.shift; shift > 0; shift -= JSON_PERSISTENT_BITS) {
+		node = node->children.nodes[(index >> shift) & JSON_PERSISTENT_MASK];
+	}
+	return node->children.values[index & JSON_PERSISTENT_MASK];
+}
+
+/*
+ * New version of node with value at index. The index may be one past the
+ * last entry to append; node is NULL if that needs a new path. Takes the
+ * reference of value.
+ */
+static struct jsonVector* json_vector_set(struct jsonVector* node, unsigned shift, size_t index, jsonPersistent_t* value) {
+	size_t slot = (index >> shift) & JSON_PERSISTENT_MASK;
+	size_t count = node == NULL ? 0 : node->count;
+	
+	struct jsonVector* copy = node == NULL ? json_vector_alloc() : json_vector_copy(node, shift, count);
+	if (copy == NULL) {
+		json_persistent_release(value);
+		return NULL;
+	}
+	
+	if (shift == 0) {
+		if (slot < count)
+			json_persistent_release(copy->children.values[slot]);
+		copy->children.values[slot] = value;
+	} else {
+		struct jsonVector* child = json_vector_set(slot < count ? node->children.nodes[slot] : NULL, shift - JSON_PERSISTENT_BITS, index, value);
+		if (child == NULL) {
+			json_vector_release(copy, shift);
+			return NULL;
+		}
+		if (slot < count)
+			json_vector_release(copy->children.nodes[slot], shift - JSON_PERSISTENT_BITS);
+		copy->children.nodes[slot] = child;
+	}
+	
+	if (slot >= count)
+		copy->count = slot + 1;
+	
+	return copy;
+}
+
+// new version of node without the entry at index, which has to be the last one; NULL if nothing is left
+static int json_vector_pop(struct jsonVector* node, unsigned shift, size_t index, struct jsonVector** result) {
+	size_t slot = (index >> shift) & JSON_PERSISTENT_MASK;
+	
+	if (shift == 0) {
+		if (slot == 0) {
+			*result = NULL;
+			return 0;
+		}
+		*result = json_vector_copy(node, shift, slot);
+		return *result == NULL ? -1 : 0;
+	}
+	
+	struct jsonVector* child;
+	if (json_vector_pop(node->children.nodes[slot], shift - JSON_PERSISTENT_BITS, index, &child) < 0)
+		return -1;
+	
+	if (child == NULL && slot == 0) {
+		*result = NULL;
+		return 0;
+	}
+	
+	struct jsonVector* copy = json_vector_copy(node, shift, slot);
+	if (copy == NULL) {
+		json_vector_release(child, shift - JSON_PERSISTENT_BITS);
+		return -1;
+	}
+	if (child != NULL)
+		copy->children.nodes[copy->count++] = child;
+	
+	*result = copy;
+	return 0;
+}
+
+static void json_vector_release_level(void** level, size_t from, size_t count, unsigned shift) {
+	for (size_t i = from; i < count; i++) {
+		if (shift == 0)
+			json_persistent_release(level[i]);
+		else
+			json_vector_release(level[i], shift - JSON_PERSISTENT_BITS);
+	}
+}
+
+// builds a vector bottom up; takes the references of the values
+static int json_vector_build(jsonPersistent_t* array, jsonPersistent_t** values, size_t size) {
+	array->size = size;
+	array->value.array.root = NULL;
+	array->value.array.shift = 0;
+	
+	if (size == 0)
+		return 0;
+	
+	void** level = (void**) values;
+	size_t count = size;
+	unsigned shift = 0;
+	
+	while (true) {
+		size_t nodes = (count + JSON_PERSISTENT_MASK) / JSON_PERSISTENT_WIDTH;
+		void** parents = json_alloc(sizeof(void*) * nodes);
+		size_t built = 0;
+		
+		for (; parents != NULL && built < nodes; built++) {
+			struct jsonVector* node = json_vector_alloc();
+			if (node == NULL)
+				break;
+			
+			for (size_t i = built * JSON_PERSISTENT_WIDTH; i < count && node->count < JSON_PERSISTENT_WIDTH; i++) {
+				node->children.nodes[node->count++] = level[i];
+			}
+			parents[built] = node;
+		}
+		
+		if (built < nodes) {
+			// children of the missing nodes are still owned by the level
+			json_vector_release_level(level, built * JSON_PERSISTENT_WIDTH, count, shift);
+			if (parents != NULL)
+				json_vector_release_level(parents, 0, built, shift + JSON_PERSISTENT_BITS);
+		}
+		
+		if (level != (void**) values)
+			json_dealloc(level);
+		
+		if (built < nodes) {
+			json_dealloc(parents);
+			return -1;
+		}
+		
+		if (nodes == 1) {
+			array->value.array.root = parents[0];
+			array->value.array.shift = shift;
+			json_dealloc(parents);
+			return 0;
+		}
+		
+		level = parents;
+		count = nodes;
+		shift += JSON_PERSISTENT_BITS;
+	}
+}
+
+// new array with value at index (or appended if index is the size); takes the reference of value
+static jsonPersistent_t* json_persistent_array_set(jsonPersistent_t* array, size_t index, jsonPersistent_t* value) {
+	jsonPersistent_t* result = json_persistent_alloc(JSON_ARRAY);
+	if (result == NULL) {
+		json_persistent_release(value);
+		return NULL;
+	}
+	
+	struct jsonVector* root = array->value.array.root;
+	unsigned shift = array->value.array.shift;
+	
+	if (root != NULL && index == ((size_t) JSON_PERSISTENT_WIDTH << shift)) {
+		// the root is full; it becomes the first child of a new root
+		struct jsonVector* grown = json_vector_alloc();
+		if (grown == NULL) {
+			json_persistent_release(value);
+			json_dealloc(result);
+			return NULL;
+		}
+		grown->children.nodes[0] = json_vector_retain(root);
+		grown->count = 1;
+		shift += JSON_PERSISTENT_BITS;
+		
+		result->value.array.root = json_vector_set(grown, shift, index, value);
+		json_vector_release(grown, shift);
+	} else {
+		result->value.array.root = json_vector_set(root, shift, index, value);
+	}
+	
+	if (result->value.array.root == NULL) {
+		json_dealloc(result);
+		return NULL;
+	}
+	
+	result->value.array.shift = shift;
+	result->size = index < array->size ? array->size : array->size + 1;
+	
+	return result;
+}
+
+static jsonPersistent_t* json_persistent_array_remove(jsonPersistent_t* array, size_t index) {
+	if (index >= array->size)
+		return NULL;
+	
+	jsonPersistent_t* result = json_persistent_alloc(JSON_ARRAY);
+	if (result == NULL)
+		return NULL;
+	
+	if (index + 1 == array->size) {
+		unsigned shift = array->value.array.shift;
+		struct jsonVector* root;
+		if (json_vector_pop(array->value.array.root, shift, index, &root) < 0) {
+			json_dealloc(result);
+			return NULL;
+		}
+		
+		// drop levels that only have a single child
+		while (root != NULL && shift > 0 && root->count == 1) {
+			struct jsonVector* child = json_vector_retain(root->children.nodes[0]);
+			json_vector_release(root, shift);
+			root = child;
+			shift -= JSON_PERSISTENT_BITS;
+		}
+		
+		result->size = index;
+		result->value.array.root = root;
+		result->value.array.shift = root == NULL ? 0 : shift;
+		return result;
+	}
+	
+	// removing from the middle shifts every following index, so the vector is rebuilt (sharing all values)
+	jsonPersistent_t** values = json_alloc(sizeof(jsonPersistent_t*) * array->size);
+	if (values == NULL) {
+		json_dealloc(result);
+		return NULL;
+	}
+	
+	size_t n = 0;
+	for (size_t i = 0; i < array->size; i++) {
+		if (i != index)
+			values[n++] = json_persistent_retain(json_vector_get(array, i));
+	}
+	
+	int status = json_vector_build(result, values, n);
+	json_dealloc(values);
+	
+	if (status < 0) {
+		json_dealloc(result);
+		return NULL;
+	}
+	
+	return result;
+}
+
+/*
+ * Conversion
+ */
+
+jsonPersistent_t* json_persistent_new(jsonValue_t* value) {
+	jsonPersistent_t* persistent = json_persistent_alloc(value->type);
+	if (persistent == NULL)
+		return NULL;
+	
+	switch(value->type) {
+		case JSON_STRING:
+			persistent->value.string = json_strdup(value->value.string);
+			if (persistent->value.string == NULL) {
+				json_dealloc(persistent);
+				return NULL;
+			}
+			break;
+		
+		case JSON_ARRAY: {
+			size_t size = value->value.array.size;
+			jsonPersistent_t** values = json_alloc(sizeof(jsonPersistent_t*) * (size > 0 ? size : 1));
+			if (values == NULL) {
+				json_dealloc(persistent);
+				return NULL;
+			}
+			
+			for (size_t i = 0; i < size; i++) {
+				values[i] = json_persistent_new(&value->value.array.entries[i]);
+				if (values[i] == NULL) {
+					for (size_t j = 0; j < i; j++) {
+						json_persistent_release(values[j]);
+					}
+					json_dealloc(values);
+					json_dealloc(persistent);
+					return NULL;
+				}
+			}
+			
+			int status = json_vector_build(persistent, values, size);
+			json_dealloc(values);
+			if (status < 0) {
+				json_dealloc(persistent);
+				return NULL;
+			}
+			break;
+		}
+		
+		case JSON_OBJECT: {
+			struct jsonHamt* root = NULL;
+			size_t order = 0;
+			
+			for (size_t i = 0; i < value->value.object.size; i++) {
+				const char* key = value->value.object.entries[i].key;
+				uint32_t hash = json_persistent_hash(key);
+				struct jsonHamt* existing = json_hamt_find(root, hash, key);
+				
+				jsonPersistent_t* entryValue = json_persistent_new(&value->value.object.entries[i].value);
+				struct jsonHamt* entry = entryValue == NULL ? NULL : json_hamt_entry(key, hash, existing != NULL ? existing->order : order, entryValue);
+				struct jsonHamt* next = entry == NULL ? NULL : json_hamt_insert(root, entry, 0);
+				json_hamt_release(root);
+				if (next == NULL) {
+					json_dealloc(persistent);
+					return NULL;
+				}
+				root = next;
+				
+				if (existing == NULL) {
+					persistent->size++;
+					order++;
+				}
+			}
+			
+			persistent->value.object.root = root;
+			persistent->value.object.nextOrder = order;
+			break;
+		}
+		
+		case JSON_BOOL:
+			persistent->value.boolean = value->value.boolean;
+			break;
+		case JSON_LONG:
+			persistent->value.integer = value->value.integer;
+			break;
+		case JSON_DOUBLE:
+			persistent->value.real = value->value.real;
+			break;
+		default:
+			break;
+	}
+	
+	return persistent;
+}
+
+static void json_vector_collect(struct jsonVector* node, unsigned shift, jsonValue_t* entries, size_t* n, bool* okay);
+
+static int json_persistent_value_r(jsonPersistent_t* persistent, jsonValue_t* value) {
+	value->type = persistent->type;
+	
+	switch(persistent->type) {
+		case JSON_STRING:
+			value->value.string = json_strdup(persistent->value.string);
+			if (value->value.string == NULL) {
+				value->type = JSON_NULL;
+				return -1;
+			}
+			return 0;
+		
+		case JSON_ARRAY: {
+			value->value.array.size = 0;
+			value->value.array.entries = json_entries_alloc(persistent->size, sizeof(jsonValue_t));
+			if (value->value.array.entries == NULL) {
+				value->type = JSON_NULL;
+				return -1;
+			}
+			
+			bool okay = true;
+			json_vector_collect(persistent->value.array.root, persistent->value.array.shift, value->value.array.entries, &value->value.array.size, &okay);
+			return okay ? 0 : -1;
+		}
+		
+		case JSON_OBJECT: {
+			value->value.object.size = 0;
+			value->value.object.entries = json_entries_alloc(persistent->size, sizeof(jsonObjectEntry_t));
+			struct jsonHamt** entries = json_alloc(sizeof(struct jsonHamt*) * (persistent->size > 0 ? persistent->size : 1));
+			if (value->value.object.entries == NULL || entries == NULL) {
+				json_entries_free(value->value.object.entries);
+				json_dealloc(entries);
+				value->type = JSON_NULL;
+				return -1;
+			}
+			
+			size_t n = 0;
+			json_hamt_collect(persistent->value.object.root, entries, &n);
+			qsort(entries, n, sizeof(struct jsonHamt*), &json_hamt_compare_order);
+			
+			int result = 0;
+			for (size_t i = 0; i < n; i++) {
+				jsonObjectEntry_t* entry = &value->value.object.entries[i];
+				entry->key = json_strdup(entries[i]->key);
+				if (entry->key == NULL) {
+					result = -1;
+					break;
+				}
+				value->value.object.size++;
+				if (json_persistent_value_r(entries[i]->value, &entry->value) < 0) {
+					result = -1;
+					break;
+				}
+			}
+			
+			json_dealloc(entries);
+			return result;
+		}
+		
+		case JSON_BOOL:
+			value->value.boolean = persistent->value.boolean;
+			return 0;
+		case JSON_LONG:
+			value->value.integer = persistent->value.integer;
+			return 0;
+		case JSON_DOUBLE:
+			value->value.real = persistent->value.real;
+			return 0;
+		default:
+			return 0;
+	}
+}
+
+// entries that could not be converted are counted as null, so the array can always be freed
+static void json_vector_collect(struct jsonVector* node, unsigned shift, jsonValue_t* entries, size_t* n, bool* okay) {
+	if (node == NULL)
+		return;
+	
+	for (size_t i = 0; *okay && i < node->count; i++) {
+		if (shift > 0) {
+			json_vector_collect(node->children.nodes[i], shift - JSON_PERSISTENT_BITS, entries, n, okay);
+		} else {
+			*okay = json_persistent_value_r(node->children.values[i], &entries[*n]) == 0;
+			(*n)++;
+		}
+	}
+}
+
+extern void json_free_r(jsonValue_t* value);
+
+jsonValue_t* json_persistent_value(jsonPersistent_t* persistent) {
+	jsonValue_t* value = json_alloc(sizeof(jsonValue_t));
+	if (value == NULL)
+		return NULL;
+	
+	if (json_persistent_value_r(persistent, value) < 0) {
+		json_free_r(value);
+		json_dealloc(value);
+		return NULL;
+	}
+	
+	return value;
+}
+
+jsonValueType_t json_persistent_type(jsonPersistent_t* persistent) {
+	return persistent->type;
+}
+
+size_t json_persistent_size(jsonPersistent_t* persistent) {
+	return persistent->size;
+}
+
+/*
+ * Access by path; only plain keys and indices are supported.
+ */
+
+static jsonPersistent_t* json_persistent_select(jsonPersistent_t* persistent, struct jsonQuerySegment* segment) {
+	if (segment->type != JSON_QUERY_SELECT)
+		return NULL;
+	
+	if (persistent->type == JSON_OBJECT) {
+		struct jsonHamt* entry = json_hamt_find(persistent->value.object.root, json_persistent_hash(segment->key), segment->key);
+		return entry == NULL ? NULL : entry->value;
+	}
+	
+	if (persistent->type == JSON_ARRAY && segment->isIndex && segment->index < persistent->size)
+		return json_vector_get(persistent, segment->index);
+	
+	return NULL;
+}
+
+jsonPersistent_t* json_persistent_get(jsonPersistent_t* persistent, const char* query) {
+	jsonQuery_t* compiled = json_query_compile(query);
+	if (compiled == NULL)
+		return NULL;
+	
+	for (size_t i = 0; persistent != NULL && i < compiled->size; i++) {
+		persistent = json_persistent_select(persistent, &compiled->segments[i]);
+	}
+	
+	json_query_free(compiled);
+	
+	return persistent;
+}
+
+// new version of persistent with the path changed; replacement is NULL for removals and its reference is taken
+static jsonPersistent_t* json_persistent_update(jsonPersistent_t* persistent, struct jsonQuerySegment* segments, size_t n, jsonPersistent_t* replacement) {
+	struct jsonQuerySegment* segment = &segments[0];
+	
+	if (segment->type != JSON_QUERY_SELECT || (persistent->type != JSON_OBJECT && (persistent->type != JSON_ARRAY || !segment->isIndex))) {
+		json_persistent_release(replacement);
+		return NULL;
+	}
+	
+	if (n > 1) {
+		jsonPersistent_t* child = json_persistent_select(persistent, segment);
+		if (child == NULL) {
+			json_persistent_release(replacement);
+			return NULL;
+		}
+		
+		replacement = json_persistent_update(child, segments + 1, n - 1, replacement);
+		if (replacement == NULL)
+			return NULL;
+	} else if (replacement == NULL) {
+		if (persistent->type == JSON_OBJECT)
+			return json_persistent_object_remove(persistent, segment->key);
+		return json_persistent_array_remove(persistent, segment->index);
+	}
+	
+	if (persistent->type == JSON_OBJECT)
+		return json_persistent_object_set(persistent, segment->key, replacement);
+	
+	if (segment->index > persistent->size) {
+		json_persistent_release(replacement);
+		return NULL;
+	}
+	return json_persistent_array_set(persistent, segment->index, replacement);
+}
+
+// value is always freed
+jsonPersistent_t* json_persistent_set(jsonPersistent_t* persistent, const char* query, jsonValue_t* value) {
+	jsonPersistent_t* replacement = json_persistent_new(value);
+	json_free(value);
+	if (replacement == NULL)
+		return NULL;
+	
+	jsonQuery_t* compiled = json_query_compile(query);
+	if (compiled == NULL) {
+		json_persistent_release(replacement);
+		return NULL;
+	}
+	
+	jsonPersistent_t* result;
+	if (compiled->multi) {
+		json_persistent_release(replacement);
+		result = NULL;
+	} else if (compiled->size == 0) {
+		result = replacement;
+	} else {
+		result = json_persistent_update(persistent, compiled->segments, compiled->size, replacement);
+	}
+	
+	json_query_free(compiled);
+	
+	return result;
+}
+
+jsonPersistent_t* json_persistent_remove(jsonPersistent_t* persistent, const char* query) {
+	jsonQuery_t* compiled = json_query_compile(query);
+	if (compiled == NULL)
+		return NULL;
+	
+	jsonPersistent_t* result = NULL;
+	if (!compiled->multi && compiled->size > 0)
+		result = json_persistent_update(persistent, compiled->segments, compiled->size, NULL);
+	
+	json_query_free(compiled);
+	
+	return result;
+}
@@ -3,16 +3,37 @@
 #include <stdbool.h>
 
 #include "json.h"
+#include "alloc.h"
+#include "container.h"
+#include "query.h"
+
+extern void json_free_r(jsonValue_t* value);
+extern int json_array_insert_entry(jsonValue_t* array, size_t index, jsonValue_t* value);
+extern int json_object_set_entry(jsonValue_t* object, const char* key, jsonValue_t* value);
+
+struct jsonQueryFrame {
+	jsonValue_t* value;
+	size_t segment;
+	size_t cursor;
+};
+
+struct jsonQueryIterator {
+	jsonQuery_t* query;
+	size_t size;
+	size_t capacity;
+	struct jsonQueryFrame* stack;
+};
+
+// returned for selectors that match the structure but not an existing key/index
+static jsonValue_t json_query_null = { .type = JSON_NULL };
 
 jsonValue_t* json_object_get(jsonValue_t* value, const char* key) {
 	if (value->type != JSON_OBJECT)
 		return NULL;
 
-	for (size_t i = 0; i < value->value.object.size; i++) {
-		if (strcmp(value->value.object.entries[i].key, key) == 0) {
-			return json_clone(&value->value.object.entries[i].value);
-		}
-	}
+	size_t i = json_container_key(value, key);
+	if (i < value->value.object.size)
+		return json_clone(&value->value.object.entries[i].value);
 	
 	return json_null();
 }
@@ -28,94 +49,1076 @@ jsonValue_t* json_array_get(jsonValue_t* value, size_t i) {
 	return json_clone(&value->value.array.entries[i]);
 }
 
-jsonValue_t* json_query(jsonValue_t* value, const char* query) {
-	#define JSON_QUERY_BUFFER_SIZE (1024)
+void json_query_free(jsonQuery_t* query) {
+	if (query == NULL)
+		return;
+	
+	for (size_t i = 0; i < query->size; i++) {
+		json_dealloc(query->segments[i].key);
+		
+		struct jsonQueryFilter* filter = query->segments[i].filter;
+		if (filter != NULL) {
+			json_query_free(filter->path);
+			if (filter->literal.type == JSON_STRING)
+				json_dealloc(filter->literal.value.string);
+			json_dealloc(filter);
+		}
+	}
+	json_dealloc(query->segments);
+	json_dealloc(query);
+}
+
+static int json_query_compile_segment(struct jsonQuerySegment* segment, const char* selector, size_t length) {
+	segment->type = JSON_QUERY_SELECT;
+	segment->isIndex = false;
+	segment->index = 0;
+	
+	if (length >= 2 && selector[0] == '[' && selector[length - 1] == ']') {
+		char* endptr;
+		long long index = strtoll(selector + 1, &endptr, 10);
+		if (endptr == selector + length - 1 && endptr != selector + 1 && index >= 0) {
+			segment->isIndex = true;
+			segment->index = index;
+		}
+	}
+	
+	if (length >= 2 && selector[0] == '"' && selector[length - 1] == '"') {
+		selector++;
+		length -= 2;
+	}
+	
+	segment->key = json_strndup(selector, length);
+	if (segment->key == NULL) {
+		return -1;
+	}
+	
+	return 0;
+}
 
-	char buffer[JSON_QUERY_BUFFER_SIZE];
+static int json_query_compile_slice(struct jsonQuerySegment* segment, const char* selector, size_t length) {
+	const char* end = selector + length;
+	char* endptr;
+	
+	segment->type = JSON_QUERY_SLICE;
+	
+	segment->hasStart = selector[0] != ':';
+	if (segment->hasStart) {
+		segment->start = strtoll(selector, &endptr, 10);
+		if (endptr == selector || *endptr != ':')
+			return -1;
+		selector = endptr;
+	}
+	selector++;
+	
+	segment->hasEnd = selector != end;
+	if (segment->hasEnd) {
+		segment->end = strtoll(selector, &endptr, 10);
+		if (endptr != end)
+			return -1;
+	}
+	
+	return 0;
+}
 
-	value = json_clone(value);
-	if (value == NULL) {
-		return NULL;
+static const char* json_query_skip_space(const char* string, const char* end) {
+	while (string < end && (*string == ' ' || *string == '\t'))
+		string++;
+	return string;
+}
+
+static int json_query_compile_literal(jsonValue_t* literal, const char* string, size_t length) {
+	if (length == 4 && strncmp(string, "null", 4) == 0) {
+		literal->type = JSON_NULL;
+	} else if (length == 4 && strncmp(string, "true", 4) == 0) {
+		literal->type = JSON_BOOL;
+		literal->value.boolean = true;
+	} else if (length == 5 && strncmp(string, "false", 5) == 0) {
+		literal->type = JSON_BOOL;
+		literal->value.boolean = false;
+	} else if (length >= 2 && string[0] == '"' && string[length - 1] == '"') {
+		literal->type = JSON_STRING;
+		literal->value.string = json_strndup(string + 1, length - 2);
+		if (literal->value.string == NULL)
+			return -1;
+	} else if (length > 0) {
+		char* tmp = json_strndup(string, length);
+		if (tmp == NULL)
+			return -1;
+		
+		char* endptr;
+		literal->type = JSON_LONG;
+		literal->value.integer = strtoll(tmp, &endptr, 10);
+		if (*endptr != '\0') {
+			literal->type = JSON_DOUBLE;
+			literal->value.real = strtod(tmp, &endptr);
+		}
+		
+		bool okay = *endptr == '\0';
+		json_dealloc(tmp);
+		
+		if (!okay)
+			return -1;
+	} else {
+		return -1;
 	}
+	
+	return 0;
+}
 
-	while(true) {	
-		if (query[0] == '\0')
+// syntax: ?(path [operator literal])
+static int json_query_compile_filter(struct jsonQuerySegment* segment, const char* selector, size_t length) {
+	const char* end = selector + length;
+	
+	if (length < 3 || selector[1] != '(' || end[-1] != ')')
+		return -1;
+	
+	selector = json_query_skip_space(selector + 2, end - 1);
+	end--;
+	
+	const char* pathEnd;
+	for (pathEnd = selector; pathEnd < end && strchr(" \t<>=!", *pathEnd) == NULL; pathEnd++);
+	
+	struct jsonQueryFilter* filter = json_alloc(sizeof(struct jsonQueryFilter));
+	if (filter == NULL)
+		return -1;
+	
+	filter->literal.type = JSON_NULL;
+	filter->operator = JSON_FILTER_EXISTS;
+	filter->path = NULL;
+	segment->type = JSON_QUERY_FILTER;
+	segment->filter = filter;
+	
+	char* path = json_strndup(selector, pathEnd - selector);
+	if (path == NULL)
+		return -1;
+	filter->path = json_query_compile(path);
+	json_dealloc(path);
+	if (filter->path == NULL || filter->path->multi)
+		return -1;
+	
+	selector = json_query_skip_space(pathEnd, end);
+	if (selector == end)
+		return 0;
+	
+	static const struct {
+		const char* token;
+		jsonQueryFilterOperator_t operator;
+	} operators[] = {
+		{ "==", JSON_FILTER_EQUAL },
+		{ "!=", JSON_FILTER_NOT_EQUAL },
+		{ "<=", JSON_FILTER_LESS_EQUAL },
+		{ ">=", JSON_FILTER_GREATER_EQUAL },
+		{ "<", JSON_FILTER_LESS },
+		{ ">", JSON_FILTER_GREATER },
+	};
+	
+	size_t i;
+	for (i = 0; i < sizeof(operators) / sizeof(operators[0]); i++) {
+		size_t tokenLength = strlen(operators[i].token);
+		if ((size_t) (end - selector) >= tokenLength && strncmp(selector, operators[i].token, tokenLength) == 0) {
+			filter->operator = operators[i].operator;
+			selector += tokenLength;
 			break;
-			
-		if (query[0] != '.') {
-			json_free(value);
+		}
+	}
+	if (i == sizeof(operators) / sizeof(operators[0]))
+		return -1;
+	
+	selector = json_query_skip_space(selector, end);
+	while (end > selector && (end[-1] == ' ' || end[-1] == '\t'))
+		end--;
+	
+	return json_query_compile_literal(&filter->literal, selector, end - selector);
+}
+
+static int json_query_compile_bracket(struct jsonQuerySegment* segment, const char* selector, size_t length) {
+	const char* content = selector + 1;
+	size_t contentLength = length - 2;
+	
+	if (contentLength == 1 && content[0] == '*') {
+		segment->type = JSON_QUERY_WILDCARD;
+		return 0;
+	}
+	if (contentLength > 0 && content[0] == '?') {
+		return json_query_compile_filter(segment, content, contentLength);
+	}
+	if (memchr(content, ':', contentLength) != NULL) {
+		return json_query_compile_slice(segment, content, contentLength);
+	}
+	
+	return json_query_compile_segment(segment, selector, length);
+}
+
+// returns the length of the bracket selector or 0 if the brackets don't match
+static size_t json_query_bracket_length(const char* query) {
+	size_t depth = 0;
+	bool quoted = false;
+	
+	for (size_t i = 0; query[i] != '\0'; i++) {
+		if (quoted) {
+			if (query[i] == '\\' && query[i + 1] != '\0')
+				i++;
+			else if (query[i] == '"')
+				quoted = false;
+		} else if (query[i] == '"') {
+			quoted = true;
+		} else if (query[i] == '[' || query[i] == '(') {
+			depth++;
+		} else if (query[i] == ']' || query[i] == ')') {
+			if (--depth == 0)
+				return i + 1;
+		}
+	}
+	
+	return 0;
+}
+
+jsonQuery_t* json_query_compile(const char* query) {
+	jsonQuery_t* compiled = json_alloc(sizeof(jsonQuery_t));
+	if (compiled == NULL)
+		return NULL;
+	
+	compiled->size = 0;
+	compiled->multi = false;
+	compiled->segments = NULL;
+	
+	// upper bound for the number of segments
+	size_t segments = 0;
+	for (size_t i = 0; query[i] != '\0'; i++) {
+		if (query[i] == '.')
+			segments++;
+	}
+	
+	if (segments > 0) {
+		compiled->segments = json_alloc(sizeof(struct jsonQuerySegment) * segments);
+		if (compiled->segments == NULL) {
+			json_dealloc(compiled);
 			return NULL;
 		}
+	}
 	
-		size_t length;
-		for (length = 1; query[length] != '\0' && query[length] != '.'; length++);
-		
-		if (length >= JSON_QUERY_BUFFER_SIZE) {
-			json_free(value);
+	while(query[0] != '\0') {
+		if (query[0] != '.') {
+			json_query_free(compiled);
 			return NULL;
 		}
 		
-		memcpy(buffer, query, length);
-		buffer[length] = '\0';
+		if (query[1] == '.') {
+			// recursive descent; the following selector is applied on every level
+			if (compiled->size == 0 || compiled->segments[compiled->size - 1].type != JSON_QUERY_DESCENT) {
+				compiled->segments[compiled->size++] = (struct jsonQuerySegment) {
+					.type = JSON_QUERY_DESCENT,
+				};
+				compiled->multi = true;
+			}
+			query++;
+			continue;
+		}
 		
-		query = query + length;
+		query++;
 		
-		if (strcmp(buffer, ".") == 0) {
-			continue;
+		size_t length = 0;
+		if (query[0] == '[') {
+			length = json_query_bracket_length(query);
+			if (query[length] != '.' && query[length] != '\0')
+				length = 0;
+		} else if (query[0] == '"') {
+			for (length = 1; query[length] != '\0' && query[length] != '"'; length++);
+			if (query[length] == '"' && (query[length + 1] == '.' || query[length + 1] == '\0'))
+				length++;
+			else
+				length = 0;
 		}
 		
-		char* _buffer = buffer + 1;
-		length--;
+		if (length == 0) {
+			for (; query[length] != '\0' && query[length] != '.'; length++);
+		}
 		
-		switch(value->type) {
-			case JSON_ARRAY:
-				if (_buffer[0] != '[' || _buffer[length - 1] != ']') {
-					json_free(value);
-					return NULL;
+		if (length > 0) {
+			struct jsonQuerySegment* segment = &compiled->segments[compiled->size++];
+			*segment = (struct jsonQuerySegment) {
+				.type = JSON_QUERY_SELECT,
+			};
+			
+			int result;
+			if (query[0] == '[' && query[length - 1] == ']') {
+				result = json_query_compile_bracket(segment, query, length);
+			} else {
+				result = json_query_compile_segment(segment, query, length);
+			}
+			
+			if (result < 0) {
+				json_query_free(compiled);
+				return NULL;
+			}
+			
+			if (segment->type != JSON_QUERY_SELECT)
+				compiled->multi = true;
+		}
+		
+		query += length;
+	}
+	
+	return compiled;
+}
+
+static jsonValue_t* json_query_select(jsonValue_t* value, struct jsonQuerySegment* segment) {
+	switch(value->type) {
+		case JSON_ARRAY:
+			if (!segment->isIndex)
+				return NULL;
+			if (segment->index >= value->value.array.size)
+				return &json_query_null;
+			return &value->value.array.entries[segment->index];
+		case JSON_OBJECT: {
+			size_t i = json_container_key(value, segment->key);
+			if (i < value->value.object.size)
+				return &value->value.object.entries[i].value;
+			return &json_query_null;
+		}
+		default:
+			return NULL;
+	}
+}
+
+static size_t json_query_children(jsonValue_t* value) {
+	switch(value->type) {
+		case JSON_ARRAY:
+			return value->value.array.size;
+		case JSON_OBJECT:
+			return value->value.object.size;
+		default:
+			return 0;
+	}
+}
+
+static jsonValue_t* json_query_child(jsonValue_t* value, size_t i) {
+	if (value->type == JSON_ARRAY)
+		return &value->value.array.entries[i];
+	else
+		return &value->value.object.entries[i].value;
+}
+
+static size_t json_query_child_index(jsonValue_t* value, jsonValue_t* child) {
+	if (value->type == JSON_ARRAY)
+		return child - value->value.array.entries;
+	else
+		return ((char*) child - (char*) &value->value.object.entries[0].value) / sizeof(jsonObjectEntry_t);
+}
+
+static int json_query_compare_values(jsonValue_t* a, jsonValue_t* b, bool* comparable) {
+	*comparable = true;
+	
+	if (a->type == JSON_LONG && b->type == JSON_LONG) {
+		return (a->value.integer > b->value.integer) - (a->value.integer < b->value.integer);
+	}
+	if ((a->type == JSON_LONG || a->type == JSON_DOUBLE) && (b->type == JSON_LONG || b->type == JSON_DOUBLE)) {
+		double x = a->type == JSON_LONG ? a->value.integer : a->value.real;
+		double y = b->type == JSON_LONG ? b->value.integer : b->value.real;
+		return (x > y) - (x < y);
+	}
+	if (a->type == JSON_STRING && b->type == JSON_STRING) {
+		return strcmp(a->value.string, b->value.string);
+	}
+	
+	// bools and nulls can only be tested for equality
+	*comparable = false;
+	if (a->type != b->type)
+		return 1;
+	if (a->type == JSON_BOOL)
+		return a->value.boolean != b->value.boolean;
+	if (a->type == JSON_NULL)
+		return 0;
+	
+	return 1;
+}
+
+static bool json_query_filter_matches(struct jsonQueryFilter* filter, jsonValue_t* value) {
+	for (size_t i = 0; i < filter->path->size; i++) {
+		value = json_query_select(value, &filter->path->segments[i]);
+		if (value == NULL || value == &json_query_null)
+			return false;
+	}
+	
+	if (filter->operator == JSON_FILTER_EXISTS)
+		return true;
+	
+	bool comparable;
+	int result = json_query_compare_values(value, &filter->literal, &comparable);
+	
+	switch(filter->operator) {
+		case JSON_FILTER_EQUAL:
+			return result == 0;
+		case JSON_FILTER_NOT_EQUAL:
+			return result != 0;
+		case JSON_FILTER_LESS:
+			return comparable && result < 0;
+		case JSON_FILTER_LESS_EQUAL:
+			return comparable && result <= 0;
+		case JSON_FILTER_GREATER:
+			return comparable && result > 0;
+		case JSON_FILTER_GREATER_EQUAL:
+			return comparable && result >= 0;
+		default:
+			return false;
+	}
+}
+
+static size_t json_query_slice_bound(bool has, long long bound, size_t fallback, size_t size) {
+	if (!has)
+		return fallback;
+	if (bound < 0) {
+		// counted from the end; negated as unsigned so LLONG_MIN doesn't overflow
+		unsigned long long back = -(unsigned long long) bound;
+		return back >= size ? 0 : size - (size_t) back;
+	}
+	if ((unsigned long long) bound > size)
+		return size;
+	return (size_t) bound;
+}
+
+static bool json_query_push(jsonQueryIterator_t* iterator, jsonValue_t* value, size_t segment) {
+	if (iterator->size == iterator->capacity) {
+		size_t capacity = iterator->capacity * 2;
+		struct jsonQueryFrame* stack = json_realloc(iterator->stack, sizeof(struct jsonQueryFrame) * capacity);
+		if (stack == NULL)
+			return false;
+		iterator->stack = stack;
+		iterator->capacity = capacity;
+	}
+	
+	iterator->stack[iterator->size++] = (struct jsonQueryFrame) {
+		.value = value,
+		.segment = segment,
+		.cursor = 0,
+	};
+	
+	return true;
+}
+
+#define JSON_QUERY_ITERATOR_INITIAL_CAPACITY (16)
+
+jsonQueryIterator_t* json_query_iterate(jsonValue_t* value, jsonQuery_t* query) {
+	jsonQueryIterator_t* iterator = json_alloc(sizeof(jsonQueryIterator_t));
+	if (iterator == NULL)
+		return NULL;
+	
+	iterator->query = query;
+	iterator->size = 0;
+	iterator->capacity = JSON_QUERY_ITERATOR_INITIAL_CAPACITY;
+	iterator->stack = json_alloc(sizeof(struct jsonQueryFrame) * iterator->capacity);
+	if (iterator->stack == NULL) {
+		json_dealloc(iterator);
+		return NULL;
+	}
+	
+	json_query_push(iterator, value, 0);
+	
+	return iterator;
+}
+
+jsonValue_t* json_query_next(jsonQueryIterator_t* iterator) {
+	jsonQuery_t* query = iterator->query;
+
+	while (iterator->size > 0) {
+		struct jsonQueryFrame* frame = &iterator->stack[iterator->size - 1];
+		
+		if (frame->segment == query->size) {
+			iterator->size--;
+			return frame->value;
+		}
+		
+		struct jsonQuerySegment* segment = &query->segments[frame->segment];
+		size_t children = json_query_children(frame->value);
+		jsonValue_t* next = NULL;
+		size_t nextSegment = frame->segment + 1;
+		
+		switch(segment->type) {
+			case JSON_QUERY_SELECT:
+				next = json_query_select(frame->value, segment);
+				if (next == NULL || next == &json_query_null) {
+					iterator->size--;
+				} else {
+					// tail position; reuse the frame
+					frame->value = next;
+					frame->segment++;
 				}
-				_buffer[length - 1] = '\0';
-				_buffer = _buffer + 1;
-				
-				char* endptr;
-				long long index = strtoll(_buffer, &endptr, 10);
-				if (*endptr != '\0') {
-					json_free(value);
-					return NULL;
+				continue;
+			case JSON_QUERY_WILDCARD:
+			case JSON_QUERY_FILTER:
+				if (frame->cursor >= children) {
+					iterator->size--;
+					continue;
 				}
-				if (index < 0) {
-					json_free(value);
-					return NULL;
+				next = json_query_child(frame->value, frame->cursor++);
+				if (segment->type == JSON_QUERY_FILTER && !json_query_filter_matches(segment->filter, next))
+					continue;
+				break;
+			case JSON_QUERY_SLICE:
+				if (frame->value->type != JSON_ARRAY) {
+					iterator->size--;
+					continue;
 				}
-				
-				jsonValue_t* arrayEntry = json_array_get(value, index);
-				json_free(value);
-				value = arrayEntry;
-			
+				size_t start = json_query_slice_bound(segment->hasStart, segment->start, 0, children);
+				size_t end = json_query_slice_bound(segment->hasEnd, segment->end, children, children);
+				if (start + frame->cursor >= end) {
+					iterator->size--;
+					continue;
+				}
+				next = json_query_child(frame->value, start + frame->cursor++);
 				break;
-			case JSON_OBJECT:
-				if (_buffer[0] == '"') {
-					if (_buffer[length - 1] != '"') {
-						json_free(value);
-						return NULL;
-					}
-										
-					_buffer[length - 1] = '\0';
-					_buffer = _buffer + 1;
+			case JSON_QUERY_DESCENT:
+				// the value itself first, then all children with the descent still pending
+				if (frame->cursor == 0) {
+					frame->cursor++;
+					next = frame->value;
+				} else if (frame->cursor - 1 < children) {
+					next = json_query_child(frame->value, frame->cursor++ - 1);
+					nextSegment = frame->segment;
+				} else {
+					iterator->size--;
+					continue;
 				}
-				
-				jsonValue_t* objectEntry = json_object_get(value, _buffer);
-				json_free(value);
-				value = objectEntry;
-			
 				break;
-			default:
-				json_free(value);
-				return NULL;
 		}
 		
+		if (!json_query_push(iterator, next, nextSegment)) {
+			iterator->size = 0;
+			return NULL;
+		}
+	}
+	
+	return NULL;
+}
+
+void json_query_iterator_free(jsonQueryIterator_t* iterator) {
+	if (iterator == NULL)
+		return;
+	
+	json_dealloc(iterator->stack);
+	json_dealloc(iterator);
+}
+
+static jsonValue_t* json_query_collect(jsonValue_t* value, jsonQuery_t* query) {
+	jsonQueryIterator_t* iterator = json_query_iterate(value, query);
+	if (iterator == NULL)
+		return NULL;
+	
+	size_t size = 0;
+	size_t capacity = JSON_QUERY_ITERATOR_INITIAL_CAPACITY;
+	jsonValue_t** matches = json_alloc(sizeof(jsonValue_t*) * capacity);
+	
+	jsonValue_t* match;
+	while (matches != NULL && (match = json_query_next(iterator)) != NULL) {
+		if (size == capacity) {
+			capacity *= 2;
+			jsonValue_t** tmp = json_realloc(matches, sizeof(jsonValue_t*) * capacity);
+			if (tmp == NULL) {
+				json_dealloc(matches);
+				matches = NULL;
+				break;
+			}
+			matches = tmp;
+		}
+		matches[size++] = match;
+	}
+	
+	json_query_iterator_free(iterator);
+	
+	if (matches == NULL)
+		return NULL;
+	
+	jsonValue_t* result = json_value();
+	if (result != NULL) {
+		result->type = JSON_ARRAY;
+		result->value.array.size = 0;
+		result->value.array.entries = json_entries_alloc(size, sizeof(jsonValue_t));
+		if (result->value.array.entries == NULL) {
+			json_dealloc(result);
+			result = NULL;
+		}
+	}
+	
+	for (size_t i = 0; result != NULL && i < size; i++) {
+		jsonValue_t* clone = json_clone(matches[i]);
+		if (clone == NULL) {
+			json_free(result);
+			result = NULL;
+			break;
+		}
+		result->value.array.entries[result->value.array.size++] = *clone;
+		json_dealloc(clone);
+	}
+	
+	json_dealloc(matches);
+	
+	return result;
+}
+
+jsonValue_t* json_query_compiled(jsonValue_t* value, jsonQuery_t* query) {
+	if (query->multi)
+		return json_query_collect(value, query);
+
+	for (size_t i = 0; i < query->size; i++) {
+		value = json_query_select(value, &query->segments[i]);
 		if (value == NULL)
 			return NULL;
 	}
 	
+	return json_clone(value);
+}
+
+/*
+ * Modifications by path: every container on the path is marked as dirty, so
+ * cached output of the containers (see json_cache()) stays consistent.
+ */
+
+static void json_invalidate_r(jsonValue_t* value) {
+	json_container_dirty(value);
+	json_container_entries_dirty(value);
+	
+	size_t size = json_query_children(value);
+	for (size_t i = 0; i < size; i++) {
+		json_invalidate_r(json_query_child(value, i));
+	}
+}
+
+// returns the parent of the last segment; every container on the way is unshared and marked as dirty
+static jsonValue_t* json_query_parent(jsonValue_t* value, jsonQuery_t* query) {
+	if (query->multi)
+		return NULL;
+	
+	for (size_t i = 0; i + 1 < query->size; i++) {
+		if (json_container_unshare(value) < 0)
+			return NULL;
+		json_container_dirty(value);
+		value = json_query_select(value, &query->segments[i]);
+		if (value == NULL || value == &json_query_null)
+			return NULL;
+	}
+	
+	if (json_container_unshare(value) < 0)
+		return NULL;
+	json_container_dirty(value);
 	return value;
 }
+
+static int json_set_entry(jsonValue_t* parent, struct jsonQuerySegment* segment, jsonValue_t* replacement) {
+	if (parent->type == JSON_OBJECT)
+		return json_object_set_entry(parent, segment->key, replacement);
+	
+	if (parent->type != JSON_ARRAY || !segment->isIndex || segment->index > parent->value.array.size)
+		return -1;
+	
+	if (segment->index == parent->value.array.size)
+		return json_array_insert_entry(parent, segment->index, replacement);
+	
+	json_free_r(&parent->value.array.entries[segment->index]);
+	json_container_entry_dirty(parent, segment->index);
+	parent->value.array.entries[segment->index] = *replacement;
+	json_dealloc(replacement);
+	json_document_adopt(parent, &parent->value.array.entries[segment->index]);
+	
+	return 0;
+}
+
+int json_set(jsonValue_t* value, const char* query, jsonValue_t* replacement) {
+	jsonQuery_t* compiled = json_query_compile(query);
+	if (compiled == NULL)
+		return -1;
+	
+	int result = -1;
+	
+	if (compiled->size == 0 && !compiled->multi) {
+		if (!json_container_readonly(value)) {
+			json_free_r(value);
+			*value = *replacement;
+			json_dealloc(replacement);
+			result = 0;
+		}
+	} else {
+		jsonValue_t* parent = json_query_parent(value, compiled);
+		if (parent != NULL)
+			result = json_set_entry(parent, &compiled->segments[compiled->size - 1], replacement);
+	}
+	
+	json_query_free(compiled);
+	
+	return result;
+}
+
+int json_invalidate(jsonValue_t* value, const char* query) {
+	jsonQuery_t* compiled = json_query_compile(query);
+	if (compiled == NULL)
+		return -1;
+	
+	int result = -1;
+	
+	jsonValue_t* parent = compiled->size == 0 ? value : json_query_parent(value, compiled);
+	if (parent != NULL) {
+		jsonValue_t* target = compiled->size == 0 ? value : json_query_select(parent, &compiled->segments[compiled->size - 1]);
+		if (target != NULL && target != &json_query_null) {
+			if (target != value)
+				json_container_entry_dirty(parent, json_query_child_index(parent, target));
+			json_invalidate_r(target);
+			result = 0;
+		}
+	}
+	
+	json_query_free(compiled);
+	
+	return result;
+}
+
+jsonValue_t* json_query(jsonValue_t* value, const char* query) {
+	jsonQuery_t* compiled = json_query_compile(query);
+	if (compiled == NULL)
+		return NULL;
+	
+	jsonValue_t* result = json_query_compiled(value, compiled);
+	
+	json_query_free(compiled);
+	
+	return result;
+}
+
+/*
+ * json_query_many() merges all queries into a prefix trie, so shared
+ * prefixes are resolved only once. Trie nodes are stored in a flat array
+ * and linked by index (first child/next sibling).
+ */
+
+#define JSON_QUERY_TRIE_NONE ((size_t) -1)
+
+struct jsonQueryTrieNode {
+	struct jsonQuerySegment* segment;
+	size_t firstChild;
+	size_t nextSibling;
+	size_t firstQuery;
+	jsonValue_t* match;
+};
+
+static void json_query_many_r(struct jsonQueryTrieNode* trie, size_t node, jsonValue_t* value, size_t* nextQuery, jsonValue_t* results[], bool* okay) {
+	for (size_t q = trie[node].firstQuery; q != JSON_QUERY_TRIE_NONE; q = nextQuery[q]) {
+		if (value == NULL) {
+			results[q] = NULL;
+		} else {
+			results[q] = json_clone(value);
+			if (results[q] == NULL)
+				*okay = false;
+		}
+	}
+	
+	size_t children = 0;
+	for (size_t c = trie[node].firstChild; c != JSON_QUERY_TRIE_NONE; c = trie[c].nextSibling) {
+		trie[c].match = NULL;
+		children++;
+	}
+	
+	if (children == 0)
+		return;
+	
+	if (value != NULL && value->type == JSON_OBJECT) {
+		// resolve all child keys in a single pass over the entries
+		size_t unresolved = children;
+		for (size_t i = 0; i < value->value.object.size && unresolved > 0; i++) {
+			jsonObjectEntry_t* entry = &value->value.object.entries[i];
+			for (size_t c = trie[node].firstChild; c != JSON_QUERY_TRIE_NONE; c = trie[c].nextSibling) {
+				if (trie[c].match == NULL && strcmp(entry->key, trie[c].segment->key) == 0) {
+					trie[c].match = &entry->value;
+					unresolved--;
+				}
+			}
+		}
+		for (size_t c = trie[node].firstChild; c != JSON_QUERY_TRIE_NONE; c = trie[c].nextSibling) {
+			if (trie[c].match == NULL)
+				trie[c].match = &json_query_null;
+		}
+	} else if (value != NULL) {
+		for (size_t c = trie[node].firstChild; c != JSON_QUERY_TRIE_NONE; c = trie[c].nextSibling) {
+			trie[c].match = json_query_select(value, trie[c].segment);
+		}
+	}
+	
+	for (size_t c = trie[node].firstChild; c != JSON_QUERY_TRIE_NONE; c = trie[c].nextSibling) {
+		json_query_many_r(trie, c, trie[c].match, nextQuery, results, okay);
+	}
+}
+
+int json_query_many(jsonValue_t* value, jsonQuery_t* queries[], size_t n, jsonValue_t* results[]) {
+	size_t nodes = 1;
+	for (size_t i = 0; i < n; i++) {
+		nodes += queries[i]->size;
+	}
+	
+	struct jsonQueryTrieNode* trie = json_alloc(sizeof(struct jsonQueryTrieNode) * nodes);
+	if (trie == NULL)
+		return -1;
+	
+	size_t* nextQuery = json_alloc(sizeof(size_t) * (n > 0 ? n : 1));
+	if (nextQuery == NULL) {
+		json_dealloc(trie);
+		return -1;
+	}
+	
+	trie[0] = (struct jsonQueryTrieNode) {
+		.segment = NULL,
+		.firstChild = JSON_QUERY_TRIE_NONE,
+		.nextSibling = JSON_QUERY_TRIE_NONE,
+		.firstQuery = JSON_QUERY_TRIE_NONE,
+	};
+	nodes = 1;
+	
+	for (size_t i = 0; i < n; i++) {
+		if (queries[i]->multi) {
+			// queries with more than one result are evaluated on their own
+			results[i] = NULL;
+			continue;
+		}
+		
+		size_t node = 0;
+		for (size_t j = 0; j < queries[i]->size; j++) {
+			struct jsonQuerySegment* segment = &queries[i]->segments[j];
+			
+			size_t child;
+			for (child = trie[node].firstChild; child != JSON_QUERY_TRIE_NONE; child = trie[child].nextSibling) {
+				if (trie[child].segment->isIndex == segment->isIndex && strcmp(trie[child].segment->key, segment->key) == 0)
+					break;
+			}
+			
+			if (child == JSON_QUERY_TRIE_NONE) {
+				child = nodes++;
+				trie[child] = (struct jsonQueryTrieNode) {
+					.segment = segment,
+					.firstChild = JSON_QUERY_TRIE_NONE,
+					.nextSibling = trie[node].firstChild,
+					.firstQuery = JSON_QUERY_TRIE_NONE,
+				};
+				trie[node].firstChild = child;
+			}
+			
+			node = child;
+		}
+		
+		nextQuery[i] = trie[node].firstQuery;
+		trie[node].firstQuery = i;
+	}
+	
+	bool okay = true;
+	json_query_many_r(trie, 0, value, nextQuery, results, &okay);
+	
+	for (size_t i = 0; i < n; i++) {
+		if (queries[i]->multi) {
+			results[i] = json_query_collect(value, queries[i]);
+			if (results[i] == NULL)
+				okay = false;
+		}
+	}
+	
+	json_dealloc(nextQuery);
+	json_dealloc(trie);
+	
+	if (!okay) {
+		for (size_t i = 0; i < n; i++) {
+			json_free(results[i]);
+			results[i] = NULL;
+		}
+		return -1;
+	}
+	
+	return 0;
+}
+
+/*
+ * json_query_text() evaluates a query directly on the JSON text. Values that
+ * are not on the query path are skipped by bracket/quote matching without
+ * decoding them. The text is not validated.
+ */
+
+// characters that are relevant while skipping over a container
+static const bool json_text_structural[256] = {
+	['"'] = true,
+	['['] = true,
+	[']'] = true,
+	['{'] = true,
+	['}'] = true,
+};
+
+// characters that end a scalar (number, true, false, null)
+static const bool json_text_delimiter[256] = {
+	[','] = true,
+	[']'] = true,
+	['}'] = true,
+	[':'] = true,
+	[' '] = true,
+	['\t'] = true,
+	['\n'] = true,
+	['\r'] = true,
+};
+
+static size_t json_text_skip_space(const char* text, size_t index, size_t length) {
+	while (index < length && (text[index] == ' ' || text[index] == '\t' || text[index] == '\n' || text[index] == '\r'))
+		index++;
+	return index;
+}
+
+// index points to the opening quote; returns the index after the closing quote
+static size_t json_text_skip_string(const char* text, size_t index, size_t length) {
+	index++;
+	while (index < length) {
+		const char* quote = memchr(text + index, '"', length - index);
+		if (quote == NULL)
+			return length;
+		
+		size_t position = quote - text;
+		size_t backslashes = 0;
+		while (position - backslashes > index && text[position - backslashes - 1] == '\\')
+			backslashes++;
+		
+		index = position + 1;
+		if (backslashes % 2 == 0)
+			return index;
+	}
+	return length;
+}
+
+// index points to the first character of a value; returns the index after the value
+static size_t json_text_skip_value(const char* text, size_t index, size_t length) {
+	if (index >= length)
+		return length;
+	
+	char c = text[index];
+	if (c == '"')
+		return json_text_skip_string(text, index, length);
+	
+	if (c != '[' && c != '{') {
+		while (index < length && !json_text_delimiter[(unsigned char) text[index]])
+			index++;
+		return index;
+	}
+	
+	size_t depth = 0;
+	while (index < length) {
+		c = text[index];
+		if (!json_text_structural[(unsigned char) c]) {
+			index++;
+			continue;
+		}
+		if (c == '"') {
+			index = json_text_skip_string(text, index, length);
+			continue;
+		}
+		index++;
+		if (c == '[' || c == '{') {
+			depth++;
+		} else if (--depth == 0) {
+			return index;
+		}
+	}
+	
+	return length;
+}
+
+// compares the raw (possibly escaped) key text with the decoded query key
+static bool json_text_key_equals(const char* raw, size_t length, const char* key) {
+	if (memchr(raw, '\\', length) == NULL) {
+		return strncmp(raw, key, length) == 0 && key[length] == '\0';
+	}
+	
+	size_t k = 0;
+	for (size_t i = 0; i < length; i++, k++) {
+		char c = raw[i];
+		if (c == '\\' && i + 1 < length) {
+			switch(raw[++i]) {
+				case 'b': c = '\b'; break;
+				case 'f': c = '\f'; break;
+				case 'n': c = '\n'; break;
+				case 'r': c = '\r'; break;
+				case 't': c = '\t'; break;
+				default: c = raw[i]; break;
+			}
+		}
+		if (key[k] != c)
+			return false;
+	}
+	
+	return key[k] == '\0';
+}
+
+// returns the index of the selected value or length if there is none
+static size_t json_text_select(const char* text, size_t index, size_t length, struct jsonQuerySegment* segment) {
+	if (text[index] == '{') {
+		index++;
+		while (true) {
+			index = json_text_skip_space(text, index, length);
+			if (index >= length || text[index] != '"')
+				return length;
+			
+			size_t keyStart = index + 1;
+			index = json_text_skip_string(text, index, length);
+			size_t keyEnd = index - 1;
+			
+			index = json_text_skip_space(text, index, length);
+			if (index >= length || text[index] != ':')
+				return length;
+			index = json_text_skip_space(text, index + 1, length);
+			if (index >= length)
+				return length;
+			
+			if (json_text_key_equals(text + keyStart, keyEnd - keyStart, segment->key))
+				return index;
+			
+			index = json_text_skip_value(text, index, length);
+			index = json_text_skip_space(text, index, length);
+			if (index >= length || text[index] != ',')
+				return length;
+			index++;
+		}
+	} else if (text[index] == '[') {
+		if (!segment->isIndex)
+			return length;
+		
+		index = json_text_skip_space(text, index + 1, length);
+		if (index < length && text[index] == ']')
+			return length;
+		
+		for (size_t i = 0; i < segment->index; i++) {
+			index = json_text_skip_value(text, index, length);
+			index = json_text_skip_space(text, index, length);
+			if (index >= length || text[index] != ',')
+				return length;
+			index = json_text_skip_space(text, index + 1, length);
+		}
+		
+		return index;
+	}
+	
+	return length;
+}
+
+int json_query_text(const char* text, size_t length, jsonQuery_t* query, jsonSpan_t* span) {
+	if (query->multi)
+		return -1;
+	
+	size_t index = json_text_skip_space(text, 0, length);
+	
+	for (size_t i = 0; i < query->size && index < length; i++) {
+		index = json_text_select(text, index, length, &query->segments[i]);
+	}
+	
+	if (index >= length)
+		return -1;
+	
+	span->offset = index;
+	span->length = json_text_skip_value(text, index, length) - index;
+	
+	return 0;
+}
+
+jsonValue_t* json_query_text_value(const char* text, size_t length, jsonQuery_t* query) {
+	jsonSpan_t span;
+	if (json_query_text(text, length, query, &span) < 0)
+		return NULL;
+	
+	return json_parse_n(text + span.offset, span.length);
+}
@@ -0,0 +1,58 @@
+#ifndef JSON_QUERY_H
+#define JSON_QUERY_H
+
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "json.h"
+
+/*
+ * Compiled queries (see json_query_compile()). Shared with modules that
+ * walk paths on their own structures.
+ */
+
+typedef enum {
+	JSON_QUERY_SELECT,
+	JSON_QUERY_WILDCARD,
+	JSON_QUERY_SLICE,
+	JSON_QUERY_DESCENT,
+	JSON_QUERY_FILTER,
+} jsonQuerySegmentType_t;
+
+typedef enum {
+	JSON_FILTER_EXISTS,
+	JSON_FILTER_EQUAL,
+	JSON_FILTER_NOT_EQUAL,
+	JSON_FILTER_LESS,
+	JSON_FILTER_LESS_EQUAL,
+	JSON_FILTER_GREATER,
+	JSON_FILTER_GREATER_EQUAL,
+} jsonQueryFilterOperator_t;
+
+struct jsonQueryFilter {
+	jsonQuery_t* path;
+	jsonQueryFilterOperator_t operator;
+	jsonValue_t literal;
+};
+
+struct jsonQuerySegment {
+	jsonQuerySegmentType_t type;
+	// key as used for objects (surrounding quotes removed)
+	char* key;
+	// index as used for arrays; only valid if isIndex is set
+	bool isIndex;
+	size_t index;
+	// slice bounds; negative values count from the end
+	bool hasStart, hasEnd;
+	long long start, end;
+	struct jsonQueryFilter* filter;
+};
+
+struct jsonQuery {
+	size_t size;
+	// set if the query can match more than one value
+	bool multi;
+	struct jsonQuerySegment* segments;
+};
+
+#endif
@@ -1,170 +1,778 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/uio.h>
 
 #include "json.h"
+#include "alloc.h"
+#include "buffer.h"
+#include "format.h"
+#include "container.h"
 
-size_t string_escaped_length(const char* string) {
-	size_t length = 0;
-	char c;
+void json_write_string(jsonBuffer_t* buffer, const char* source);
+
+int json_buffer_init(jsonBuffer_t* buffer, size_t capacity) {
+	buffer->length = 0;
+	buffer->capacity = capacity;
+	buffer->failed = false;
+	buffer->fixed = false;
+	buffer->write = NULL;
+	buffer->context = NULL;
+	buffer->stringWriter = &json_write_string;
+	buffer->iov = NULL;
+	buffer->cacheAll = false;
+	buffer->data = json_alloc(capacity);
+	if (buffer->data == NULL) {
+		buffer->capacity = 0;
+		buffer->failed = true;
+		return -1;
+	}
+	return 0;
+}
+
+void json_buffer_init_fixed(jsonBuffer_t* buffer, char* data, size_t capacity) {
+	*buffer = (jsonBuffer_t) {
+		.data = data,
+		.length = 0,
+		.capacity = capacity,
+		.failed = false,
+		.fixed = true,
+		.write = NULL,
+		.context = NULL,
+		.stringWriter = &json_write_string,
+		.iov = NULL,
+		.cacheAll = false,
+	};
+}
+
+int json_buffer_init_sink(jsonBuffer_t* buffer, size_t capacity, jsonWriteFunction_t write, void* context) {
+	int result = json_buffer_init(buffer, capacity);
+	buffer->write = write;
+	buffer->context = context;
+	return result;
+}
+
+int json_buffer_flush(jsonBuffer_t* buffer) {
+	if (buffer->failed)
+		return -1;
+	
+	if (buffer->write != NULL && buffer->length > 0) {
+		if (buffer->write(buffer->context, buffer->data, buffer->length) < 0) {
+			buffer->failed = true;
+			return -1;
+		}
+		buffer->length = 0;
+	}
+	
+	return 0;
+}
+
+void json_buffer_destroy(jsonBuffer_t* buffer) {
+	json_dealloc(buffer->data);
+	buffer->data = NULL;
+	buffer->length = 0;
+	buffer->capacity = 0;
+}
+
+char* json_buffer_grow(jsonBuffer_t* buffer, size_t size) {
+	if (buffer->failed)
+		return NULL;
+	
+	if (buffer->fixed) {
+		buffer->failed = true;
+		return NULL;
+	}
+	
+	if (buffer->write != NULL) {
+		if (json_buffer_flush(buffer) < 0)
+			return NULL;
+		if (buffer->capacity >= size)
+			return buffer->data;
+	}
+	
+	size_t capacity = buffer->capacity > 0 ? buffer->capacity : JSON_BUFFER_INITIAL_CAPACITY;
+	while (capacity - buffer->length < size) {
+		capacity *= 2;
+	}
+	
+	char* data = json_realloc(buffer->data, capacity);
+	if (data == NULL) {
+		buffer->failed = true;
+		return NULL;
+	}
+	
+	buffer->data = data;
+	buffer->capacity = capacity;
+	
+	return buffer->data + buffer->length;
+}
+
+// terminates the buffer and hands over its memory; NULL if any write failed
+char* json_buffer_finish(jsonBuffer_t* buffer) {
+	json_buffer_put(buffer, '\0');
+	
+	if (buffer->failed) {
+		json_buffer_destroy(buffer);
+		return NULL;
+	}
+	
+	char* data = buffer->data;
+	buffer->data = NULL;
+	return data;
+}
+
+// escape character for every byte that has to be escaped; 0 otherwise
+static const char json_escape_char[256] = {
+	['\\'] = '\\',
+	['"'] = '"',
+	['/'] = '/',
+	['\b'] = 'b',
+	['\f'] = 'f',
+	['\n'] = 'n',
+	['\r'] = 'r',
+	['\t'] = 't',
+};
+
+/*
+ * The scanners return the index of the first byte that may need escaping (or
+ * length). The vectorized versions report all bytes <= 13 as candidates; the
+ * caller checks json_escape_char for the exact answer.
+ */
+
+typedef size_t (*jsonEscapeScanner_t)(const char* string, size_t length);
+
+static size_t json_escape_scan_scalar(const char* string, size_t length) {
 	size_t i;
-	for (i = 0, c = string[i]; c != '\0'; c = string[++i]) {
-		switch(c) {
-			case '\\':
-			case '"':
-			case '/':
-			case '\b':
-			case '\f':
-			case '\n':
-			case '\r':
-			case '\t':
-				length += 2;
-				break;
-			default:
-				length += 1;
-				break;
+	for (i = 0; i < length; i++) {
+		if (json_escape_char[(unsigned char) string[i]] != 0)
+			break;
+	}
+	return i;
+}
+
+#ifdef __SSE2__
+
+#include <immintrin.h>
+
+static size_t json_escape_scan_sse2(const char* string, size_t length) {
+	const __m128i backslash = _mm_set1_epi8('\\');
+	const __m128i quote = _mm_set1_epi8('"');
+	const __m128i slash = _mm_set1_epi8('/');
+	const __m128i control = _mm_set1_epi8(13);
+	
+	size_t i = 0;
+	for (; i + 16 <= length; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i*) (string + i));
+		__m128i mask = _mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(v, backslash), _mm_cmpeq_epi8(v, quote)),
+			_mm_or_si128(_mm_cmpeq_epi8(v, slash), _mm_cmpeq_epi8(_mm_min_epu8(v, control), v))
+		);
+		int bits = _mm_movemask_epi8(mask);
+		if (bits != 0)
+			return i + __builtin_ctz(bits);
+	}
+	
+	return i + json_escape_scan_scalar(string + i, length - i);
+}
+
+__attribute__((target("avx2")))
+static size_t json_escape_scan_avx2(const char* string, size_t length) {
+	const __m256i backslash = _mm256_set1_epi8('\\');
+	const __m256i quote = _mm256_set1_epi8('"');
+	const __m256i slash = _mm256_set1_epi8('/');
+	const __m256i control = _mm256_set1_epi8(13);
+	
+	size_t i = 0;
+	for (; i + 32 <= length; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i*) (string + i));
+		__m256i mask = _mm256_or_si256(
+			_mm256_or_si256(_mm256_cmpeq_epi8(v, backslash), _mm256_cmpeq_epi8(v, quote)),
+			_mm256_or_si256(_mm256_cmpeq_epi8(v, slash), _mm256_cmpeq_epi8(_mm256_min_epu8(v, control), v))
+		);
+		unsigned int bits = _mm256_movemask_epi8(mask);
+		if (bits != 0)
+			return i + __builtin_ctz(bits);
+	}
+	
+	return i + json_escape_scan_sse2(string + i, length - i);
+}
+
+#endif
+
+static size_t json_escape_scan_resolve(const char* string, size_t length);
+
+static jsonEscapeScanner_t json_escape_scan = &json_escape_scan_resolve;
+
+// picks the best scanner for this CPU on first use
+static size_t json_escape_scan_resolve(const char* string, size_t length) {
+	jsonEscapeScanner_t scanner = &json_escape_scan_scalar;
+	
+#ifdef __SSE2__
+	scanner = &json_escape_scan_sse2;
+	
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		scanner = &json_escape_scan_avx2;
+#endif
+	
+	__atomic_store_n(&json_escape_scan, scanner, __ATOMIC_RELAXED);
+	
+	return scanner(string, length);
+}
+
+static inline size_t json_escape_next(const char* string, size_t length) {
+	jsonEscapeScanner_t scanner = __atomic_load_n(&json_escape_scan, __ATOMIC_RELAXED);
+	return scanner(string, length);
+}
+
+static size_t json_escaped_length(const char* string, size_t length) {
+	size_t result = length;
+	
+	for (size_t i = 0; i < length; i++) {
+		i += json_escape_next(string + i, length - i);
+		if (i < length && json_escape_char[(unsigned char) string[i]] != 0)
+			result++;
+	}
+	
+	return result;
+}
+
+size_t string_escaped_length(const char* string) {
+	return json_escaped_length(string, strlen(string));
+}
+
+// strings are escaped in pieces so the reservation stays bounded for streaming
+#define JSON_WRITE_STRING_CHUNK_SIZE (4096)
+
+static void json_write_string_chunk(jsonBuffer_t* buffer, const char* source, size_t length) {
+	// worst case: every character is escaped
+	size_t reserve = 2 * length;
+	if (buffer->fixed && buffer->capacity - buffer->length < reserve) {
+		// the worst case doesn't fit into a fixed buffer but the exact size might
+		reserve = json_escaped_length(source, length);
+	}
+	
+	char* target = json_buffer_reserve(buffer, reserve);
+	if (target == NULL)
+		return;
+	
+	size_t size = 0;
+	size_t i = 0;
+	while (i < length) {
+		// copy the clean run up to the next candidate in bulk
+		size_t run = json_escape_next(source + i, length - i);
+		memcpy(target + size, source + i, run);
+		size += run;
+		i += run;
+		
+		if (i == length)
+			break;
+		
+		char c = source[i++];
+		char escape = json_escape_char[(unsigned char) c];
+		if (escape != 0) {
+			target[size++] = '\\';
+			target[size++] = escape;
+		} else {
+			target[size++] = c;
 		}
 	}
 	
-	return length;
+	buffer->length += size;
 }
 
-size_t json_length(jsonValue_t* value) {
-	size_t result = 0;
-	switch (value->type) {
+void json_write_string(jsonBuffer_t* buffer, const char* source) {
+	size_t length = strlen(source);
+	
+	json_buffer_put(buffer, '"');
+	
+	while (length > JSON_WRITE_STRING_CHUNK_SIZE) {
+		json_write_string_chunk(buffer, source, JSON_WRITE_STRING_CHUNK_SIZE);
+		source += JSON_WRITE_STRING_CHUNK_SIZE;
+		length -= JSON_WRITE_STRING_CHUNK_SIZE;
+	}
+	json_write_string_chunk(buffer, source, length);
+	
+	json_buffer_put(buffer, '"');
+}
+
+void json_write_double(jsonBuffer_t* buffer, double value) {
+	if (buffer->capacity - buffer->length < JSON_FORMAT_BUFFER_SIZE) {
+		// near the end of the buffer; only reserve what is needed
+		char tmp[JSON_FORMAT_BUFFER_SIZE];
+		json_buffer_write(buffer, tmp, json_format_double(tmp, value));
+		return;
+	}
+	
+	buffer->length += json_format_double(buffer->data + buffer->length, value);
+}
+
+void json_write_long(jsonBuffer_t* buffer, long long value) {
+	if (buffer->capacity - buffer->length < JSON_FORMAT_BUFFER_SIZE) {
+		char tmp[JSON_FORMAT_BUFFER_SIZE];
+		json_buffer_write(buffer, tmp, json_format_long(tmp, value));
+		return;
+	}
+	
+	buffer->length += json_format_long(buffer->data + buffer->length, value);
+}
+
+/*
+ * Containers with caching enabled keep a copy of their serialized form.
+ * Clean containers are copied from the cache; dirty ones are serialized
+ * and stored again. Modifications through json_set() or json_invalidate()
+ * mark every container on the path as dirty; caches stored before a call of
+ * json_array_push() and friends in the same document are ignored (see
+ * json_container_current()); only json_cache() replaces those, since
+ * readers of shares on other threads may still use them. Empty caches are
+ * filled with a compare and swap for the same reason.
+ */
+
+// smaller containers are cheaper to serialize again than to keep around
+#define JSON_CACHE_MIN_LENGTH (64)
+
+static inline bool json_cache_write(jsonBuffer_t* buffer, jsonValue_t* value) {
+	size_t length;
+	const char* cache = json_container_cache(value, &length);
+	if (cache == NULL)
+		return false;
+	
+	json_buffer_write(buffer, cache, length);
+	return true;
+}
+
+static void json_cache_store(jsonBuffer_t* buffer, jsonValue_t* value, size_t start) {
+	struct jsonContainerInfo* info = json_container_info_get(value);
+	if (!buffer->cacheAll && (info == NULL || !info->cached))
+		return;
+	// frozen documents are read concurrently; json_freeze() filled their caches
+	if (info != NULL && info->frozen)
+		return;
+	// outdated caches are only replaced by json_cache(), other threads may still read them
+	if (!buffer->cacheAll && __atomic_load_n(&info->cache, __ATOMIC_ACQUIRE) != NULL)
+		return;
+	
+	struct jsonDocument* document = json_container_document(value);
+	if (document == NULL)
+		return;
+	
+	// the output has to be contiguous; sinks may have flushed the beginning already
+	if (buffer->failed || buffer->write != NULL || buffer->iov != NULL)
+		return;
+	
+	size_t length = buffer->length - start;
+	
+	if (info == NULL || !info->cached) {
+		if (length < JSON_CACHE_MIN_LENGTH)
+			return;
+		info = json_container_info(value);
+		if (info == NULL)
+			return;
+		info->cached = true;
+	}
+	
+	struct jsonCache* cache = json_alloc(sizeof(struct jsonCache) + length);
+	if (cache == NULL)
+		return;
+	cache->generation = __atomic_load_n(&document->generation, __ATOMIC_ACQUIRE);
+	cache->length = length;
+	memcpy(cache->data, buffer->data + start, length);
+	
+	if (buffer->cacheAll) {
+		json_dealloc(info->cache);
+		__atomic_store_n(&info->cache, cache, __ATOMIC_RELEASE);
+		return;
+	}
+	
+	// shares of the document may be serialized on other threads at the same time
+	struct jsonCache* expected = NULL;
+	if (!__atomic_compare_exchange_n(&info->cache, &expected, cache, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+		json_dealloc(cache);
+}
+
+/*
+ * Values parsed with JSON_PARSE_SPANS know their source text. Unmodified
+ * containers and scalars are copied from the source instead of being
+ * serialized again; this also keeps their original formatting.
+ */
+
+static inline bool json_source_write(jsonBuffer_t* buffer, jsonValue_t* value) {
+	size_t length;
+	const char* source = json_container_source(value, &length);
+	if (source == NULL)
+		return false;
+	
+	json_buffer_write(buffer, source, length);
+	return true;
+}
+
+void json_stringify_r(jsonBuffer_t* buffer, jsonValue_t* value);
+
+static inline void json_stringify_entry(jsonBuffer_t* buffer, jsonValue_t* container, size_t i, jsonValue_t* entry) {
+	size_t length;
+	const char* source = json_container_entry_source(container, i, entry, &length);
+	if (source != NULL) {
+		json_buffer_write(buffer, source, length);
+	} else {
+		json_stringify_r(buffer, entry);
+	}
+}
+
+void json_stringify_r(jsonBuffer_t* buffer, jsonValue_t* value) {
+	size_t start;
+	
+	switch(value->type) {
 		case JSON_NULL:
-			return 4;
+			json_buffer_write(buffer, "null", 4);
+			break;
 		case JSON_STRING:
-			return 2 + string_escaped_length(value->value.string);
+			buffer->stringWriter(buffer, value->value.string);
+			break;
 		case JSON_DOUBLE:
-			return snprintf(NULL, 0, "%lf", value->value.real);
+			json_write_double(buffer, value->value.real);
+			break;
 		case JSON_LONG:
-			return snprintf(NULL, 0, "%lld", value->value.integer);
+			json_write_long(buffer, value->value.integer);
+			break;
 		case JSON_BOOL:
-			return 5;
+			if (value->value.boolean) {
+				json_buffer_write(buffer, "true", 4);
+			} else {
+				json_buffer_write(buffer, "false", 5);
+			}
+			break;
 		case JSON_ARRAY:
-			result += 2;
+			if (json_cache_write(buffer, value))
+				break;
+			start = buffer->length;
+			
+			if (json_source_write(buffer, value))
+				break;
+			
+			json_buffer_put(buffer, '[');
+			
 			for (size_t i = 0; i < value->value.array.size; i++) {
-				result += json_length(&(value->value.array.entries[i])) + 1;
+				if (i > 0)
+					json_buffer_put(buffer, ',');
+				json_stringify_entry(buffer, value, i, &(value->value.array.entries[i]));
 			}
-			return result;
+			
+			json_buffer_put(buffer, ']');
+			
+			json_cache_store(buffer, value, start);
+			break;
 		case JSON_OBJECT:
-			result += 2;
+			if (json_cache_write(buffer, value))
+				break;
+			start = buffer->length;
+			
+			if (json_source_write(buffer, value))
+				break;
+			
+			json_buffer_put(buffer, '{');
+			
 			for (size_t i = 0; i < value->value.object.size; i++) {
-				result += strlen(value->value.object.entries[i].key) + 2 + 1;
-				result += json_length(&(value->value.object.entries[i].value)) + 1;
+				if (i > 0)
+					json_buffer_put(buffer, ',');
+				json_write_string(buffer, value->value.object.entries[i].key);
+				json_buffer_put(buffer, ':');
+				json_stringify_entry(buffer, value, i, &(value->value.object.entries[i].value));
 			}
-			return result;
+			
+			json_buffer_put(buffer, '}');
+			
+			json_cache_store(buffer, value, start);
+			break;
 		default:
-			return 0;
+			break;
 	}
 }
 
-size_t json_write_string(char* target, size_t maxSize, const char* source) {	
+int json_cache(jsonValue_t* value) {
+	if (json_document_attach(value) < 0)
+		return -1;
 	
-	#define JSON_WRITE_STRING_ADD(c) target[size++] = c; if (size == maxSize) return size;
-
-	size_t size = 0;
+	jsonBuffer_t buffer;
+	if (json_buffer_init(&buffer, JSON_BUFFER_INITIAL_CAPACITY) < 0)
+		return -1;
+	
+	buffer.cacheAll = true;
+	json_stringify_r(&buffer, value);
+	
+	int result = buffer.failed ? -1 : 0;
+	json_buffer_destroy(&buffer);
+	
+	return result;
+}
 
-	JSON_WRITE_STRING_ADD('"');
+void json_uncache(jsonValue_t* value) {
+	struct jsonContainerInfo* info = json_container_info_get(value);
+	if (info != NULL && !info->frozen) {
+		json_container_dirty(value);
+		info->cached = false;
+	}
 	
-	size_t i;
-	char c;
-	for (i = 0, c = source[i]; c != '\0'; c = source[++i]) {
-		switch(c) {
-			case '\\':
-				JSON_WRITE_STRING_ADD('\\');
-				JSON_WRITE_STRING_ADD('\\');
-				break;
-			case '"':
-				JSON_WRITE_STRING_ADD('\\');
-				JSON_WRITE_STRING_ADD('"');
-				break;
-			case '/':
-				JSON_WRITE_STRING_ADD('\\');
-				JSON_WRITE_STRING_ADD('/');
-				break;
-			case '\b':
-				JSON_WRITE_STRING_ADD('\\');
-				JSON_WRITE_STRING_ADD('b');
-				break;
-			case '\f':
-				JSON_WRITE_STRING_ADD('\\');
-				JSON_WRITE_STRING_ADD('f');
-				break;
-			case '\n':
-				JSON_WRITE_STRING_ADD('\\');
-				JSON_WRITE_STRING_ADD('n');
-				break;
-			case '\r':
-				JSON_WRITE_STRING_ADD('\\');
-				JSON_WRITE_STRING_ADD('r');
-				break;
-			case '\t':
-				JSON_WRITE_STRING_ADD('\\');
-				JSON_WRITE_STRING_ADD('t');
-				break;
-			default:
-				JSON_WRITE_STRING_ADD(c);
-				break;
+	if (value->type == JSON_ARRAY) {
+		for (size_t i = 0; i < value->value.array.size; i++) {
+			json_uncache(&(value->value.array.entries[i]));
 		}
+	} else if (value->type == JSON_OBJECT) {
+		for (size_t i = 0; i < value->value.object.size; i++) {
+			json_uncache(&(value->value.object.entries[i].value));
+		}
+	}
+}
+
+char* json_stringify(jsonValue_t* value) {
+	jsonBuffer_t buffer;
+	if (json_buffer_init(&buffer, JSON_BUFFER_INITIAL_CAPACITY) < 0)
+		return NULL;
+		
+	json_stringify_r(&buffer, value);
+
+	return json_buffer_finish(&buffer);
+}
+
+static size_t json_long_length(long long value) {
+	size_t length = 1;
+	unsigned long long magnitude = value;
+	
+	if (value < 0) {
+		length++;
+		magnitude = 0ULL - magnitude;
 	}
 	
-	JSON_WRITE_STRING_ADD('"');
+	while (magnitude >= 10) {
+		magnitude /= 10;
+		length++;
+	}
 	
-	return size;
+	return length;
 }
 
-size_t json_stringify_r(char* string, size_t index, size_t totalSize, jsonValue_t* value) {
+size_t json_stringify_length(jsonValue_t* value) {
+	char tmp[JSON_FORMAT_BUFFER_SIZE];
+	size_t result = 0;
+	
+	size_t length;
+	if (json_container_cache(value, &length) != NULL || json_container_source(value, &length) != NULL)
+		return length;
+	
 	switch(value->type) {
 		case JSON_NULL:
-			return snprintf(string + index, totalSize - index, "null") + index;
+			return 4;
 		case JSON_STRING:
-			return json_write_string(string + index, totalSize - index, value->value.string) + index;
+			return 2 + string_escaped_length(value->value.string);
 		case JSON_DOUBLE:
-			return snprintf(string + index, totalSize - index, "%lf", value->value.real) + index;
+			return json_format_double(tmp, value->value.real);
 		case JSON_LONG:
-			return snprintf(string + index, totalSize - index, "%lld", value->value.integer) + index;
+			return json_long_length(value->value.integer);
 		case JSON_BOOL:
-			return snprintf(string + index, totalSize - index, "%s", value->value.boolean ? "true" : "false") + index;
+			return value->value.boolean ? 4 : 5;
 		case JSON_ARRAY:
-			index += snprintf(string + index, totalSize - index, "[");
-			
+			// brackets and commas
+			result = 2 + (value->value.array.size > 0 ? value->value.array.size - 1 : 0);
 			for (size_t i = 0; i < value->value.array.size; i++) {
-				index = json_stringify_r(string, index, totalSize, &(value->value.array.entries[i]));
-			
-				index += snprintf(string + index, totalSize - index, ",");
+				if (json_container_entry_source(value, i, &(value->value.array.entries[i]), &length) != NULL) {
+					result += length;
+				} else {
+					result += json_stringify_length(&(value->value.array.entries[i]));
+				}
 			}
-			index--;
-			
-			index += snprintf(string + index, totalSize - index, "]");
-			return index;
+			return result;
 		case JSON_OBJECT:
-			index += snprintf(string + index, totalSize - index, "{");
-			
+			// braces, commas, quotes and colons
+			result = 2 + (value->value.object.size > 0 ? value->value.object.size - 1 : 0);
 			for (size_t i = 0; i < value->value.object.size; i++) {
-				index += json_write_string(string + index, totalSize - index, value->value.object.entries[i].key);
-				index += snprintf(string + index, totalSize - index, ":");
-				index = json_stringify_r(string, index, totalSize, &(value->value.object.entries[i].value));
-			
-				index += snprintf(string + index, totalSize - index, ",");
+				result += 3 + string_escaped_length(value->value.object.entries[i].key);
+				if (json_container_entry_source(value, i, &(value->value.object.entries[i].value), &length) != NULL) {
+					result += length;
+				} else {
+					result += json_stringify_length(&(value->value.object.entries[i].value));
+				}
 			}
-			index--; // replace last , with }
-			index += snprintf(string + index, totalSize - index, "}");
-			return index;
+			return result;
 		default:
-			return index;
+			return 0;
 	}
 }
 
-char* json_stringify(jsonValue_t* value) {
-	size_t size = json_length(value) + 1;
+int json_stringify_buf(jsonValue_t* value, char* string, size_t capacity, size_t* needed) {
+	jsonBuffer_t buffer;
+	json_buffer_init_fixed(&buffer, string, capacity);
+	
+	json_stringify_r(&buffer, value);
+	json_buffer_put(&buffer, '\0');
+	
+	if (!buffer.failed) {
+		if (needed != NULL)
+			*needed = buffer.length;
+		return 0;
+	}
+	
+	if (needed != NULL)
+		*needed = json_stringify_length(value) + 1;
+	return -1;
+}
 
-	char* string = malloc(size);
-	if (string == NULL)
-		return NULL;
-		
-	json_stringify_r(string, 0, size, value);		
+int json_stringify_to(jsonValue_t* value, jsonWriteFunction_t write, void* context) {
+	jsonBuffer_t buffer;
+	if (json_buffer_init_sink(&buffer, JSON_BUFFER_STREAM_CAPACITY, write, context) < 0)
+		return -1;
+	
+	json_stringify_r(&buffer, value);
+	
+	int result = json_buffer_flush(&buffer);
+	json_buffer_destroy(&buffer);
+	
+	return result;
+}
+
+int json_write_file(void* context, const char* data, size_t length) {
+	if (fwrite(data, 1, length, (FILE*) context) != length)
+		return -1;
+	return 0;
+}
+
+int json_write_fd(void* context, const char* data, size_t length) {
+	int fd = (int) (intptr_t) context;
+	
+	while (length > 0) {
+		ssize_t written = write(fd, data, length);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		data += written;
+		length -= written;
+	}
+	
+	return 0;
+}
+
+int json_stringify_to_file(jsonValue_t* value, FILE* file) {
+	return json_stringify_to(value, &json_write_file, file);
+}
+
+int json_stringify_to_fd(jsonValue_t* value, int fd) {
+	return json_stringify_to(value, &json_write_fd, (void*) (intptr_t) fd);
+}
+
+/*
+ * iovec output: the structure, numbers, short and escaped strings are written
+ * to the buffer, long escape-free strings are referenced directly. The
+ * segments are recorded as offsets because the buffer may move while growing.
+ */
 
-	return string;
+// shorter strings are copied; an extra iovec would cost more than the copy
+#define JSON_IOV_MIN_STRING_LENGTH (128)
+
+struct jsonIovSegment {
+	// NULL for segments in the side buffer
+	const char* base;
+	size_t offset;
+	size_t length;
+};
+
+struct jsonIovList {
+	size_t size;
+	size_t capacity;
+	struct jsonIovSegment* segments;
+	// start of the current (open) segment in the side buffer
+	size_t start;
+};
+
+static void json_iov_add(jsonBuffer_t* buffer, const char* base, size_t offset, size_t length) {
+	struct jsonIovList* list = buffer->iov;
+	
+	if (length == 0 || buffer->failed)
+		return;
+	
+	if (list->size == list->capacity) {
+		size_t capacity = list->capacity > 0 ? list->capacity * 2 : 16;
+		struct jsonIovSegment* segments = json_realloc(list->segments, sizeof(struct jsonIovSegment) * capacity);
+		if (segments == NULL) {
+			buffer->failed = true;
+			return;
+		}
+		list->segments = segments;
+		list->capacity = capacity;
+	}
+	
+	list->segments[list->size++] = (struct jsonIovSegment) {
+		.base = base,
+		.offset = offset,
+		.length = length,
+	};
+}
+
+static void json_iov_write_string(jsonBuffer_t* buffer, const char* string) {
+	size_t length = strlen(string);
+	
+	if (length < JSON_IOV_MIN_STRING_LENGTH || json_escape_next(string, length) != length) {
+		json_write_string(buffer, string);
+		return;
+	}
+	
+	json_buffer_put(buffer, '"');
+	
+	struct jsonIovList* list = buffer->iov;
+	json_iov_add(buffer, NULL, list->start, buffer->length - list->start);
+	json_iov_add(buffer, string, 0, length);
+	list->start = buffer->length;
+	
+	json_buffer_put(buffer, '"');
+}
+
+int json_stringify_iov(jsonValue_t* value, struct iovec** iov, int* count) {
+	struct jsonIovList list = {
+		.size = 0,
+		.capacity = 0,
+		.segments = NULL,
+		.start = 0,
+	};
+	
+	jsonBuffer_t buffer;
+	if (json_buffer_init(&buffer, JSON_BUFFER_INITIAL_CAPACITY) < 0)
+		return -1;
+	buffer.stringWriter = &json_iov_write_string;
+	buffer.iov = &list;
+	
+	json_stringify_r(&buffer, value);
+	
+	json_iov_add(&buffer, NULL, list.start, buffer.length - list.start);
+	
+	// the iovec array and the side buffer share one allocation
+	struct iovec* result = NULL;
+	if (!buffer.failed && list.size <= INT_MAX) {
+		result = json_alloc(sizeof(struct iovec) * list.size + buffer.length);
+	}
+	
+	if (result == NULL) {
+		json_dealloc(list.segments);
+		json_buffer_destroy(&buffer);
+		return -1;
+	}
+	
+	char* side = (char*) (result + list.size);
+	memcpy(side, buffer.data, buffer.length);
+	
+	for (size_t i = 0; i < list.size; i++) {
+		struct jsonIovSegment* segment = &list.segments[i];
+		result[i].iov_base = (void*) ((segment->base != NULL ? segment->base : side) + segment->offset);
+		result[i].iov_len = segment->length;
+	}
+	
+	*iov = result;
+	*count = list.size;
+	
+	json_dealloc(list.segments);
+	json_buffer_destroy(&buffer);
+	
+	return 0;
 }
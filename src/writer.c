@@ -0,0 +1,270 @@
+#include <stdlib.h>
+#include <stdbool.h>
+
+#include "json.h"
+#include "alloc.h"
+#include "buffer.h"
+
+extern void json_stringify_r(jsonBuffer_t* buffer, jsonValue_t* value);
+extern void json_write_string(jsonBuffer_t* buffer, const char* source);
+extern void json_write_double(jsonBuffer_t* buffer, double value);
+extern void json_write_long(jsonBuffer_t* buffer, long long value);
+
+/*
+ * Streaming writer: Values are written directly into the output buffer
+ * without building a tree. The writer keeps a stack with the state of every
+ * open container to insert commas and to reject invalid sequences (e.g. a
+ * value in an object without a key). Errors are sticky; once a call failed
+ * all further calls fail as well.
+ */
+
+#define JSON_WRITER_OBJECT  (1 << 0)
+// the container has at least one entry
+#define JSON_WRITER_ENTRIES (1 << 1)
+// a key was written; the object expects a value
+#define JSON_WRITER_KEY     (1 << 2)
+
+#define JSON_WRITER_INITIAL_DEPTH (16)
+
+struct jsonWriter {
+	jsonBuffer_t buffer;
+	unsigned char* stack;
+	size_t depth;
+	size_t capacity;
+	// a complete top-level value was written
+	bool done;
+	bool failed;
+};
+
+static jsonWriter_t* json_writer_create() {
+	jsonWriter_t* writer = json_alloc(sizeof(jsonWriter_t));
+	if (writer == NULL)
+		return NULL;
+	
+	writer->stack = json_alloc(JSON_WRITER_INITIAL_DEPTH);
+	if (writer->stack == NULL) {
+		json_dealloc(writer);
+		return NULL;
+	}
+	writer->depth = 0;
+	writer->capacity = JSON_WRITER_INITIAL_DEPTH;
+	writer->done = false;
+	writer->failed = false;
+	
+	return writer;
+}
+
+static void json_writer_destroy(jsonWriter_t* writer) {
+	json_buffer_destroy(&writer->buffer);
+	json_dealloc(writer->stack);
+	json_dealloc(writer);
+}
+
+jsonWriter_t* json_writer_new() {
+	jsonWriter_t* writer = json_writer_create();
+	if (writer == NULL)
+		return NULL;
+	
+	if (json_buffer_init(&writer->buffer, JSON_BUFFER_INITIAL_CAPACITY) < 0) {
+		json_writer_destroy(writer);
+		return NULL;
+	}
+	
+	return writer;
+}
+
+jsonWriter_t* json_writer_new_sink(jsonWriteFunction_t write, void* context) {
+	jsonWriter_t* writer = json_writer_create();
+	if (writer == NULL)
+		return NULL;
+	
+	if (json_buffer_init_sink(&writer->buffer, JSON_BUFFER_STREAM_CAPACITY, write, context) < 0) {
+		json_writer_destroy(writer);
+		return NULL;
+	}
+	
+	return writer;
+}
+
+static int json_writer_fail(jsonWriter_t* writer) {
+	writer->failed = true;
+	return -1;
+}
+
+// checks that a value may be written at the current position and writes the separator
+static int json_writer_before_value(jsonWriter_t* writer) {
+	if (writer->failed || writer->buffer.failed)
+		return json_writer_fail(writer);
+	
+	if (writer->depth == 0) {
+		if (writer->done)
+			return json_writer_fail(writer);
+		return 0;
+	}
+	
+	unsigned char* state = &writer->stack[writer->depth - 1];
+	
+	if (*state & JSON_WRITER_OBJECT) {
+		if (!(*state & JSON_WRITER_KEY))
+			return json_writer_fail(writer);
+		*state &= ~JSON_WRITER_KEY;
+	} else {
+		if (*state & JSON_WRITER_ENTRIES)
+			json_buffer_put(&writer->buffer, ',');
+		*state |= JSON_WRITER_ENTRIES;
+	}
+	
+	return 0;
+}
+
+static int json_writer_after_value(jsonWriter_t* writer) {
+	if (writer->depth == 0)
+		writer->done = true;
+	
+	if (writer->buffer.failed)
+		return json_writer_fail(writer);
+	
+	return 0;
+}
+
+static int json_writer_begin(jsonWriter_t* writer, unsigned char state, char c) {
+	if (json_writer_before_value(writer) < 0)
+		return -1;
+	
+	if (writer->depth == writer->capacity) {
+		size_t capacity = writer->capacity * 2;
+		unsigned char* stack = json_realloc(writer->stack, capacity);
+		if (stack == NULL)
+			return json_writer_fail(writer);
+		writer->stack = stack;
+		writer->capacity = capacity;
+	}
+	
+	writer->stack[writer->depth++] = state;
+	json_buffer_put(&writer->buffer, c);
+	
+	return 0;
+}
+
+static int json_writer_end(jsonWriter_t* writer, unsigned char state, char c) {
+	if (writer->failed || writer->depth == 0)
+		return json_writer_fail(writer);
+	
+	unsigned char top = writer->stack[writer->depth - 1];
+	if ((top & JSON_WRITER_OBJECT) != state || (top & JSON_WRITER_KEY))
+		return json_writer_fail(writer);
+	
+	writer->depth--;
+	json_buffer_put(&writer->buffer, c);
+	
+	return json_writer_after_value(writer);
+}
+
+int json_writer_begin_object(jsonWriter_t* writer) {
+	return json_writer_begin(writer, JSON_WRITER_OBJECT, '{');
+}
+
+int json_writer_end_object(jsonWriter_t* writer) {
+	return json_writer_end(writer, JSON_WRITER_OBJECT, '}');
+}
+
+int json_writer_begin_array(jsonWriter_t* writer) {
+	return json_writer_begin(writer, 0, '[');
+}
+
+int json_writer_end_array(jsonWriter_t* writer) {
+	return json_writer_end(writer, 0, ']');
+}
+
+int json_writer_key(jsonWriter_t* writer, const char* key) {
+	if (writer->failed || writer->depth == 0 || key == NULL)
+		return json_writer_fail(writer);
+	
+	unsigned char* state = &writer->stack[writer->depth - 1];
+	if (!(*state & JSON_WRITER_OBJECT) || (*state & JSON_WRITER_KEY))
+		return json_writer_fail(writer);
+	
+	if (*state & JSON_WRITER_ENTRIES)
+		json_buffer_put(&writer->buffer, ',');
+	*state |= JSON_WRITER_ENTRIES | JSON_WRITER_KEY;
+	
+	json_write_string(&writer->buffer, key);
+	json_buffer_put(&writer->buffer, ':');
+	
+	if (writer->buffer.failed)
+		return json_writer_fail(writer);
+	
+	return 0;
+}
+
+int json_writer_string(jsonWriter_t* writer, const char* string) {
+	if (string == NULL)
+		return json_writer_fail(writer);
+	if (json_writer_before_value(writer) < 0)
+		return -1;
+	json_write_string(&writer->buffer, string);
+	return json_writer_after_value(writer);
+}
+
+int json_writer_long(jsonWriter_t* writer, long long value) {
+	if (json_writer_before_value(writer) < 0)
+		return -1;
+	json_write_long(&writer->buffer, value);
+	return json_writer_after_value(writer);
+}
+
+int json_writer_double(jsonWriter_t* writer, double value) {
+	if (json_writer_before_value(writer) < 0)
+		return -1;
+	json_write_double(&writer->buffer, value);
+	return json_writer_after_value(writer);
+}
+
+int json_writer_bool(jsonWriter_t* writer, bool value) {
+	if (json_writer_before_value(writer) < 0)
+		return -1;
+	if (value) {
+		json_buffer_write(&writer->buffer, "true", 4);
+	} else {
+		json_buffer_write(&writer->buffer, "false", 5);
+	}
+	return json_writer_after_value(writer);
+}
+
+int json_writer_null(jsonWriter_t* writer) {
+	if (json_writer_before_value(writer) < 0)
+		return -1;
+	json_buffer_write(&writer->buffer, "null", 4);
+	return json_writer_after_value(writer);
+}
+
+int json_writer_value(jsonWriter_t* writer, jsonValue_t* value) {
+	if (value == NULL)
+		return json_writer_fail(writer);
+	if (json_writer_before_value(writer) < 0)
+		return -1;
+	json_stringify_r(&writer->buffer, value);
+	return json_writer_after_value(writer);
+}
+
+char* json_writer_finish(jsonWriter_t* writer) {
+	char* string = NULL;
+	
+	if (!writer->failed && writer->done && writer->buffer.write == NULL)
+		string = json_buffer_finish(&writer->buffer);
+	
+	json_writer_destroy(writer);
+	
+	return string;
+}
+
+int json_writer_close(jsonWriter_t* writer) {
+	int result = -1;
+	
+	if (!writer->failed && writer->done)
+		result = json_buffer_flush(&writer->buffer);
+	
+	json_writer_destroy(writer);
+	
+	return result;
+}
@@ -4,6 +4,8 @@
 #include <errno.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <math.h>
+#include <pthread.h>
 
 #include <json.h>
 
@@ -19,7 +21,7 @@ void checkBool(bool ok, const char* check) {
 		result = "[FAILED]";
 		global = false;
 	}
-
+	
 	printf("%s:%*s%s\n", check, (int) (30 - strlen(check)), "", result);
 }
 void checkInt(long long value, long long compare, const char* check) {
@@ -44,7 +46,7 @@ void showError() {
 
 /*bool hasData(int fd) {
 	int tmp = poll(&(struct pollfd){ .fd = fd, .events = POLLIN }, 1, 10);
-
+	
 	return tmp == 1;
 }*/
 
@@ -78,11 +80,7 @@ void testDouble() {
 	
 	char* string = json_stringify(v);
 	
-	size_t size = snprintf(NULL, 0, "%lf", d);
-	char* compare = alloca(size + 1);
-	sprintf(compare, "%lf", d);
-	
-	checkString(string, compare, "stringify");
+	checkString(string, "3.1415926", "stringify");
 	
 	free(string);
 	json_free(v);
@@ -145,6 +143,73 @@ void testBool() {
 	json_free(v);
 }
 
+void testNumberFormat() {
+	struct {
+		double value;
+		const char* string;
+	} doubles[] = {
+		{ 0.0, "0.0" },
+		{ -0.0, "-0.0" },
+		{ 1.0, "1.0" },
+		{ 0.1, "0.1" },
+		{ -2.5, "-2.5" },
+		{ 1e21, "1e+21" },
+		{ 1.5e-7, "1.5e-7" },
+		{ 0.001, "0.001" },
+		{ 123456789012345.0, "123456789012345.0" },
+		{ 5e-324, "5e-324" },
+		{ 1.7976931348623157e308, "1.7976931348623157e+308" },
+	};
+	
+	for (size_t i = 0; i < sizeof(doubles) / sizeof(doubles[0]); i++) {
+		jsonValue_t* v = json_double(doubles[i].value);
+		char* string = json_stringify(v);
+		checkString(string, doubles[i].string, doubles[i].string);
+		free(string);
+		json_free(v);
+	}
+	
+	long long longs[] = { 0, 7, -42, 1000000, 9223372036854775807LL, -9223372036854775807LL - 1 };
+	for (size_t i = 0; i < sizeof(longs) / sizeof(longs[0]); i++) {
+		char compare[32];
+		sprintf(compare, "%lld", longs[i]);
+		
+		jsonValue_t* v = json_long(0);
+		v->value.integer = longs[i];
+		char* string = json_stringify(v);
+		checkString(string, compare, compare);
+		free(string);
+		json_free(v);
+	}
+	
+	// property: every finite double survives a round trip
+	srand(1337);
+	size_t failures = 0;
+	for (size_t i = 0; i < 100000; i++) {
+		unsigned long long bits = 0;
+		for (size_t j = 0; j < 4; j++) {
+			bits = (bits << 16) ^ (rand() & 0xFFFF);
+		}
+		
+		double d;
+		memcpy(&d, &bits, sizeof(d));
+		if (!isfinite(d))
+			continue;
+		
+		jsonValue_t* v = json_double(d);
+		char* string = json_stringify(v);
+		jsonValue_t* parsed = json_parse(string);
+		
+		if (parsed == NULL || parsed->type != JSON_DOUBLE || memcmp(&parsed->value.real, &d, sizeof(d)) != 0)
+			failures++;
+		
+		json_free(parsed);
+		free(string);
+		json_free(v);
+	}
+	checkInt(failures, 0, "random round trip");
+}
+
 void testString() {
 	const char* s = "foobar";
 	
@@ -164,6 +229,59 @@ void testString() {
 	json_free(v);
 }
 
+static size_t escapeReference(char* target, const char* source) {
+	size_t size = 0;
+	target[size++] = '"';
+	for (size_t i = 0; source[i] != '\0'; i++) {
+		const char* escape = strchr("\\\\\"\"//\bb\ff\nn\rr\tt", source[i]);
+		if (escape != NULL && (escape - "\\\\\"\"//\bb\ff\nn\rr\tt") % 2 == 0) {
+			target[size++] = '\\';
+			target[size++] = escape[1];
+		} else {
+			target[size++] = source[i];
+		}
+	}
+	target[size++] = '"';
+	target[size] = '\0';
+	return size;
+}
+
+void testStringEscape() {
+	const char special[] = "\\\"/\b\f\n\r\t\x01\x0b\x7f\xc3\xa4";
+	char source[100];
+	char compare[2 * sizeof(source) + 3];
+	size_t failures = 0;
+	
+	// every special character at every position of strings up to 70 bytes
+	for (size_t length = 0; length < 70; length++) {
+		for (size_t position = 0; position <= length; position++) {
+			for (size_t k = 0; k < sizeof(special) - 1; k++) {
+				memset(source, 'a', length);
+				source[length] = '\0';
+				if (position < length)
+					source[position] = special[k];
+				
+				escapeReference(compare, source);
+				
+				jsonValue_t* v = json_string(source);
+				char* string = json_stringify(v);
+				if (strcmp(string, compare) != 0)
+					failures++;
+				free(string);
+				json_free(v);
+			}
+		}
+	}
+	
+	checkInt(failures, 0, "all positions");
+	
+	jsonValue_t* v = json_string("path/to\\file \"x\"\n");
+	char* string = json_stringify(v);
+	checkString(string, "\"path\\/to\\\\file \\\"x\\\"\\n\"", "mixed escapes");
+	free(string);
+	json_free(v);
+}
+
 void testNull() {
 	jsonValue_t* v = json_null();
 	
@@ -202,8 +320,7 @@ void testArray() {
 	checkInt(value->value.array.entries[3].type, JSON_OBJECT, "[3] type is correct");
 	
 	char* string = json_stringify(value);
-	// the two zeros are technically not wrong but kinda hard to remove => let's keep them
-	char* compare = "[\"Hello\",\"World\",null,{\"okay\":true,\"pi\":3.141500,\"leet\":1337}]";
+	char* compare = "[\"Hello\",\"World\",null,{\"okay\":true,\"pi\":3.1415,\"leet\":1337}]";
 	
 	checkString(string, compare, "stringify");
 	
@@ -236,7 +353,7 @@ void testObject() {
 	checkInt(value->value.object.entries[2].value.type, JSON_ARRAY, "[2] type is correct");
 	
 	char* string = json_stringify(value);
-	char* compare = "{\"foo\":\"bar\",\"number\":42,\"list\":[true,3.141500,null]}";
+	char* compare = "{\"foo\":\"bar\",\"number\":42,\"list\":[true,3.1415,null]}";
 	
 	checkString(string, compare, "stringify");
 	
@@ -244,6 +361,349 @@ void testObject() {
 	json_free(value);
 }
 
+void testStringifyLarge() {
+	jsonValue_t* value = json_object(true, 2,
+		"empty", json_array(true, 0),
+		"nested", json_object(true, 0)
+	);
+	
+	char* string = json_stringify(value);
+	checkString(string, "{\"empty\":[],\"nested\":{}}", "empty containers");
+	free(string);
+	json_free(value);
+	
+	size_t size = 10000;
+	jsonValue_t** values = malloc(sizeof(jsonValue_t*) * size);
+	for (size_t i = 0; i < size; i++) {
+		values[i] = json_string("a\"b");
+	}
+	value = json_array_direct(true, size, values);
+	free(values);
+	
+	string = json_stringify(value);
+	checkInt(strlen(string), size * 7 + 1, "buffer growth, length");
+	checkBool(strncmp(string, "[\"a\\\"b\",\"a", 10) == 0, "buffer growth, content");
+	checkInt(string[strlen(string) - 1], ']', "buffer growth, end");
+	free(string);
+	json_free(value);
+}
+
+struct collector {
+	char* data;
+	size_t length;
+	size_t calls;
+	size_t maxChunk;
+};
+
+int collect(void* context, const char* data, size_t length) {
+	struct collector* collector = context;
+	collector->data = realloc(collector->data, collector->length + length + 1);
+	memcpy(collector->data + collector->length, data, length);
+	collector->length += length;
+	collector->data[collector->length] = '\0';
+	collector->calls++;
+	if (length > collector->maxChunk)
+		collector->maxChunk = length;
+	return 0;
+}
+
+int failingSink(void* context, const char* data, size_t length) {
+	return -1;
+}
+
+void testStringifyStream() {
+	size_t size = 50000;
+	jsonValue_t** values = malloc(sizeof(jsonValue_t*) * size);
+	for (size_t i = 0; i < size; i++) {
+		values[i] = json_object(true, 2,
+			"id", json_long(i),
+			"name", json_string("foo/bar")
+		);
+	}
+	jsonValue_t* value = json_array_direct(true, size, values);
+	free(values);
+	
+	char* compare = json_stringify(value);
+	
+	struct collector collector = { 0 };
+	checkInt(json_stringify_to(value, &collect, &collector), 0, "callback, okay");
+	checkBool(collector.calls > 1, "callback, flushed in chunks");
+	checkBool(collector.maxChunk <= 64 * 1024, "callback, bounded chunks");
+	checkString(collector.data, compare, "callback, same output");
+	free(collector.data);
+	
+	FILE* file = tmpfile();
+	checkInt(json_stringify_to_file(value, file), 0, "file, okay");
+	checkInt(ftell(file), strlen(compare), "file, length");
+	fclose(file);
+	
+	file = tmpfile();
+	checkInt(json_stringify_to_fd(value, fileno(file)), 0, "fd, okay");
+	char* read = malloc(strlen(compare) + 1);
+	rewind(file);
+	size_t length = fread(read, 1, strlen(compare), file);
+	read[length] = '\0';
+	checkString(read, compare, "fd, same output");
+	free(read);
+	fclose(file);
+	
+	checkInt(json_stringify_to(value, &failingSink, NULL), -1, "failing sink");
+	
+	free(compare);
+	json_free(value);
+}
+
+void testStringifyIov() {
+	char longString[300];
+	memset(longString, 'x', sizeof(longString) - 1);
+	longString[sizeof(longString) - 1] = '\0';
+	
+	char escapedString[300];
+	memset(escapedString, 'y', sizeof(escapedString) - 1);
+	escapedString[sizeof(escapedString) - 1] = '\0';
+	escapedString[100] = '"';
+	
+	jsonValue_t* value = json_object(true, 4,
+		"long", json_string(longString),
+		"escaped", json_string(escapedString),
+		"short", json_string("foo"),
+		"list", json_array(true, 2, json_long(42), json_string(longString))
+	);
+	
+	struct iovec* iov;
+	int count;
+	checkInt(json_stringify_iov(value, &iov, &count), 0, "okay");
+	checkInt(count, 5, "iovec count");
+	checkVoid(iov[1].iov_base, value->value.object.entries[0].value.value.string, "string referenced");
+	checkInt(iov[1].iov_len, strlen(longString), "referenced length");
+	
+	char* compare = json_stringify(value);
+	
+	FILE* file = tmpfile();
+	checkInt(writev(fileno(file), iov, count), strlen(compare), "writev");
+	char* read = malloc(strlen(compare) + 1);
+	rewind(file);
+	size_t length = fread(read, 1, strlen(compare), file);
+	read[length] = '\0';
+	checkString(read, compare, "same output");
+	free(read);
+	fclose(file);
+	
+	free(compare);
+	free(iov);
+	json_free(value);
+}
+
+void testStringifyBuffer() {
+	jsonValue_t* value = json_object(true, 4,
+		"name", json_string("a/b\"c"),
+		"pi", json_double(3.1415),
+		"list", json_array(true, 3, json_long(-1337), json_bool(false), json_null()),
+		"empty", json_object(true, 0)
+	);
+	
+	char* compare = json_stringify(value);
+	size_t length = strlen(compare);
+	
+	checkInt(json_stringify_length(value), length, "exact length");
+	
+	char buffer[256];
+	size_t needed = 0;
+	
+	checkInt(json_stringify_buf(value, buffer, sizeof(buffer), &needed), 0, "large buffer, okay");
+	checkString(buffer, compare, "large buffer, output");
+	checkInt(needed, length + 1, "large buffer, used");
+	
+	size_t failures = 0;
+	for (size_t capacity = 0; capacity <= length + 1; capacity++) {
+		needed = 0;
+		int result = json_stringify_buf(value, buffer, capacity, &needed);
+		if (capacity <= length && (result != -1 || needed != length + 1))
+			failures++;
+		if (capacity == length + 1 && (result != 0 || strcmp(buffer, compare) != 0))
+			failures++;
+	}
+	checkInt(failures, 0, "every capacity");
+	
+	free(compare);
+	json_free(value);
+}
+
+void testStringifyParallel() {
+	size_t size = 20000;
+	jsonValue_t** values = malloc(sizeof(jsonValue_t*) * size);
+	for (size_t i = 0; i < size; i++) {
+		values[i] = json_object(true, 3,
+			"id", json_long(i),
+			"name", json_string("a/b\"c"),
+			"tags", json_array(true, 2, json_double(i / 8.0), json_null())
+		);
+	}
+	jsonValue_t* value = json_object(true, 3,
+		"head", json_string("foo"),
+		"items", json_array_direct(true, size, values),
+		"tail", json_array(true, 0)
+	);
+	free(values);
+	
+	char* compare = json_stringify(value);
+	
+	char* string = json_stringify_parallel(value, 4);
+	checkString(string, compare, "4 threads, same output");
+	free(string);
+	
+	string = json_stringify_parallel(value, 1);
+	checkString(string, compare, "1 thread, same output");
+	free(string);
+	
+	struct collector collector = { 0 };
+	checkInt(json_stringify_parallel_to(value, 3, &collect, &collector), 0, "callback, okay");
+	checkString(collector.data, compare, "callback, same output");
+	free(collector.data);
+	
+	checkInt(json_stringify_parallel_to(value, 3, &failingSink, NULL), -1, "failing sink");
+	
+	jsonValue_t* small = json_array(true, 3, json_long(1), json_string("x"), json_object(true, 0));
+	string = json_stringify_parallel(small, 8);
+	checkString(string, "[1,\"x\",{}]", "small, serial");
+	free(string);
+	json_free(small);
+	
+	free(compare);
+	json_free(value);
+}
+
+void testWriter() {
+	jsonWriter_t* writer = json_writer_new();
+	json_writer_begin_object(writer);
+	json_writer_key(writer, "name");
+	json_writer_string(writer, "a/b\"c");
+	json_writer_key(writer, "list");
+	json_writer_begin_array(writer);
+	json_writer_long(writer, -1337);
+	json_writer_double(writer, 3.1415);
+	json_writer_bool(writer, false);
+	json_writer_null(writer);
+	json_writer_begin_object(writer);
+	json_writer_end_object(writer);
+	json_writer_end_array(writer);
+	json_writer_key(writer, "value");
+	jsonValue_t* value = json_array(true, 2, json_bool(true), json_string("x"));
+	json_writer_value(writer, value);
+	json_free(value);
+	checkInt(json_writer_end_object(writer), 0, "okay");
+	char* string = json_writer_finish(writer);
+	checkString(string, "{\"name\":\"a\\/b\\\"c\",\"list\":[-1337,3.1415,false,null,{}],\"value\":[true,\"x\"]}", "output");
+	free(string);
+	
+	writer = json_writer_new();
+	json_writer_begin_object(writer);
+	checkInt(json_writer_long(writer, 1), -1, "value without key");
+	checkInt(json_writer_key(writer, "a"), -1, "sticky error");
+	checkBool(json_writer_finish(writer) == NULL, "failed writer");
+	
+	writer = json_writer_new();
+	json_writer_begin_array(writer);
+	checkInt(json_writer_end_object(writer), -1, "mismatched end");
+	checkBool(json_writer_finish(writer) == NULL, "mismatched end, no output");
+	
+	writer = json_writer_new();
+	json_writer_begin_array(writer);
+	checkBool(json_writer_finish(writer) == NULL, "incomplete document");
+	
+	writer = json_writer_new();
+	json_writer_long(writer, 1);
+	checkInt(json_writer_long(writer, 2), -1, "second top-level value");
+	json_writer_close(writer);
+	
+	writer = json_writer_new();
+	json_writer_begin_object(writer);
+	json_writer_key(writer, "a");
+	checkInt(json_writer_key(writer, "b"), -1, "key after key");
+	json_writer_close(writer);
+	
+	struct collector collector = { 0 };
+	writer = json_writer_new_sink(&collect, &collector);
+	json_writer_begin_array(writer);
+	for (size_t i = 0; i < 100; i++) {
+		json_writer_begin_array(writer);
+	}
+	for (size_t i = 0; i < 100; i++) {
+		json_writer_end_array(writer);
+	}
+	json_writer_end_array(writer);
+	checkInt(json_writer_close(writer), 0, "sink, okay");
+	checkInt(collector.length, 202, "sink, deep nesting");
+	free(collector.data);
+}
+
+void testCache() {
+	size_t size = 100;
+	jsonValue_t** values = malloc(sizeof(jsonValue_t*) * size);
+	for (size_t i = 0; i < size; i++) {
+		values[i] = json_object(true, 3,
+			"id", json_long(i),
+			"name", json_string("some longer name to pass the cache threshold"),
+			"tags", json_array(true, 2, json_double(i / 8.0), json_null())
+		);
+	}
+	jsonValue_t* value = json_object(true, 2,
+		"items", json_array_direct(true, size, values),
+		"small", json_array(true, 1, json_long(1))
+	);
+	free(values);
+	
+	char* compare = json_stringify(value);
+	checkInt(json_cache(value), 0, "okay");
+	jsonMemoryUsage_t usage;
+	json_memory_usage(value, &usage);
+	checkBool(usage.overhead > strlen(compare), "root cached");
+	json_memory_usage(&value->value.object.entries[1].value, &usage);
+	checkBool(usage.overhead < 32, "small container not cached");
+	
+	char* string = json_stringify(value);
+	checkString(string, compare, "cached output");
+	free(string);
+	free(compare);
+	
+	checkInt(json_set(value, ".items.[5].name", json_string("changed")), 0, "set, okay");
+	checkInt(json_set(value, ".items.[7].extra", json_bool(true)), 0, "set new key, okay");
+	checkInt(json_set(value, ".items.[100]", json_long(42)), 0, "set append, okay");
+	jsonValue_t* replacement = json_long(0);
+	checkInt(json_set(value, ".missing.[0]", replacement), -1, "set missing path");
+	checkInt(json_set(value, ".items.[*].id", replacement), -1, "set wildcard");
+	json_free(replacement);
+	
+	jsonValue_t* reference = json_clone(value);
+	compare = json_stringify(reference);
+	string = json_stringify(value);
+	checkString(string, compare, "after set");
+	checkInt(json_stringify_length(value), strlen(compare), "after set, length");
+	free(string);
+	free(compare);
+	json_free(reference);
+	
+	// direct modifications are not visible until the path is invalidated
+	value->value.object.entries[0].value.value.array.entries[3].value.object.entries[0].value.value.integer = 1337;
+	string = json_stringify(value);
+	checkBool(strstr(string, "1337") == NULL, "stale without invalidate");
+	free(string);
+	
+	checkInt(json_invalidate(value, ".items.[3].id"), 0, "invalidate, okay");
+	checkInt(json_invalidate(value, ".items.[1000]"), -1, "invalidate missing path");
+	string = json_stringify(value);
+	checkBool(strstr(string, "{\"id\":1337,") != NULL, "after invalidate");
+	free(string);
+	
+	json_uncache(value);
+	value->value.object.entries[0].value.value.array.entries[3].value.object.entries[0].value.value.integer = 4242;
+	string = json_stringify(value);
+	checkBool(strstr(string, "{\"id\":4242,") != NULL, "uncached");
+	free(string);
+	
+	json_free(value);
+}
+
 void testParse() {
 	jsonValue_t* value = json_parse("{ \"foo\": \"bar\", \"foobar\": [ 1337, 3.1415, null, false] }");
 	
@@ -273,6 +733,87 @@ void testParse() {
 	json_free(value);
 }
 
+void testParseSpans() {
+	const char* source = "{ \"a\" : 1.50, \"b\": [1, 2,  3], \"c\": {\"x\": \"a/b\"}, \"d\": 1e2 }";
+	jsonValue_t* value = json_parse_with(source, strlen(source), JSON_PARSE_SPANS);
+	checkNull(value, "okay");
+	
+	char* string = json_stringify(value);
+	checkString(string, source, "unmodified, original text");
+	free(string);
+	
+	jsonValue_t* unrelated = json_array(true, 0);
+	json_array_push(unrelated, json_long(1));
+	json_free(unrelated);
+	string = json_stringify(value);
+	checkString(string, source, "other document modified");
+	free(string);
+	
+	// storing caches keeps the source text of the containers
+	checkInt(json_cache(value), 0, "cache, okay");
+	unrelated = json_array(true, 0);
+	json_array_push(unrelated, json_long(1));
+	json_free(unrelated);
+	string = json_stringify(value);
+	checkString(string, source, "cached, original text");
+	free(string);
+	
+	checkInt(json_set(value, ".a", json_long(2)), 0, "set, okay");
+	string = json_stringify(value);
+	checkString(string, "{\"a\":2,\"b\":[1, 2,  3],\"c\":{\"x\": \"a/b\"},\"d\":1e2}", "set, unmodified parts copied");
+	checkInt(json_stringify_length(value), strlen(string), "set, length");
+	free(string);
+	
+	free(value->value.object.entries[2].value.value.object.entries[0].value.value.string);
+	value->value.object.entries[2].value.value.object.entries[0].value.value.string = strdup("new");
+	checkInt(json_invalidate(value, ".c.x"), 0, "invalidate, okay");
+	string = json_stringify(value);
+	checkString(string, "{\"a\":2,\"b\":[1, 2,  3],\"c\":{\"x\":\"new\"},\"d\":1e2}", "invalidate");
+	free(string);
+	
+	char* parallel = json_stringify_parallel(value, 2);
+	string = json_stringify(value);
+	checkString(parallel, string, "parallel");
+	free(parallel);
+	free(string);
+	
+	jsonValue_t* clone = json_clone(value);
+	string = json_stringify(clone);
+	checkString(string, "{\"a\":2,\"b\":[1,2,3],\"c\":{\"x\":\"new\"},\"d\":100.0}", "clone is serialized");
+	free(string);
+	json_free(clone);
+	
+	json_free(value);
+	
+	value = json_parse_with("42", 2, JSON_PARSE_SPANS);
+	checkInt(value->value.integer, 42, "scalar document");
+	json_free(value);
+	
+	checkBool(json_parse_with("[1, 2", 5, JSON_PARSE_SPANS) == NULL, "error");
+	
+	// large containers; every entry keeps its own text
+	size_t size = 1000;
+	char* large = malloc(size * 16);
+	char* expected = malloc(size * 16);
+	size_t length = sprintf(large, "[");
+	size_t expectedLength = sprintf(expected, "[");
+	for (size_t i = 0; i < size; i++) {
+		length += sprintf(large + length, "%s%zu.50 \t", i > 0 ? ",\n" : "", i);
+		expectedLength += sprintf(expected + expectedLength, i == 500 ? "%s7" : "%s%zu.50", i > 0 ? "," : "", i);
+	}
+	sprintf(large + length, "]");
+	sprintf(expected + expectedLength, "]");
+	
+	value = json_parse_with(large, strlen(large), JSON_PARSE_SPANS);
+	checkInt(json_set(value, ".[500]", json_long(7)), 0, "large, set");
+	string = json_stringify(value);
+	checkString(string, expected, "large, unmodified entries");
+	free(string);
+	json_free(value);
+	free(large);
+	free(expected);
+}
+
 void testQuery() {
 	jsonValue_t* value = json_array(true, 4,
 		json_string("Hello"),
@@ -311,6 +852,1156 @@ void testQuery() {
 	
 	json_free(tmp);
 	
+	// ".." was an empty segment that was skipped before recursive descent was added
+	tmp = json_query(value, ".[3]..leet");
+	checkNull(tmp, "double dot, not null");
+	checkInt(tmp->type, JSON_ARRAY, "double dot, descent");
+	checkInt(tmp->value.array.size, 1, "double dot, matches");
+	checkInt(tmp->value.array.entries[0].value.integer, 1337, "double dot, value");
+	json_free(tmp);
+	
+	json_free(value);
+}
+
+void testQueryMany() {
+	jsonValue_t* value = json_parse("{ \"payload\": { \"meta\": { \"id\": 42, \"name\": \"foo\" }, \"list\": [ 1, 2, 3 ] }, \"flag\": true }");
+	
+	const char* paths[] = {
+		".payload.meta.id",
+		".payload.meta.name",
+		".payload.list.[2]",
+		".flag",
+		".payload.missing",
+		".flag.foo",
+		".payload.meta.id",
+	};
+	size_t n = sizeof(paths) / sizeof(paths[0]);
+	
+	jsonQuery_t* queries[n];
+	jsonValue_t* results[n];
+	
+	for (size_t i = 0; i < n; i++) {
+		queries[i] = json_query_compile(paths[i]);
+	}
+	
+	checkInt(json_query_many(value, queries, n, results), 0, "query many");
+	
+	checkInt(results[0]->type, JSON_LONG, "shared prefix, type");
+	checkInt(results[0]->value.integer, 42, "shared prefix, value");
+	checkString(results[1]->value.string, "foo", "sibling key, value");
+	checkInt(results[2]->value.integer, 3, "array index, value");
+	checkBool(results[3]->value.boolean, "top level, value");
+	checkInt(results[4]->type, JSON_NULL, "missing key, type");
+	checkBool(results[5] == NULL, "structure mismatch");
+	checkInt(results[6]->value.integer, 42, "duplicate query, value");
+	
+	for (size_t i = 0; i < n; i++) {
+		json_free(results[i]);
+		json_query_free(queries[i]);
+	}
+	
+	checkBool(json_query_compile("foo") == NULL, "invalid query");
+	
+	json_free(value);
+}
+
+void testQueryIterator() {
+	jsonValue_t* value = json_parse("{ \"items\": [ { \"id\": 1, \"price\": 5 }, { \"id\": 2, \"price\": 12.5 }, { \"id\": 3, \"price\": 20, \"sub\": { \"id\": 4 } } ] }");
+	
+	jsonQuery_t* query;
+	jsonQueryIterator_t* iterator;
+	jsonValue_t* tmp;
+	long long sum;
+	size_t count;
+	
+	query = json_query_compile(".items.[*].price");
+	checkNull(query, "wildcard, compiles");
+	iterator = json_query_iterate(value, query);
+	sum = 0;
+	count = 0;
+	while ((tmp = json_query_next(iterator)) != NULL) {
+		sum += tmp->type == JSON_LONG ? tmp->value.integer : (long long) tmp->value.real;
+		count++;
+	}
+	checkInt(count, 3, "wildcard, count");
+	checkInt(sum, 37, "wildcard, values");
+	json_query_iterator_free(iterator);
+	json_query_free(query);
+	
+	query = json_query_compile("..id");
+	iterator = json_query_iterate(value, query);
+	sum = 0;
+	count = 0;
+	while ((tmp = json_query_next(iterator)) != NULL) {
+		sum = sum * 10 + tmp->value.integer;
+		count++;
+	}
+	checkInt(count, 4, "descent, count");
+	checkInt(sum, 1234, "descent, document order");
+	json_query_iterator_free(iterator);
+	json_query_free(query);
+	
+	tmp = json_query(value, ".items.[1:].id");
+	checkInt(tmp->type, JSON_ARRAY, "slice, type");
+	checkInt(tmp->value.array.size, 2, "slice, size");
+	checkInt(tmp->value.array.entries[0].value.integer, 2, "slice, first value");
+	json_free(tmp);
+	
+	tmp = json_query(value, ".items.[-1:].id");
+	checkInt(tmp->value.array.size, 1, "negative slice, size");
+	checkInt(tmp->value.array.entries[0].value.integer, 3, "negative slice, value");
+	json_free(tmp);
+	
+	tmp = json_query(value, ".items.[-10:-2].id");
+	checkInt(tmp->value.array.size, 1, "negative slice, clamped");
+	checkInt(tmp->value.array.entries[0].value.integer, 1, "negative slice, clamped value");
+	json_free(tmp);
+	
+	tmp = json_query(value, ".items.[?(.price >= 12.5)].id");
+	checkInt(tmp->value.array.size, 2, "filter, size");
+	checkInt(tmp->value.array.entries[0].value.integer, 2, "filter, first value");
+	json_free(tmp);
+	
+	tmp = json_query(value, ".items.[?(.sub)].id");
+	checkInt(tmp->value.array.size, 1, "exists filter, size");
+	checkInt(tmp->value.array.entries[0].value.integer, 3, "exists filter, value");
+	json_free(tmp);
+	
+	tmp = json_query(value, ".items.[?(.id == \"foo\")]");
+	checkInt(tmp->value.array.size, 0, "no match, size");
+	json_free(tmp);
+	
+	checkBool(json_query_compile(".[?(.a.[*] > 1)]") == NULL, "multi filter path");
+	checkBool(json_query_compile(".[1:x]") == NULL, "invalid slice");
+	
+	json_free(value);
+}
+
+void testQueryText() {
+	const char* text = "{ \"skip\": { \"a\": [1, \"]}\\\"\", {}] }, \"payload\" : { \"list\": [ true, \"x\", { \"id\": 42 } ], \"a\\/b\": null } }";
+	size_t length = strlen(text);
+	
+	jsonQuery_t* query;
+	jsonSpan_t span;
+	
+	query = json_query_compile(".payload.list.[2].id");
+	checkInt(json_query_text(text, length, query, &span), 0, "nested, found");
+	checkBool(span.length == 2 && strncmp(text + span.offset, "42", 2) == 0, "nested, span");
+	json_query_free(query);
+	
+	query = json_query_compile(".payload.list");
+	checkInt(json_query_text(text, length, query, &span), 0, "container, found");
+	checkBool(span.length == 27 && text[span.offset] == '[' && text[span.offset + span.length - 1] == ']', "container, span");
+	
+	jsonValue_t* value = json_query_text_value(text, length, query);
+	checkNull(value, "parsed value, not null");
+	checkInt(value->value.array.size, 3, "parsed value, size");
+	json_free(value);
+	json_query_free(query);
+	
+	query = json_query_compile(".payload.a/b");
+	checkInt(json_query_text(text, length, query, &span), 0, "escaped key, found");
+	json_query_free(query);
+	
+	query = json_query_compile(".payload.missing");
+	checkInt(json_query_text(text, length, query, &span), -1, "missing key");
+	json_query_free(query);
+	
+	query = json_query_compile(".skip.a.[5]");
+	checkInt(json_query_text(text, length, query, &span), -1, "index out of range");
+	json_query_free(query);
+}
+
+void testColumns() {
+	jsonValue_t* value = json_parse("[ { \"id\": 1, \"price\": 5, \"name\": \"foo\", \"ok\": true }, { \"name\": \"bar\", \"price\": 2.5, \"id\": 2 }, 42, { \"id\": 3, \"price\": null, \"name\": \"baz\", \"ok\": false } ]");
+	
+	const char* fields[] = { "id", "price", "name", "ok", "missing" };
+	jsonColumn_t* columns;
+	
+	checkInt(json_array_to_columns(value, fields, 5, &columns), 0, "extraction");
+	
+	checkInt(columns[0].type, JSON_LONG, "long column, type");
+	checkInt(columns[0].values.integers[1], 2, "long column, value");
+	checkBool(json_column_is_null(&columns[0], 2), "non-object row, null");
+	checkInt(columns[0].values.integers[3], 3, "long column, last value");
+	
+	checkInt(columns[1].type, JSON_DOUBLE, "promoted column, type");
+	checkDouble(columns[1].values.reals[0], 5, "promoted column, value");
+	checkDouble(columns[1].values.reals[1], 2.5, "double column, value");
+	checkBool(json_column_is_null(&columns[1], 3), "null value, null");
+	checkBool(!json_column_is_null(&columns[1], 1), "value, not null");
+	
+	checkInt(columns[2].type, JSON_STRING, "string column, type");
+	checkString(columns[2].data + columns[2].offsets[1], "bar", "string column, value");
+	checkString(columns[2].data + columns[2].offsets[3], "baz", "string column, after null");
+	
+	checkInt(columns[3].type, JSON_BOOL, "bool column, type");
+	checkBool(json_column_is_null(&columns[3], 1), "missing key, null");
+	checkBool(!columns[3].values.booleans[3], "bool column, value");
+	
+	checkInt(columns[4].type, JSON_NULL, "all null column, type");
+	
+	json_columns_free(columns, 5);
+	json_free(value);
+	
+	value = json_parse("[ { \"a\": 1 }, { \"a\": \"foo\" } ]");
+	const char* mixed[] = { "a" };
+	checkInt(json_array_to_columns(value, mixed, 1, &columns), -1, "mixed types");
+	json_free(value);
+}
+
+void testReduce() {
+	jsonValue_t* value = json_parse("[ 3, 1, 4, 1, 5, 9, 2, 6, 5 ]");
+	jsonReduction_t result;
+	
+	checkInt(json_array_reduce(value, JSON_REDUCE_ALL, &result), 0, "longs, okay");
+	checkInt(result.count, 9, "longs, count");
+	checkInt(result.sum.type, JSON_LONG, "longs, sum type");
+	checkInt(result.sum.value.integer, 36, "longs, sum");
+	checkInt(result.min.value.integer, 1, "longs, min");
+	checkInt(result.max.value.integer, 9, "longs, max");
+	checkDouble(result.mean, 4, "longs, mean");
+	json_free(value);
+	
+	value = json_parse("[ 0.5, -1.5, 2.25, 4.0, 1.75 ]");
+	checkInt(json_array_reduce(value, JSON_REDUCE_SUM, &result), 0, "doubles, okay");
+	checkInt(result.sum.type, JSON_DOUBLE, "doubles, sum type");
+	checkDouble(result.sum.value.real, 7, "doubles, sum");
+	checkInt(json_array_reduce(value, JSON_REDUCE_MIN | JSON_REDUCE_MAX, &result), 0, "doubles, okay");
+	checkDouble(result.min.value.real, -1.5, "doubles, min");
+	checkDouble(result.max.value.real, 4, "doubles, max");
+	json_free(value);
+	
+	value = json_parse("[ 1, 2.5, null, \"foo\", 3 ]");
+	checkInt(json_array_reduce(value, JSON_REDUCE_ALL, &result), 0, "mixed, okay");
+	checkInt(result.count, 3, "mixed, count");
+	checkDouble(result.sum.value.real, 6.5, "mixed, sum");
+	checkDouble(result.max.value.real, 3, "mixed, max");
+	json_free(value);
+	
+	value = json_parse("[]");
+	checkInt(json_array_reduce(value, JSON_REDUCE_ALL, &result), 0, "empty, okay");
+	checkInt(result.count, 0, "empty, count");
+	checkInt(result.min.type, JSON_NULL, "empty, min");
+	json_free(value);
+}
+
+struct counter {
+	size_t allocations;
+	size_t frees;
+};
+
+void* countingMalloc(void* context, size_t size) {
+	((struct counter*) context)->allocations++;
+	return malloc(size);
+}
+
+void* countingRealloc(void* context, void* pointer, size_t size) {
+	if (pointer == NULL)
+		((struct counter*) context)->allocations++;
+	return realloc(pointer, size);
+}
+
+void countingFree(void* context, void* pointer) {
+	if (pointer != NULL)
+		((struct counter*) context)->frees++;
+	free(pointer);
+}
+
+void testAllocator() {
+	const char* text = "{\"list\": [1, 2.5, \"foo\", null, true], \"object\": {\"a\": \"b\"}}";
+	
+	struct counter counter = { 0 };
+	json_set_allocator(&countingMalloc, &countingRealloc, &countingFree, &counter);
+	jsonValue_t* value = json_parse(text);
+	jsonValue_t* clone = json_clone(value);
+	char* string = json_stringify(clone);
+	json_free(clone);
+	json_free(value);
+	countingFree(&counter, string);
+	json_set_allocator(NULL, NULL, NULL, NULL);
+	
+	checkBool(counter.allocations > 10, "global, used");
+	checkInt(counter.allocations, counter.frees, "global, balanced");
+	
+	jsonPool_t* pool = json_pool_new();
+	json_set_thread_allocator(&json_pool_malloc, &json_pool_realloc, &json_pool_free, pool);
+	
+	value = json_parse(text);
+	string = json_stringify(value);
+	checkString(string, "{\"list\":[1,2.5,\"foo\",null,true],\"object\":{\"a\":\"b\"}}", "pool, output");
+	json_pool_free(pool, string);
+	json_free(value);
+	
+	size_t size = json_pool_size(pool);
+	checkBool(size > 0, "pool, used");
+	
+	for (size_t i = 0; i < 100; i++) {
+		value = json_parse(text);
+		json_free(value);
+	}
+	checkInt(json_pool_size(pool), size, "pool, memory is reused");
+	
+	jsonValue_t** values = malloc(sizeof(jsonValue_t*) * 5000);
+	for (size_t i = 0; i < 5000; i++) {
+		values[i] = json_string("a string that is longer than the largest size class of the pool, so it is passed to malloc directly; a string that is longer than the largest size class of the pool, so it is passed to malloc directly; a string that is longer than the largest size class of the pool, so it is passed to malloc directly");
+	}
+	value = json_array_direct(true, 5000, values);
+	free(values);
+	char* parallel = json_stringify_parallel(value, 4);
+	string = json_stringify(value);
+	checkString(parallel, string, "pool, parallel stringify");
+	json_pool_free(pool, parallel);
+	json_pool_free(pool, string);
+	json_free(value);
+	
+	json_set_thread_allocator(NULL, NULL, NULL, NULL);
+	json_pool_destroy(pool);
+}
+
+void* shareAndFree(void* argument) {
+	jsonValue_t* value = argument;
+	for (size_t i = 0; i < 10000; i++) {
+		json_free(json_share(&value->value.object.entries[0].value));
+	}
+	return NULL;
+}
+
+void testMemory() {
+	jsonAllocatorStats_t stats = { 0 };
+	json_set_thread_allocator(&json_stats_malloc, &json_stats_realloc, &json_stats_free, &stats);
+	
+	jsonValue_t* value = json_parse("{\"a\": [1, 2], \"b\": \"xyz\", \"c\": {\"d\": [true, null, 1.5]}}");
+	
+	jsonMemoryUsage_t usage;
+	size_t bytes = json_memory_usage(value, &usage);
+	checkInt(bytes, stats.bytes, "usage, matches allocator");
+	checkInt(usage.values, 10, "usage, values");
+	checkInt(usage.containers, 4, "usage, containers");
+	checkInt(usage.entries, 9, "usage, entries");
+	checkInt(usage.strings, 5, "usage, strings");
+	checkInt(usage.stringBytes, 12, "usage, string bytes");
+	checkInt(usage.slack, 0, "usage, no slack");
+	checkInt(sizeof(jsonValue_t), 24, "usage, value size");
+	
+	json_array_push(&value->value.object.entries[0].value, json_long(3));
+	json_memory_usage(value, &usage);
+	checkInt(usage.slack, sizeof(jsonValue_t), "push, slack");
+	checkBool(usage.overhead > 0, "push, capacity bookkeeping");
+	checkInt(json_memory_usage(value, NULL), stats.bytes, "push, matches allocator");
+	
+	char* string = json_stringify(value);
+	checkBool(stats.peak > stats.bytes, "peak");
+	json_stats_free(&stats, string);
+	
+	json_free(value);
+	json_set_thread_allocator(NULL, NULL, NULL, NULL);
+	
+	checkInt(stats.bytes, 0, "stats, all freed");
+	checkInt(stats.allocations, stats.frees, "stats, balanced");
+	
+	jsonPool_t* pool = json_pool_new();
+	stats = (jsonAllocatorStats_t) {
+		.malloc = &json_pool_malloc,
+		.realloc = &json_pool_realloc,
+		.free = &json_pool_free,
+		.context = pool,
+	};
+	json_set_thread_allocator(&json_stats_malloc, &json_stats_realloc, &json_stats_free, &stats);
+	value = json_parse("[\"chained\", {\"to\": \"pool\"}]");
+	checkInt(json_memory_usage(value, NULL), stats.bytes, "chained, matches allocator");
+	json_free(value);
+	json_set_thread_allocator(NULL, NULL, NULL, NULL);
+	checkInt(stats.bytes, 0, "chained, all freed");
+	json_pool_destroy(pool);
+}
+
+void* limitedMalloc(void* context, size_t size) {
+	struct counter* counter = context;
+	if (counter->allocations == counter->frees + 8)
+		return NULL;
+	return countingMalloc(context, size);
+}
+
+void testCloneDeep() {
+	const size_t depth = 200000;
+	
+	jsonValue_t* value = json_string("bottom");
+	for (size_t i = 0; i < depth; i++) {
+		value = json_array(true, 1, value);
+	}
+	
+	jsonValue_t* cloned = json_clone(value);
+	checkNull(cloned, "deep, clone not null");
+	
+	size_t level = 0;
+	jsonValue_t* current = cloned;
+	while (current->type == JSON_ARRAY && current->value.array.size == 1) {
+		current = &(current->value.array.entries[0]);
+		level++;
+	}
+	checkInt(level, depth, "deep, depth");
+	checkString(current->value.string, "bottom", "deep, bottom");
+	
+	json_free(cloned);
+	json_free(value);
+	
+	value = json_parse("{\"a\": [1, \"two\", {\"b\": [\"c\", \"d\"]}], \"e\": \"f\"}");
+	
+	struct counter counter = { 0 };
+	json_set_thread_allocator(&limitedMalloc, &countingRealloc, &countingFree, &counter);
+	cloned = json_clone(value);
+	json_set_thread_allocator(NULL, NULL, NULL, NULL);
+	
+	checkBool(cloned == NULL, "failing, no clone");
+	checkInt(counter.allocations, counter.frees, "failing, balanced");
+	
+	json_free(value);
+}
+
+struct shareReader {
+	jsonValue_t* value;
+	const char* serialized;
+	uint64_t hash;
+};
+
+// serializes and hashes a share of the value, the infos inside are common to all threads
+static void* readShare(void* argument) {
+	struct shareReader* reader = argument;
+	bool okay = true;
+	
+	for (size_t i = 0; okay && i < 200; i++) {
+		jsonValue_t* share = json_share(reader->value);
+		char* string = json_stringify(share);
+		okay = strcmp(string, reader->serialized) == 0 && json_hash(share) == reader->hash && json_equal(share, reader->value);
+		free(string);
+		json_free(share);
+	}
+	
+	return okay ? reader : NULL;
+}
+
+// runs readShare() on four threads
+static bool readShares(jsonValue_t* value) {
+	jsonValue_t* clone = json_clone(value);
+	char* serialized = json_stringify(clone);
+	struct shareReader reader = { value, serialized, json_hash(clone) };
+	json_free(clone);
+	
+	pthread_t threads[4];
+	for (size_t i = 0; i < 4; i++) {
+		pthread_create(&threads[i], NULL, &readShare, &reader);
+	}
+	bool okay = true;
+	for (size_t i = 0; i < 4; i++) {
+		void* result;
+		pthread_join(threads[i], &result);
+		okay = okay && result == &reader;
+	}
+	
+	free(serialized);
+	
+	return okay;
+}
+
+void testShare() {
+	jsonValue_t* value = json_object(true, 2,
+		"a", json_object(true, 2,
+			"b", json_long(1),
+			"c", json_array(true, 2, json_string("foo"), json_null())
+		),
+		"d", json_array(true, 1, json_string("bar"))
+	);
+	
+	jsonValue_t* clone = json_share(value);
+	checkVoid(clone->value.object.entries, value->value.object.entries, "entries shared");
+	
+	checkInt(json_set(clone, ".a.b", json_long(2)), 0, "set, okay");
+	checkBool(clone->value.object.entries != value->value.object.entries, "root copied");
+	checkVoid(clone->value.object.entries[1].value.value.array.entries, value->value.object.entries[1].value.value.array.entries, "sibling still shared");
+	checkVoid(clone->value.object.entries[0].value.value.object.entries[1].value.value.array.entries, value->value.object.entries[0].value.value.object.entries[1].value.value.array.entries, "nested sibling still shared");
+	
+	char* string = json_stringify(value);
+	checkString(string, "{\"a\":{\"b\":1,\"c\":[\"foo\",null]},\"d\":[\"bar\"]}", "original unchanged");
+	free(string);
+	string = json_stringify(clone);
+	checkString(string, "{\"a\":{\"b\":2,\"c\":[\"foo\",null]},\"d\":[\"bar\"]}", "clone changed");
+	free(string);
+	
+	json_free(value);
+	string = json_stringify(clone);
+	checkString(string, "{\"a\":{\"b\":2,\"c\":[\"foo\",null]},\"d\":[\"bar\"]}", "clone outlives original");
+	free(string);
+	
+	json_set_shared_clones(true);
+	jsonValue_t* result = json_query(clone, ".d");
+	checkVoid(result->value.array.entries, clone->value.object.entries[1].value.value.array.entries, "query result shared");
+	json_free(result);
+	json_set_shared_clones(false);
+	
+	result = json_query(clone, ".d");
+	checkBool(result->value.array.entries != clone->value.object.entries[1].value.value.array.entries, "deep clone by default");
+	json_free(result);
+	
+	pthread_t threads[4];
+	for (size_t i = 0; i < 4; i++) {
+		pthread_create(&threads[i], NULL, &shareAndFree, clone);
+	}
+	for (size_t i = 0; i < 4; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	checkInt(json_stringify_length(clone), 42, "concurrent sharing");
+	
+	json_free(clone);
+	
+	char key[16];
+	value = json_object(true, 0);
+	for (long i = 0; i < 20; i++) {
+		snprintf(key, sizeof(key), "list%ld", i);
+		json_object_set(value, key, json_array(true, 4, json_string("a longer string"), json_long(i), json_string("so the output is cached"), json_null()));
+	}
+	json_cache(value);
+	
+	// every thread fills the emptied caches, only one of them is kept
+	json_set(value, ".list3.[1]", json_long(-3));
+	checkBool(readShares(value), "concurrent, dirty caches");
+	
+	// outdated caches are left alone until the next json_cache()
+	json_array_push(&value->value.object.entries[5].value, json_long(5));
+	checkBool(readShares(value), "concurrent, outdated caches");
+	json_cache(value);
+	checkBool(readShares(value), "concurrent, cached again");
+	
+	json_free(value);
+}
+
+void testMutate() {
+	jsonValue_t* array = json_array(true, 0);
+	for (long i = 0; i < 100000; i++) {
+		json_array_push(array, json_long(i));
+	}
+	checkInt(array->value.array.size, 100000, "push, size");
+	checkInt(array->value.array.entries[99999].value.integer, 99999, "push, last");
+	json_free(array);
+	
+	array = json_array(true, 2, json_long(1), json_long(3));
+	checkInt(json_array_insert(array, 1, json_long(2)), 0, "insert, okay");
+	checkInt(json_array_insert(array, 0, json_long(0)), 0, "insert front, okay");
+	jsonValue_t* value = json_long(5);
+	checkInt(json_array_insert(array, 10, value), -1, "insert out of range");
+	json_free(value);
+	checkInt(json_array_remove(array, 2), 0, "remove, okay");
+	checkInt(json_array_remove(array, 3), -1, "remove out of range");
+	char* string = json_stringify(array);
+	checkString(string, "[0,1,3]", "array content");
+	free(string);
+	
+	checkInt(json_reserve(array, 1000), 0, "reserve, okay");
+	jsonValue_t* entries = array->value.array.entries;
+	for (long i = 0; i < 997; i++) {
+		json_array_push(array, json_long(i));
+	}
+	checkVoid(array->value.array.entries, entries, "reserve, no reallocation");
+	
+	jsonValue_t* object = json_object(true, 0);
+	value = json_null();
+	checkInt(json_array_push(object, value), -1, "push on object");
+	json_free(value);
+	json_object_set(object, "a", json_long(1));
+	json_object_set(object, "b", json_string("foo"));
+	json_object_set(object, "c", array);
+	json_object_set(object, "a", json_long(2));
+	checkInt(object->value.object.size, 3, "object, size");
+	
+	value = json_object_take(object, "b");
+	checkString(value->value.string, "foo", "take, value");
+	json_free(value);
+	checkBool(json_object_take(object, "b") == NULL, "take missing");
+	checkInt(json_object_remove(object, "c"), 0, "remove, okay");
+	checkInt(json_object_remove(object, "c"), -1, "remove missing");
+	string = json_stringify(object);
+	checkString(string, "{\"a\":2}", "object content");
+	free(string);
+	
+	jsonValue_t* clone = json_share(object);
+	json_object_set(clone, "b", json_bool(true));
+	string = json_stringify(object);
+	checkString(string, "{\"a\":2}", "shared, original unchanged");
+	free(string);
+	string = json_stringify(clone);
+	checkString(string, "{\"a\":2,\"b\":true}", "shared, clone changed");
+	free(string);
+	json_free(clone);
+	json_free(object);
+	
+	const char* source = "[1, 2,  3]";
+	array = json_parse_with(source, strlen(source), JSON_PARSE_SPANS);
+	json_array_insert(array, 0, json_long(0));
+	string = json_stringify(array);
+	checkString(string, "[0,1,2,3]", "spans, modified");
+	free(string);
+	json_free(array);
+	
+	// the containers above a modified one don't write their old output
+	source = "{\"name\": \"nested containers with cached output\", \"list\": [1, 2, 3]}";
+	object = json_parse_with(source, strlen(source), JSON_PARSE_SPANS);
+	jsonValue_t* other = json_parse(source);
+	json_cache(other);
+	json_array_push(&object->value.object.entries[1].value, json_long(4));
+	json_array_push(&other->value.object.entries[1].value, json_long(4));
+	string = json_stringify(object);
+	checkString(string, "{\"name\":\"nested containers with cached output\",\"list\":[1,2,3,4]}", "nested push, spans");
+	free(string);
+	string = json_stringify(other);
+	checkString(string, "{\"name\":\"nested containers with cached output\",\"list\":[1,2,3,4]}", "nested push, cache");
+	free(string);
+	json_free(other);
+	json_free(object);
+	
+	// changed without json_invalidate(), so the old output shows as long as the cache is used
+	source = "{\"name\": \"two documents with their cached output\", \"list\": [1, 2, 3]}";
+	object = json_parse(source);
+	other = json_parse(source);
+	json_cache(object);
+	json_cache(other);
+	other->value.object.entries[1].value.value.array.entries[0].value.integer = 7;
+	json_array_push(&object->value.object.entries[1].value, json_long(4));
+	string = json_stringify(other);
+	checkString(string, "{\"name\":\"two documents with their cached output\",\"list\":[1,2,3]}", "other document, cache kept");
+	free(string);
+	
+	// containers added to a document invalidate it as well
+	json_set(object, ".added", json_array(true, 0));
+	json_cache(object);
+	json_array_push(&object->value.object.entries[2].value, json_long(5));
+	string = json_stringify(object);
+	checkString(string, "{\"name\":\"two documents with their cached output\",\"list\":[1,2,3,4],\"added\":[5]}", "added container, push");
+	free(string);
+	json_free(other);
+	json_free(object);
+	
+	array = json_array(true, 0);
+	for (long i = 0; i < 20; i++) {
+		jsonValue_t* inner = json_array(true, 0);
+		for (long j = 0; j < 20; j++) {
+			json_array_push(inner, json_long(j));
+		}
+		json_array_push(array, inner);
+	}
+	uint64_t hash = json_hash(array);
+	json_array_push(&array->value.array.entries[7], json_long(20));
+	checkBool(json_hash(array) != hash, "nested push, hash");
+	json_free(array);
+}
+
+char* persistentString(jsonPersistent_t* persistent, const char* query) {
+	jsonValue_t* value = json_persistent_value(json_persistent_get(persistent, query));
+	char* string = json_stringify(value);
+	json_free(value);
+	return string;
+}
+
+void* readPersistent(void* argument) {
+	jsonPersistent_t* version = argument;
+	long long sum = 0;
+	for (int i = 0; i < 1000; i++) {
+		jsonPersistent_t* entry = json_persistent_get(version, ".list.[999]");
+		jsonValue_t* value = json_persistent_value(entry);
+		sum += value->value.integer;
+		json_free(value);
+	}
+	json_persistent_release(version);
+	return (void*) (sum == 999000 ? 1L : 0L);
+}
+
+void testPersistent() {
+	jsonValue_t* value = json_parse("{\"a\": {\"b\": 1, \"c\": [\"foo\", null]}, \"d\": [\"bar\"], \"e\": true}");
+	jsonPersistent_t* first = json_persistent_new(value);
+	json_free(value);
+	
+	checkInt(json_persistent_type(first), JSON_OBJECT, "type");
+	checkInt(json_persistent_size(first), 3, "size");
+	
+	jsonPersistent_t* second = json_persistent_set(first, ".a.b", json_long(2));
+	checkNull(second, "set, okay");
+	checkBool(json_persistent_get(first, ".a") != json_persistent_get(second, ".a"), "set, path copied");
+	checkVoid(json_persistent_get(first, ".a.c"), json_persistent_get(second, ".a.c"), "set, sibling shared");
+	checkVoid(json_persistent_get(first, ".d"), json_persistent_get(second, ".d"), "set, other subtree shared");
+	
+	char* string = persistentString(first, "");
+	checkString(string, "{\"a\":{\"b\":1,\"c\":[\"foo\",null]},\"d\":[\"bar\"],\"e\":true}", "set, old version unchanged");
+	free(string);
+	string = persistentString(second, "");
+	checkString(string, "{\"a\":{\"b\":2,\"c\":[\"foo\",null]},\"d\":[\"bar\"],\"e\":true}", "set, new version");
+	free(string);
+	
+	jsonPersistent_t* third = json_persistent_remove(second, ".d");
+	checkNull(third, "remove, okay");
+	checkBool(json_persistent_remove(second, ".x") == NULL, "remove, missing key");
+	checkBool(json_persistent_set(second, ".x.y", json_long(1)) == NULL, "set, missing parent");
+	
+	jsonPersistent_t* fourth = json_persistent_set(third, ".d", json_string("back"));
+	string = persistentString(fourth, "");
+	checkString(string, "{\"a\":{\"b\":2,\"c\":[\"foo\",null]},\"e\":true,\"d\":\"back\"}", "insertion order");
+	free(string);
+	string = persistentString(second, "");
+	checkString(string, "{\"a\":{\"b\":2,\"c\":[\"foo\",null]},\"d\":[\"bar\"],\"e\":true}", "remove, old version unchanged");
+	free(string);
+	
+	json_persistent_release(first);
+	json_persistent_release(third);
+	json_persistent_release(fourth);
+	
+	string = persistentString(second, ".a.c");
+	checkString(string, "[\"foo\",null]", "outlives other versions");
+	free(string);
+	json_persistent_release(second);
+	
+	value = json_parse("{\"list\": [], \"map\": {}}");
+	jsonPersistent_t* version = json_persistent_new(value);
+	json_free(value);
+	
+	char query[32];
+	for (long i = 0; i < 2000; i++) {
+		snprintf(query, sizeof(query), ".list.[%ld]", i);
+		jsonPersistent_t* next = json_persistent_set(version, query, json_long(i));
+		json_persistent_release(version);
+		version = next;
+		
+		snprintf(query, sizeof(query), ".map.k%ld", i);
+		next = json_persistent_set(version, query, json_long(i));
+		json_persistent_release(version);
+		version = next;
+	}
+	checkInt(json_persistent_size(json_persistent_get(version, ".list")), 2000, "array, size");
+	checkInt(json_persistent_size(json_persistent_get(version, ".map")), 2000, "object, size");
+	
+	value = json_persistent_value(version);
+	bool okay = value->value.object.entries[0].value.value.array.size == 2000 && value->value.object.entries[1].value.value.object.size == 2000;
+	for (long i = 0; okay && i < 2000; i++) {
+		snprintf(query, sizeof(query), "k%ld", i);
+		okay = value->value.object.entries[0].value.value.array.entries[i].value.integer == i
+			&& strcmp(value->value.object.entries[1].value.value.object.entries[i].key, query) == 0
+			&& value->value.object.entries[1].value.value.object.entries[i].value.value.integer == i;
+	}
+	checkBool(okay, "round trip, order");
+	
+	jsonPersistent_t* copy = json_persistent_new(value);
+	json_free(value);
+	
+	for (long i = 0; i < 2000; i += 2) {
+		snprintf(query, sizeof(query), ".map.k%ld", i);
+		jsonPersistent_t* next = json_persistent_remove(copy, query);
+		json_persistent_release(copy);
+		copy = next;
+	}
+	for (long i = 1999; i >= 1000; i--) {
+		snprintf(query, sizeof(query), ".list.[%ld]", i);
+		jsonPersistent_t* next = json_persistent_remove(copy, query);
+		json_persistent_release(copy);
+		copy = next;
+	}
+	jsonPersistent_t* next = json_persistent_remove(copy, ".list.[0]");
+	json_persistent_release(copy);
+	copy = next;
+	
+	value = json_persistent_value(copy);
+	jsonValue_t* list = &value->value.object.entries[0].value;
+	jsonValue_t* map = &value->value.object.entries[1].value;
+	okay = list->value.array.size == 999 && map->value.object.size == 1000;
+	for (long i = 0; okay && i < 999; i++) {
+		okay = list->value.array.entries[i].value.integer == i + 1;
+	}
+	for (long i = 0; okay && i < 1000; i++) {
+		snprintf(query, sizeof(query), "k%ld", 2 * i + 1);
+		okay = strcmp(map->value.object.entries[i].key, query) == 0;
+	}
+	checkBool(okay, "remove, remaining entries");
+	json_free(value);
+	
+	pthread_t threads[4];
+	for (size_t i = 0; i < 4; i++) {
+		pthread_create(&threads[i], NULL, &readPersistent, json_persistent_retain(version));
+	}
+	for (long i = 0; i < 100; i++) {
+		snprintf(query, sizeof(query), ".list.[%ld]", i);
+		jsonPersistent_t* next = json_persistent_set(version, query, json_long(-i));
+		json_persistent_release(version);
+		version = next;
+	}
+	okay = true;
+	for (size_t i = 0; i < 4; i++) {
+		void* result;
+		pthread_join(threads[i], &result);
+		okay = okay && result != NULL;
+	}
+	checkBool(okay, "concurrent readers");
+	
+	json_persistent_release(version);
+	json_persistent_release(copy);
+}
+
+struct frozenReader {
+	jsonValue_t* value;
+	const char* serialized;
+	uint64_t hash;
+};
+
+static void* readFrozen(void* argument) {
+	struct frozenReader* reader = argument;
+	jsonQuery_t* queries[2] = { json_query_compile(".routes.r17.target"), json_query_compile(".list.[*].weight") };
+	char query[64];
+	bool okay = true;
+	
+	for (long round = 0; okay && round < 20; round++) {
+		for (long i = 0; okay && i < 1000; i += 7) {
+			snprintf(query, sizeof(query), ".routes.r%ld.weight", i);
+			jsonValue_t* result = json_query(reader->value, query);
+			okay = result != NULL && result->type == JSON_LONG && result->value.integer == i;
+			json_free(result);
+		}
+		
+		jsonValue_t* results[2];
+		okay = okay && json_query_many(reader->value, queries, 2, results) == 0;
+		if (okay) {
+			okay = results[0]->type == JSON_STRING && strcmp(results[0]->value.string, "host-17") == 0 && results[1]->value.array.size == 3;
+			json_free(results[0]);
+			json_free(results[1]);
+		}
+		
+		char* string = json_stringify(reader->value);
+		okay = okay && strcmp(string, reader->serialized) == 0;
+		free(string);
+		
+		jsonValue_t* share = json_share(reader->value);
+		okay = okay && json_hash(reader->value) == reader->hash && json_equal(share, reader->value);
+		json_free(share);
+	}
+	
+	json_query_free(queries[0]);
+	json_query_free(queries[1]);
+	
+	return okay ? reader : NULL;
+}
+
+void testFreeze() {
+	char key[32];
+	char target[32];
+	jsonValue_t* routes = json_object(true, 0);
+	for (long i = 0; i < 1000; i++) {
+		snprintf(key, sizeof(key), "r%ld", i);
+		snprintf(target, sizeof(target), "host-%ld", i);
+		json_object_set(routes, key, json_object(true, 2, "target", json_string(target), "weight", json_long(i)));
+	}
+	jsonValue_t* value = json_object(true, 3,
+		"routes", routes,
+		"list", json_parse("[{\"weight\": 1}, {\"weight\": 2}, {\"weight\": 3}]"),
+		"duplicates", json_parse("{\"k0\":0,\"k1\":1,\"k2\":2,\"k3\":3,\"k4\":4,\"k5\":5,\"k6\":6,\"k7\":7,\"k8\":8,\"k9\":9,"
+			"\"k10\":10,\"k11\":11,\"k12\":12,\"k13\":13,\"k14\":14,\"k15\":15,\"k3\":-3}")
+	);
+	
+	// cached containers that are dirty get their output back
+	json_cache(value);
+	json_set(value, ".list.[1].weight", json_long(2));
+	char* serialized = json_stringify(value);
+	
+	checkBool(!json_frozen(value), "not frozen");
+	checkInt(json_freeze(value), 0, "freeze, okay");
+	checkBool(json_frozen(value) && json_frozen(&value->value.object.entries[1].value), "frozen");
+	checkInt(json_freeze(value), 0, "freeze again, okay");
+	
+	jsonValue_t* result = json_query(value, ".routes.r999.target");
+	checkString(result->value.string, "host-999", "indexed lookup");
+	json_free(result);
+	result = json_query(value, ".routes.missing");
+	checkInt(result->type, JSON_NULL, "indexed lookup, missing key");
+	json_free(result);
+	result = json_object_get(&value->value.object.entries[2].value, "k3");
+	checkInt(result->value.integer, 3, "indexed lookup, duplicates");
+	json_free(result);
+	
+	jsonValue_t* entry = json_long(1);
+	checkInt(json_set(value, ".routes.r1.weight", entry), -1, "set fails");
+	checkInt(json_set(value, "", entry), -1, "set root fails");
+	checkInt(json_array_push(&value->value.object.entries[1].value, entry), -1, "push fails");
+	checkInt(json_object_set(&value->value.object.entries[0].value, "new", entry), -1, "object set fails");
+	json_free(entry);
+	checkInt(json_object_remove(&value->value.object.entries[2].value, "k1"), -1, "remove fails");
+	jsonValue_t* patch = json_parse("[{\"op\": \"remove\", \"path\": \"/list/0\"}]");
+	checkInt(json_patch_apply(value, patch), -1, "patch fails");
+	json_free(patch);
+	patch = json_parse("[{\"op\": \"replace\", \"path\": \"\", \"value\": 5}]");
+	checkInt(json_patch_apply(value, patch), -1, "patch root fails");
+	json_free(patch);
+	patch = json_parse("7");
+	checkInt(json_merge_patch_apply(value, patch), -1, "merge patch root fails");
+	json_free(patch);
+	json_uncache(value);
+	
+	char* string = json_stringify(value);
+	checkString(string, serialized, "unchanged");
+	free(string);
+	
+	jsonValue_t* clone = json_clone(value);
+	checkBool(!json_frozen(clone), "clone not frozen");
+	checkInt(json_set(clone, ".routes.r1.weight", json_long(-1)), 0, "clone modifiable");
+	json_free(clone);
+	
+	json_set_shared_clones(true);
+	clone = json_clone(value);
+	json_set_shared_clones(false);
+	checkInt(json_set(clone, ".routes.r1.weight", json_long(-1)), 0, "shared clone modifiable");
+	checkBool(!json_frozen(clone) && json_frozen(value), "shared clone, copied");
+	json_free(clone);
+	
+	jsonValue_t* original = json_parse("{\"list\": [1, 2, 3]}");
+	clone = json_share(original);
+	checkInt(json_freeze(clone), 0, "freeze share, okay");
+	checkBool(!json_frozen(original), "freeze share, original");
+	checkInt(json_array_push(&original->value.object.entries[0].value, json_long(4)), 0, "freeze share, modifiable");
+	json_free(clone);
+	json_free(original);
+	
+	struct frozenReader reader = { .value = value, .serialized = serialized, .hash = json_hash(value) };
+	pthread_t threads[4];
+	for (size_t i = 0; i < 4; i++) {
+		pthread_create(&threads[i], NULL, &readFrozen, &reader);
+	}
+	bool okay = true;
+	for (size_t i = 0; i < 4; i++) {
+		void* result;
+		pthread_join(threads[i], &result);
+		okay = okay && result != NULL;
+	}
+	checkBool(okay, "concurrent readers");
+	
+	free(serialized);
+	json_free(value);
+}
+
+static size_t allocationBudget;
+
+static void* budgetMalloc(void* context, size_t size) {
+	if (allocationBudget == 0)
+		return NULL;
+	allocationBudget--;
+	return countingMalloc(context, size);
+}
+
+void testIntern() {
+	const char* text = "{\"items\": ["
+		"{\"address\": {\"street\": \"Main St\", \"city\": \"Springfield\"}, \"tags\": [\"new\", \"sale\"]},"
+		"{\"address\": {\"street\": \"Main St\", \"city\": \"Springfield\"}, \"tags\": [\"new\", \"sale\"]},"
+		"{\"address\": {\"street\": \"Elm St\", \"city\": \"Springfield\"}, \"tags\": [\"new\", \"sale\"]},"
+		"{\"address\": {}, \"tags\": []}"
+	"]}";
+	jsonValue_t* reference = json_parse(text);
+	
+	jsonAllocatorStats_t stats = { 0 };
+	json_set_thread_allocator(&json_stats_malloc, &json_stats_realloc, &json_stats_free, &stats);
+	jsonValue_t* value = json_parse(text);
+	for (size_t i = 0; i < 16; i++) {
+		json_array_push(&value->value.object.entries[0].value, json_clone(&value->value.object.entries[0].value.value.array.entries[0]));
+	}
+	size_t before = stats.bytes;
+	json_intern_subtrees(value);
+	checkBool(stats.bytes < before, "less memory");
+	json_free(value);
+	json_set_thread_allocator(NULL, NULL, NULL, NULL);
+	checkInt(stats.bytes, 0, "all freed");
+	
+	value = json_parse(text);
+	checkInt(json_intern_subtrees(value), 0, "okay");
+	checkBool(json_equal(value, reference), "unchanged");
+	jsonValue_t* items = &value->value.object.entries[0].value;
+	jsonValue_t* first = &items->value.array.entries[0];
+	jsonValue_t* third = &items->value.array.entries[2];
+	checkVoid(items->value.array.entries[1].value.object.entries, first->value.object.entries, "equal objects shared");
+	checkVoid(third->value.object.entries[1].value.value.array.entries, first->value.object.entries[1].value.value.array.entries, "equal arrays shared");
+	checkBool(third->value.object.entries[0].value.value.object.entries != first->value.object.entries[0].value.value.object.entries, "different objects separate");
+	
+	checkInt(json_set(value, ".items.[1].address.city", json_string("Shelbyville")), 0, "set, okay");
+	char* string = json_stringify(first);
+	checkString(string, "{\"address\":{\"street\":\"Main St\",\"city\":\"Springfield\"},\"tags\":[\"new\",\"sale\"]}", "set, copy on write");
+	free(string);
+	json_free(value);
+	
+	value = json_parse_with(text, strlen(text), JSON_PARSE_INTERN | JSON_PARSE_SPANS);
+	items = &value->value.object.entries[0].value;
+	checkVoid(items->value.array.entries[1].value.object.entries, items->value.array.entries[0].value.object.entries, "parse, shared");
+	jsonValue_t* spans = json_parse_with(text, strlen(text), JSON_PARSE_SPANS);
+	string = json_stringify(value);
+	char* compare = json_stringify(spans);
+	json_free(spans);
+	checkString(string, compare, "parse, stringify");
+	free(string);
+	free(compare);
+	
+	json_freeze(value);
+	checkInt(json_intern_subtrees(value), -1, "frozen fails");
+	json_free(value);
+	
+	bool okay = true;
+	for (size_t budget = 0; okay && budget < 16; budget++) {
+		value = json_clone(reference);
+		struct counter counter = { 0 };
+		allocationBudget = budget;
+		json_set_thread_allocator(&budgetMalloc, &countingRealloc, &countingFree, &counter);
+		int result = json_intern_subtrees(value);
+		json_set_thread_allocator(NULL, NULL, NULL, NULL);
+		okay = json_equal(value, reference) && (budget > 0 || result < 0);
+		json_free(value);
+	}
+	checkBool(okay, "failing allocator, complete");
+	
+	json_free(reference);
+}
+
+void testEqual() {
+	jsonValue_t* a = json_parse("{\"a\": [1, 2.5, \"x\", null, true], \"b\": {\"c\": \"d\", \"e\": -0.0}}");
+	jsonValue_t* b = json_object(true, 2,
+		"a", json_array(true, 5, json_long(1), json_double(2.5), json_string("x"), json_null(), json_bool(true)),
+		"b", json_object(true, 2, "c", json_string("d"), "e", json_double(0.0))
+	);
+	jsonValue_t* c = json_parse("{\"b\": {\"e\": 0.0, \"c\": \"d\"}, \"a\": [1, 2.5, \"x\", null, true]}");
+	jsonValue_t* d = json_parse("{\"a\": [1, 2.5, \"x\", null, false], \"b\": {\"c\": \"d\", \"e\": 0.0}}");
+	
+	checkBool(json_equal(a, b), "equal");
+	checkBool(json_hash(a) == json_hash(b), "equal, hash");
+	checkBool(!json_equal(a, c), "reordered, not equal");
+	checkBool(json_equal_with(a, c, JSON_EQUAL_UNORDERED), "reordered, equal unordered");
+	checkBool(json_hash(a) == json_hash(c), "reordered, hash");
+	checkBool(!json_equal_with(a, d, JSON_EQUAL_UNORDERED), "different");
+	checkBool(json_hash(a) != json_hash(d), "different, hash");
+	
+	jsonValue_t* integer = json_long(1);
+	jsonValue_t* real = json_double(1.0);
+	checkBool(!json_equal(integer, real), "types differ");
+	json_free(integer);
+	json_free(real);
+	
+	json_free(a);
+	json_free(b);
+	json_free(c);
+	json_free(d);
+	
+	char key[16];
+	a = json_object(true, 0);
+	b = json_object(true, 0);
+	for (long i = 0; i < 100; i++) {
+		snprintf(key, sizeof(key), "k%ld", i);
+		json_object_set(a, key, json_long(i));
+		snprintf(key, sizeof(key), "k%ld", 99 - i);
+		json_object_set(b, key, json_long(99 - i));
+	}
+	
+	uint64_t hash = json_hash(a);
+	checkBool(hash == json_hash(b), "large, hash");
+	checkBool(json_equal_with(a, b, JSON_EQUAL_UNORDERED), "large, equal unordered");
+	
+	json_set(b, ".k42", json_long(-1));
+	checkBool(json_hash(b) != hash, "modified, hash changed");
+	checkBool(!json_equal_with(a, b, JSON_EQUAL_UNORDERED), "modified, not equal");
+	json_set(b, ".k42", json_long(42));
+	checkBool(json_hash(b) == hash, "restored, hash");
+	
+	c = json_share(a);
+	checkBool(json_equal(a, c), "shared, equal");
+	json_free(c);
+	
+	// the stored hashes are shared by all threads
+	json_set(a, ".k7", json_array(true, 2, json_long(7), json_long(7)));
+	checkBool(readShares(a), "shared, concurrent hashes");
+	hash = json_hash(a);
+	json_array_push(&a->value.object.entries[7].value, json_long(7));
+	checkBool(json_hash(a) != hash, "nested push, hash changed");
+	checkBool(readShares(a), "pushed, concurrent hashes");
+	
+	json_free(a);
+	json_free(b);
+}
+
+void checkPatch(const char* document, const char* patch, const char* expected, const char* check) {
+	jsonValue_t* value = json_parse(document);
+	jsonValue_t* operations = json_parse(patch);
+	
+	int result = json_patch_apply(value, operations);
+	if (expected == NULL) {
+		checkInt(result, -1, check);
+		jsonValue_t* original = json_parse(document);
+		checkBool(json_equal(value, original), "unchanged after failure");
+		json_free(original);
+	} else {
+		checkInt(result, 0, check);
+		char* string = json_stringify(value);
+		checkString(string, expected, check);
+		free(string);
+	}
+	
+	json_free(operations);
+	json_free(value);
+}
+
+void checkDiff(const char* a, const char* b, size_t operations, const char* check) {
+	jsonValue_t* valueA = json_parse(a);
+	jsonValue_t* valueB = json_parse(b);
+	
+	jsonValue_t* patch = json_diff(valueA, valueB);
+	checkInt(patch->value.array.size, operations, check);
+	checkInt(json_patch_apply(valueA, patch), 0, check);
+	checkBool(json_equal_with(valueA, valueB, JSON_EQUAL_UNORDERED), check);
+	
+	json_free(patch);
+	json_free(valueA);
+	json_free(valueB);
+}
+
+void testPatch() {
+	checkPatch("{\"foo\": \"bar\"}", "[{\"op\": \"add\", \"path\": \"/baz\", \"value\": \"qux\"}]", "{\"foo\":\"bar\",\"baz\":\"qux\"}", "add member");
+	checkPatch("{\"foo\": [\"bar\", \"baz\"]}", "[{\"op\": \"add\", \"path\": \"/foo/1\", \"value\": \"qux\"}]", "{\"foo\":[\"bar\",\"qux\",\"baz\"]}", "add element");
+	checkPatch("{\"foo\": [\"bar\"]}", "[{\"op\": \"add\", \"path\": \"/foo/-\", \"value\": 1}]", "{\"foo\":[\"bar\",1]}", "add at end");
+	checkPatch("{\"baz\": \"qux\", \"foo\": \"bar\"}", "[{\"op\": \"remove\", \"path\": \"/baz\"}]", "{\"foo\":\"bar\"}", "remove member");
+	checkPatch("{\"baz\": \"qux\", \"foo\": \"bar\"}", "[{\"op\": \"replace\", \"path\": \"/baz\", \"value\": \"boo\"}]", "{\"baz\":\"boo\",\"foo\":\"bar\"}", "replace");
+	checkPatch("{\"foo\": {\"bar\": \"baz\", \"waldo\": \"fred\"}, \"qux\": {\"corge\": \"grault\"}}", "[{\"op\": \"move\", \"from\": \"/foo/waldo\", \"path\": \"/qux/thud\"}]", "{\"foo\":{\"bar\":\"baz\"},\"qux\":{\"corge\":\"grault\",\"thud\":\"fred\"}}", "move");
+	checkPatch("{\"foo\": [\"all\", \"grass\", \"cows\", \"eat\"]}", "[{\"op\": \"move\", \"from\": \"/foo/1\", \"path\": \"/foo/3\"}]", "{\"foo\":[\"all\",\"cows\",\"eat\",\"grass\"]}", "move element");
+	checkPatch("{\"a\": {\"b\": 1}}", "[{\"op\": \"copy\", \"from\": \"/a\", \"path\": \"/c\"}, {\"op\": \"replace\", \"path\": \"/c/b\", \"value\": 2}]", "{\"a\":{\"b\":1},\"c\":{\"b\":2}}", "copy");
+	checkPatch("{\"/\": 1, \"m~n\": 2}", "[{\"op\": \"test\", \"path\": \"/~1\", \"value\": 1}, {\"op\": \"remove\", \"path\": \"/m~0n\"}]", "{\"\\/\":1}", "escaped keys");
+	checkPatch("{\"foo\": \"bar\"}", "[{\"op\": \"replace\", \"path\": \"\", \"value\": [1]}]", "[1]", "replace root");
+	
+	checkPatch("{\"baz\": \"qux\"}", "[{\"op\": \"add\", \"path\": \"/x\", \"value\": 1}, {\"op\": \"test\", \"path\": \"/baz\", \"value\": \"bar\"}]", NULL, "failed test");
+	checkPatch("{\"foo\": \"bar\"}", "[{\"op\": \"add\", \"path\": \"/baz/bat\", \"value\": \"qux\"}]", NULL, "missing parent");
+	checkPatch("{\"foo\": [1]}", "[{\"op\": \"add\", \"path\": \"/foo/01\", \"value\": 2}]", NULL, "leading zero");
+	checkPatch("{\"a\": {\"b\": 1}}", "[{\"op\": \"move\", \"from\": \"/a\", \"path\": \"/a/c\"}]", NULL, "move into child");
+	checkPatch("{\"a\": 1}", "[{\"op\": \"jump\", \"path\": \"/a\"}]", NULL, "unknown operation");
+	
+	checkDiff("{\"a\": 1, \"b\": [1, 2, 3], \"c\": {\"d\": true}}", "{\"a\": 1, \"b\": [1, 2, 3], \"c\": {\"d\": true}}", 0, "diff, equal");
+	checkDiff("{\"a\": 1, \"b\": [1, 2, 3], \"c\": {\"d\": true}}", "{\"c\": {\"d\": false}, \"b\": [1, 3], \"e\": null}", 4, "diff, changes");
+	checkDiff("[1, 2, 3, 4, 5]", "[1, 2, 9, 8, 7, 4, 5]", 3, "diff, inserted");
+	checkDiff("{\"a~/b\": [{\"x\": 1}]}", "{\"a~/b\": [{\"x\": 2}]}", 1, "diff, escaping");
+	checkDiff("{\"a\": 1}", "[1]", 1, "diff, root");
+	
+	jsonValue_t* a = json_array(true, 0);
+	for (long i = 0; i < 1000; i++) {
+		json_array_push(a, json_object(true, 2, "id", json_long(i), "tags", json_array(true, 1, json_string("x"))));
+	}
+	jsonValue_t* b = json_clone(a);
+	json_set(b, ".[500].id", json_long(-1));
+	
+	jsonValue_t* patch = json_diff(a, b);
+	char* string = json_stringify(patch);
+	checkString(string, "[{\"op\":\"replace\",\"path\":\"\\/500\\/id\",\"value\":-1}]", "diff, large");
+	free(string);
+	json_free(patch);
+	json_free(a);
+	json_free(b);
+	
+	jsonValue_t* value = json_parse("{\"title\": \"Goodbye!\", \"author\": {\"givenName\": \"John\", \"familyName\": \"Doe\"}, \"tags\": [\"example\", \"sample\"], \"content\": \"This will be unchanged\"}");
+	jsonValue_t* merge = json_parse("{\"title\": \"Hello!\", \"phoneNumber\": \"+01-123-456-7890\", \"author\": {\"familyName\": null}, \"tags\": [\"example\"], \"x\": {\"y\": null, \"z\": 1}}");
+	checkInt(json_merge_patch_apply(value, merge), 0, "merge patch");
+	string = json_stringify(value);
+	checkString(string, "{\"title\":\"Hello!\",\"author\":{\"givenName\":\"John\"},\"tags\":[\"example\"],\"content\":\"This will be unchanged\",\"phoneNumber\":\"+01-123-456-7890\",\"x\":{\"z\":1}}", "merge patch, result");
+	free(string);
+	json_free(merge);
 	json_free(value);
 }
 
@@ -344,20 +2035,45 @@ void testClone() {
 int main(int argc, char** argv) {
 	header("Types");
 	test("double", &testDouble);
+	test("number format", &testNumberFormat);
 	test("long", &testLong);
 	test("bool", &testBool);
 	test("string", &testString);
+	test("string escape", &testStringEscape);
 	test("null", &testNull);
 	test("array", &testArray);
 	test("array", &testObject);
+	test("large", &testStringifyLarge);
+	test("stream", &testStringifyStream);
+	test("iovec", &testStringifyIov);
+	test("caller buffer", &testStringifyBuffer);
+	test("parallel", &testStringifyParallel);
+	test("writer", &testWriter);
+	test("cache", &testCache);
 	
 	header("Functionality");
 	test("parse", &testParse);
+	test("parse spans", &testParseSpans);
 	test("query", &testQuery);
+	test("query many", &testQueryMany);
+	test("query iterator", &testQueryIterator);
+	test("query text", &testQueryText);
 	test("clone", &testClone);
+	test("clone deep", &testCloneDeep);
+	test("share", &testShare);
+	test("mutate", &testMutate);
+	test("persistent", &testPersistent);
+	test("freeze", &testFreeze);
+	test("intern", &testIntern);
+	test("equal", &testEqual);
+	test("patch", &testPatch);
+	test("allocator", &testAllocator);
+	test("memory", &testMemory);
+	test("columns", &testColumns);
+	test("reduce", &testReduce);
+	
+	
 	
-
-
 	printf("\nOverall: %s\n", overall ? "OK" : "FAILED");
 	
 	return overall ? 0 : 1;